@@ -2,6 +2,9 @@
 
 #include "livegrapher/ClientConnection.hpp"
 
+#include <algorithm>
+#include <cerrno>
+
 #ifdef _WIN32
 #pragma warning(disable : 4267)
 #endif
@@ -18,23 +21,255 @@ bool ClientConnection::IsGraphSelected(uint8_t id) {
     return m_datasets & (1LL << id);
 }
 
-void ClientConnection::AddData(std::string_view data) {
-    for (size_t i = 0; i < data.size(); ++i) {
-        m_writeQueue.emplace_back(data[i]);
+uint64_t ClientConnection::Selection() const { return m_datasets; }
+
+void ClientConnection::SetSelection(uint64_t selection) {
+    m_datasets = selection;
+}
+
+void ClientConnection::SubscribeCatalog() { m_catalogSubscribed = true; }
+
+bool ClientConnection::IsCatalogSubscribed() const {
+    return m_catalogSubscribed;
+}
+
+void ClientConnection::AcceptExtendedPackets() {
+    m_acceptsExtendedPackets = true;
+}
+
+bool ClientConnection::AcceptsExtendedPackets() const {
+    return m_acceptsExtendedPackets;
+}
+
+void ClientConnection::SetNativeSamples(bool enabled) {
+    m_nativeSamples = enabled;
+}
+
+bool ClientConnection::NativeSamples() const { return m_nativeSamples; }
+
+void ClientConnection::SetSessionToken(uint64_t token) {
+    m_sessionToken = token;
+}
+
+uint64_t ClientConnection::SessionToken() const { return m_sessionToken; }
+
+void ClientConnection::SetMarkedSequence(uint64_t sequence) {
+    m_markedSequence = sequence;
+}
+
+uint64_t ClientConnection::MarkedSequence() const { return m_markedSequence; }
+
+void ClientConnection::SetReplay(uint64_t cursor, uint64_t end) {
+    m_replayCursor = cursor;
+    m_replayEnd = end;
+}
+
+uint64_t ClientConnection::ReplayCursor() const { return m_replayCursor; }
+
+uint64_t ClientConnection::ReplayEnd() const { return m_replayEnd; }
+
+bool ClientConnection::IsReplaying() const {
+    return m_replayCursor < m_replayEnd;
+}
+
+std::deque<ClientConnection::RangeTransfer>&
+ClientConnection::RangeTransfers() {
+    return m_rangeTransfers;
+}
+
+void ClientConnection::RequestClose() { m_closeRequested = true; }
+
+bool ClientConnection::IsCloseRequested() const { return m_closeRequested; }
+
+void ClientConnection::SetFlushPolicy(size_t bytes,
+                                      std::chrono::microseconds delay) {
+    m_flushBytes = bytes;
+    m_flushDelay = delay;
+}
+
+void ClientConnection::RequestFlushPolicy(size_t bytes,
+                                          std::chrono::microseconds delay) {
+    SetFlushPolicy(bytes, delay);
+    m_flushPolicyRequested = true;
+}
+
+bool ClientConnection::IsFlushPolicyRequested() const {
+    return m_flushPolicyRequested;
+}
+
+bool ClientConnection::AddData(std::string_view data) {
+    if (data.empty()) {
+        return false;
+    }
+
+    bool wasEmpty = m_writeQueue.empty();
+    if (wasEmpty) {
+        m_lastProgress = std::chrono::steady_clock::now();
+        m_flushDeadline = m_lastProgress + m_flushDelay;
+    }
+
+    size_t oldSize = m_writeQueue.size();
+    m_writeQueue.insert(m_writeQueue.end(), data.begin(), data.end());
+    m_bytesAdded += data.size();
+
+    return wasEmpty || (m_flushBytes > 0 && oldSize < m_flushBytes &&
+                        m_writeQueue.size() >= m_flushBytes);
+}
+
+bool ClientConnection::AddSample(
+    std::string_view data, uint8_t id,
+    std::chrono::steady_clock::time_point enqueueTime) {
+    bool wake = AddData(data);
+    m_queuedSamples.push_back({m_bytesAdded, enqueueTime, id});
+    return wake;
+}
+
+void ClientConnection::AddBulkData(std::string packet) {
+    if (packet.empty()) {
+        return;
+    }
+
+    // The client has to start accepting data again before it's considered
+    // stalled
+    if (!HasDataToWrite()) {
+        m_lastProgress = std::chrono::steady_clock::now();
+    }
+
+    m_bulkBytes += packet.size();
+    m_bulkQueue.emplace_back(std::move(packet));
+}
+
+TokenBucket& ClientConnection::Budget() { return m_budget; }
+
+void ClientConnection::CountSample(uint8_t priority, bool queued) {
+    if (queued) {
+        ++m_samplesAdmitted[priority];
+    } else {
+        ++m_samplesShed[priority];
     }
 }
 
+uint64_t ClientConnection::SamplesAdmitted(uint8_t priority) const {
+    return m_samplesAdmitted[priority];
+}
+
+uint64_t ClientConnection::SamplesShed(uint8_t priority) const {
+    return m_samplesShed[priority];
+}
+
 bool ClientConnection::HasDataToWrite() const {
-    return m_writeQueue.size() > 0;
+    return m_writeQueue.size() > 0 || !m_bulkQueue.empty();
+}
+
+bool ClientConnection::IsFlushDue(
+    std::chrono::steady_clock::time_point now) const {
+    // Bulk packets are large enough that coalescing them gains nothing
+    if (m_writeQueue.empty()) {
+        return !m_bulkQueue.empty();
+    }
+
+    return (m_flushBytes > 0 && m_writeQueue.size() >= m_flushBytes) ||
+           now >= m_flushDeadline;
 }
 
-bool ClientConnection::WriteToSocket() {
-    int count = socket.Write(
-        std::string_view{m_writeQueue.data(), m_writeQueue.size()});
+std::chrono::steady_clock::time_point ClientConnection::FlushDeadline() const {
+    return m_flushDeadline;
+}
+
+void ClientConnection::SetWriteInterest(bool interest) {
+    m_writeInterest = interest;
+}
+
+bool ClientConnection::HasWriteInterest() const { return m_writeInterest; }
+
+bool ClientConnection::ReceiveFromSocket() {
+    size_t size = m_receiveBuffer.size();
+    m_receiveBuffer.resize(size + kReceiveChunkSize);
+    int count = socket.ReadAvailable(m_receiveBuffer.data() + size,
+                                     kReceiveChunkSize);
+    int error = Socket::LastError();
+    m_receiveBuffer.resize(size + std::max(count, 0));
+
+    // The socket is nonblocking, so having no data isn't an error
+    if (count == -1 && (error == EAGAIN || error == Socket::kWouldBlock)) {
+        return true;
+    }
+    return count > 0;
+}
+
+std::string_view ClientConnection::ReceivedData() const {
+    return m_receiveBuffer;
+}
+
+void ClientConnection::ConsumeReceived(size_t count) {
+    m_receiveBuffer.erase(0, count);
+}
+
+bool ClientConnection::WriteToSocket(LatencyHistogram* datasetLatency,
+                                     size_t maxBytes) {
+    // Live data goes first, so a bulk packet is only moved to the write queue
+    // once it's empty
+    if (m_writeQueue.empty() && !m_bulkQueue.empty()) {
+        auto& packet = m_bulkQueue.front();
+        m_writeQueue.insert(m_writeQueue.end(), packet.begin(), packet.end());
+        m_bytesAdded += packet.size();
+        m_bulkBytes -= packet.size();
+        m_bulkQueue.pop_front();
+    }
+
+    int count = socket.Write(std::string_view{
+        m_writeQueue.data(), std::min(m_writeQueue.size(), maxBytes)});
     if (count == -1) {
         return false;
     } else {
         m_writeQueue.erase(m_writeQueue.begin(), m_writeQueue.begin() + count);
+        m_bytesSent += count;
+
+        if (count > 0) {
+            m_lastProgress = std::chrono::steady_clock::now();
+        }
+
+        // Release the memory held by a backlog once it's drained
+        if (m_writeQueue.empty() &&
+            m_writeQueue.capacity() > kMaxIdleQueueCapacity) {
+            m_writeQueue.shrink_to_fit();
+        }
+
+        // Record the latency of every sample that was completely sent
+        if (!m_queuedSamples.empty() &&
+            m_queuedSamples.front().end <= m_bytesSent) {
+            auto now = std::chrono::steady_clock::now();
+            while (!m_queuedSamples.empty() &&
+                   m_queuedSamples.front().end <= m_bytesSent) {
+                const auto& sample = m_queuedSamples.front();
+                auto latency =
+                    std::chrono::duration_cast<std::chrono::microseconds>(
+                        now - sample.enqueueTime)
+                        .count();
+                m_latency.Record(latency);
+                if (datasetLatency != nullptr) {
+                    datasetLatency[sample.id].Record(latency);
+                }
+                m_queuedSamples.pop_front();
+            }
+        }
+
         return true;
     }
 }
+
+std::chrono::steady_clock::time_point ClientConnection::LastProgress() const {
+    return m_lastProgress;
+}
+
+uint64_t ClientConnection::BytesSent() const { return m_bytesSent; }
+
+size_t ClientConnection::BytesQueued() const { return m_writeQueue.size(); }
+
+size_t ClientConnection::BulkBytesQueued() const { return m_bulkBytes; }
+
+size_t ClientConnection::SamplesQueued() const {
+    return m_queuedSamples.size();
+}
+
+const LatencyHistogram& ClientConnection::Latency() const { return m_latency; }
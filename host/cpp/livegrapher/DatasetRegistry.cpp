@@ -0,0 +1,170 @@
+// Copyright (c) 2020 FRC Team 3512. All Rights Reserved.
+
+#include "livegrapher/DatasetRegistry.hpp"
+
+#include <functional>
+#include <thread>
+
+DatasetRegistry::DatasetRegistry(
+    std::chrono::steady_clock::duration gracePeriod)
+    : m_gracePeriod{gracePeriod} {}
+
+DatasetRegistry::~DatasetRegistry() {
+    for (auto entry : m_entries) {
+        delete entry;
+    }
+}
+
+std::optional<uint8_t> DatasetRegistry::Find(std::string_view name) const {
+    // Register the lookup so Unregister() doesn't free an entry it's reading
+    uint32_t epoch = m_epoch.load() & 1;
+    m_readers[epoch].fetch_add(1);
+
+    std::optional<uint8_t> id;
+    auto entry = FindEntry(name, std::hash<std::string_view>{}(name));
+    if (entry != nullptr) {
+        id = entry->id;
+    }
+
+    m_readers[epoch].fetch_sub(1, std::memory_order_release);
+    return id;
+}
+
+std::optional<uint8_t> DatasetRegistry::Register(std::string_view name,
+                                                 bool& inserted) {
+    inserted = false;
+
+    if (auto id = Find(name)) {
+        return id;
+    }
+
+    std::scoped_lock lock(m_mutex);
+
+    // Another thread may have registered the dataset while this one waited.
+    // Entries can't be freed while the mutex is held, so the lookup doesn't
+    // need to be registered.
+    size_t hash = std::hash<std::string_view>{}(name);
+    if (auto entry = FindEntry(name, hash)) {
+        return entry->id;
+    }
+
+    // Prefer IDs that were never used, then the ID released the longest ago
+    // if its grace period has passed
+    auto now = std::chrono::steady_clock::now();
+    std::optional<size_t> id;
+    for (size_t i = 0; i < kCapacity; ++i) {
+        if (m_idStates[i] == IDState::kUnused) {
+            id = i;
+            break;
+        }
+        if (m_idStates[i] == IDState::kReleased &&
+            now - m_releaseTimes[i] >= m_gracePeriod &&
+            (!id || m_releaseTimes[i] < m_releaseTimes[id.value()])) {
+            id = i;
+        }
+    }
+    if (!id) {
+        return std::nullopt;
+    }
+
+    auto entry = new Entry{std::string{name}, hash, static_cast<uint8_t>(*id)};
+    m_entries[*id] = entry;
+    m_idStates[*id] = IDState::kActive;
+
+    // At most kCapacity slots hold entries, so there's always an empty slot or
+    // a tombstone to reuse
+    size_t slot = hash % kNumSlots;
+    while (true) {
+        auto current = m_slots[slot].load(std::memory_order_relaxed);
+        if (current == nullptr || current == Tombstone()) {
+            break;
+        }
+        slot = (slot + 1) % kNumSlots;
+    }
+    m_slots[slot].store(entry);
+
+    inserted = true;
+    return entry->id;
+}
+
+std::optional<uint8_t> DatasetRegistry::Unregister(std::string_view name) {
+    std::scoped_lock lock(m_mutex);
+
+    size_t hash = std::hash<std::string_view>{}(name);
+    size_t slot = hash % kNumSlots;
+    for (size_t i = 0; i < kNumSlots; ++i) {
+        auto entry = m_slots[slot].load(std::memory_order_relaxed);
+        if (entry == nullptr) {
+            break;
+        }
+        if (entry != Tombstone() && entry->hash == hash &&
+            entry->name == name) {
+            uint8_t id = entry->id;
+
+            m_slots[slot].store(Tombstone());
+            m_entries[id] = nullptr;
+            m_idStates[id] = IDState::kReleased;
+            m_releaseTimes[id] = std::chrono::steady_clock::now();
+
+            // Lookups that started before the tombstone was stored may still
+            // be reading the entry
+            Synchronize();
+            delete entry;
+
+            return id;
+        }
+        slot = (slot + 1) % kNumSlots;
+    }
+
+    return std::nullopt;
+}
+
+std::optional<std::string_view> DatasetRegistry::Name(uint8_t id) const {
+    if (id >= kCapacity || m_entries[id] == nullptr) {
+        return std::nullopt;
+    }
+    return m_entries[id]->name;
+}
+
+const DatasetRegistry::Entry* DatasetRegistry::FindEntry(std::string_view name,
+                                                         size_t hash) const {
+    // An empty slot ends the probe sequence, but a tombstone doesn't because
+    // the entry being searched for may have been inserted after the
+    // tombstone's entry
+    size_t slot = hash % kNumSlots;
+    for (size_t i = 0; i < kNumSlots; ++i) {
+        auto entry = m_slots[slot].load();
+        if (entry == nullptr) {
+            return nullptr;
+        }
+        if (entry != Tombstone() && entry->hash == hash &&
+            entry->name == name) {
+            return entry;
+        }
+        slot = (slot + 1) % kNumSlots;
+    }
+
+    return nullptr;
+}
+
+void DatasetRegistry::Synchronize() {
+    // Lookups that started before the epoch changed are counted in the old
+    // epoch's counter, and new ones are counted in the other. A lookup that
+    // read the old epoch long ago may increment either counter, so both are
+    // flipped away from and drained in turn.
+    //
+    // The writer stores a tombstone and then loads a counter, while a lookup
+    // increments a counter and then loads the slot. Only sequentially
+    // consistent loads guarantee that one of them sees the other's store.
+    for (int i = 0; i < 2; ++i) {
+        uint32_t old = m_epoch.fetch_add(1) & 1;
+        while (m_readers[old].load() != 0) {
+            std::this_thread::yield();
+        }
+    }
+}
+
+const DatasetRegistry::Entry* DatasetRegistry::Tombstone() {
+    static const Entry tombstone{};
+    return &tombstone;
+}
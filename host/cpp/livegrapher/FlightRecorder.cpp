@@ -0,0 +1,225 @@
+// Copyright (c) 2020 FRC Team 3512. All Rights Reserved.
+
+#include "livegrapher/FlightRecorder.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <system_error>
+
+// Sequence number of a record that's in the middle of being written
+constexpr uint64_t kRecordWriting = ~uint64_t{0};
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free,
+              "FlightRecord fields must be lock-free to live in shared memory");
+
+/**
+ * Opens the recorder file, moving any previous recording out of the way so it
+ * isn't overwritten.
+ *
+ * @param path     The path of the recorder file.
+ * @param capacity The maximum number of samples retained.
+ */
+static MappedFile OpenRecorderFile(const std::string& path, size_t capacity) {
+    std::string prevPath = path + ".prev";
+
+    // rename() doesn't replace existing files on Windows. If the previous
+    // recording can't be moved, opening the file would truncate it.
+    std::remove(prevPath.c_str());
+    if (std::rename(path.c_str(), prevPath.c_str()) != 0 && errno != ENOENT) {
+        throw std::system_error(errno, std::generic_category(),
+                                "FlightRecorder");
+    }
+
+    return MappedFile{path,
+                      kFlightRecordOffset + capacity * sizeof(FlightRecord)};
+}
+
+FlightRecorder::FlightRecorder(const std::string& path, size_t capacity)
+    : m_file{OpenRecorderFile(path, std::max<size_t>(capacity, 1))} {
+    m_header = reinterpret_cast<FlightRecorderHeader*>(m_file.Data());
+    m_records =
+        reinterpret_cast<FlightRecord*>(m_file.Data() + kFlightRecordOffset);
+
+    // The file was just truncated, so it's zero-filled. The magic number is
+    // written last so a reader never sees a partially initialized header.
+    m_header->version = kFlightRecorderVersion;
+    m_header->recordSize = sizeof(FlightRecord);
+    m_header->capacity = std::max<size_t>(capacity, 1);
+    m_header->writeIndex.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    std::memcpy(m_header->magic, kFlightRecorderMagic,
+                sizeof(kFlightRecorderMagic));
+}
+
+FlightRecorder::~FlightRecorder() { m_file.Flush(); }
+
+void FlightRecorder::SetName(uint8_t id, std::string_view name) {
+    // Records only hold the low bits of the serial number, which are skipped
+    // when they're zero so they never mean "no name"
+    uint32_t serial;
+    do {
+        serial =
+            m_header->nameCount.fetch_add(1, std::memory_order_relaxed) + 1;
+    } while ((serial & kFlightRecorderNameMask) == 0);
+    auto& entry = m_header->names[(serial - 1) % kFlightRecorderNames];
+
+    // Mark the entry as being written like records are
+    entry.serial.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    auto length = std::min<size_t>(name.length(), sizeof(entry.data));
+    std::memcpy(entry.data, name.data(), length);
+    entry.length = static_cast<uint8_t>(length);
+
+    entry.serial.store(serial, std::memory_order_release);
+    m_nameSerials[id].store(serial & kFlightRecorderNameMask,
+                            std::memory_order_relaxed);
+}
+
+void FlightRecorder::Write(uint8_t id, uint64_t time, float value) {
+    uint64_t index =
+        m_header->writeIndex.fetch_add(1, std::memory_order_relaxed);
+    auto& record = m_records[index % m_header->capacity];
+
+    uint32_t valueBits;
+    std::memcpy(&valueBits, &value, sizeof(valueBits));
+    uint64_t name = m_nameSerials[id].load(std::memory_order_relaxed);
+
+    // Mark the record as being written before touching its payload so a
+    // reader never pairs the old sequence number with the new payload
+    record.seq.store(kRecordWriting, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    record.time.store(time, std::memory_order_relaxed);
+    record.payload.store(name << 38 | uint64_t{id} << 32 | valueBits,
+                         std::memory_order_relaxed);
+
+    // Publish the record
+    record.seq.store(index + 1, std::memory_order_release);
+}
+
+void FlightRecorder::Flush() { m_file.Flush(); }
+
+FlightRecorderReader::FlightRecorderReader(const std::string& path)
+    : m_file{path} {
+    if (m_file.Size() < kFlightRecordOffset) {
+        throw std::runtime_error(path + " is too small for a flight recorder");
+    }
+
+    m_header = reinterpret_cast<const FlightRecorderHeader*>(m_file.Data());
+    m_records = reinterpret_cast<const FlightRecord*>(m_file.Data() +
+                                                      kFlightRecordOffset);
+
+    if (std::memcmp(m_header->magic, kFlightRecorderMagic,
+                    sizeof(kFlightRecorderMagic)) != 0) {
+        throw std::runtime_error(path + " isn't a flight recorder file");
+    }
+    if (m_header->version != kFlightRecorderVersion ||
+        m_header->recordSize != sizeof(FlightRecord)) {
+        throw std::runtime_error(path + " has an unsupported format version");
+    }
+    if (m_header->capacity == 0 ||
+        (m_file.Size() - kFlightRecordOffset) / sizeof(FlightRecord) <
+            m_header->capacity) {
+        throw std::runtime_error(path + " is truncated");
+    }
+}
+
+std::string FlightRecorderReader::Name(uint32_t serial) const {
+    if (serial == 0) {
+        return {};
+    }
+
+    // The serial number only matches if the entry hasn't been reused for a
+    // later name change. Entries are copied like records in Read().
+    const auto& entry = m_header->names[(serial - 1) % kFlightRecorderNames];
+    uint32_t entrySerial = entry.serial.load(std::memory_order_acquire);
+    if ((entrySerial & kFlightRecorderNameMask) != serial) {
+        return {};
+    }
+
+    std::string name{entry.data, entry.length};
+
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (entry.serial.load(std::memory_order_relaxed) != entrySerial) {
+        return {};
+    }
+
+    return name;
+}
+
+std::vector<std::string> FlightRecorderReader::Names() const {
+    uint32_t count = m_header->nameCount.load(std::memory_order_acquire);
+    uint32_t first =
+        count > kFlightRecorderNames ? count - kFlightRecorderNames : 0;
+
+    std::vector<std::string> names;
+    for (uint32_t serial = first + 1; serial <= count; ++serial) {
+        auto name = Name(serial & kFlightRecorderNameMask);
+        if (!name.empty() &&
+            std::find(names.begin(), names.end(), name) == names.end()) {
+            names.emplace_back(std::move(name));
+        }
+    }
+    return names;
+}
+
+uint64_t FlightRecorderReader::Begin() const {
+    uint64_t end = End();
+    if (end > m_header->capacity) {
+        return end - m_header->capacity;
+    } else {
+        return 0;
+    }
+}
+
+uint64_t FlightRecorderReader::End() const {
+    return m_header->writeIndex.load(std::memory_order_acquire);
+}
+
+bool FlightRecorderReader::Read(uint64_t index,
+                                FlightRecorderSample& sample) const {
+    const auto& record = m_records[index % m_header->capacity];
+
+    uint64_t seq = record.seq.load(std::memory_order_acquire);
+    if (seq != index + 1) {
+        return false;
+    }
+
+    uint64_t time = record.time.load(std::memory_order_relaxed);
+    uint64_t payload = record.payload.load(std::memory_order_relaxed);
+
+    // If a writer started overwriting the record while it was being copied,
+    // the copy may be torn
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (record.seq.load(std::memory_order_relaxed) != seq) {
+        return false;
+    }
+
+    uint32_t valueBits = static_cast<uint32_t>(payload);
+    sample.id = static_cast<uint8_t>(payload >> 32) & 0x3F;
+    sample.time = time;
+    std::memcpy(&sample.value, &valueBits, sizeof(sample.value));
+    sample.name = static_cast<uint32_t>(payload >> 38);
+    return true;
+}
+
+FlightRecorderNames::FlightRecorderNames(const FlightRecorderReader& reader)
+    : m_reader{reader} {}
+
+const std::string& FlightRecorderNames::Get(
+    const FlightRecorderSample& sample) {
+    auto& entry = m_entries[sample.id];
+    if (!entry.valid || entry.serial != sample.name) {
+        entry.name = m_reader.Name(sample.name);
+        if (entry.name.empty()) {
+            entry.name = "Graph " + std::to_string(sample.id);
+        }
+        entry.serial = sample.name;
+        entry.valid = true;
+    }
+    return entry.name;
+}
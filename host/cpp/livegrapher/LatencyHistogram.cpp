@@ -0,0 +1,87 @@
+// Copyright (c) 2020 FRC Team 3512. All Rights Reserved.
+
+#include "livegrapher/LatencyHistogram.hpp"
+
+#include <algorithm>
+
+void LatencyHistogram::Record(uint64_t value) {
+    value = std::min(value, kMaxValue);
+
+    ++m_buckets[BucketIndex(value)];
+    ++m_count;
+    m_sum += value;
+    m_max = std::max(m_max, value);
+}
+
+void LatencyHistogram::Merge(const LatencyHistogram& other) {
+    for (size_t i = 0; i < kNumBuckets; ++i) {
+        m_buckets[i] += other.m_buckets[i];
+    }
+    m_count += other.m_count;
+    m_sum += other.m_sum;
+    m_max = std::max(m_max, other.m_max);
+}
+
+void LatencyHistogram::Reset() { *this = LatencyHistogram{}; }
+
+uint64_t LatencyHistogram::Count() const { return m_count; }
+
+uint64_t LatencyHistogram::Sum() const { return m_sum; }
+
+uint64_t LatencyHistogram::Max() const { return m_max; }
+
+uint64_t LatencyHistogram::Percentile(double percentile) const {
+    if (m_count == 0) {
+        return 0;
+    }
+
+    // Rank of the value at the percentile, counting from 1
+    auto rank = static_cast<uint64_t>(percentile / 100.0 * m_count + 0.5);
+    rank = std::clamp<uint64_t>(rank, 1, m_count);
+
+    uint64_t seen = 0;
+    for (size_t i = 0; i < kNumBuckets; ++i) {
+        seen += m_buckets[i];
+        if (seen >= rank) {
+            // The last bucket's upper bound is the largest value recorded
+            if (i + 1 == kNumBuckets) {
+                return m_max;
+            }
+            return std::min(BucketLowerBound(i + 1) - 1, m_max);
+        }
+    }
+
+    return m_max;
+}
+
+uint64_t LatencyHistogram::BucketCount(size_t bucket) const {
+    return m_buckets[bucket];
+}
+
+size_t LatencyHistogram::BucketIndex(uint64_t value) {
+    if (value < kSubBuckets) {
+        return value;
+    }
+
+    // Position of the most significant bit
+    uint64_t msb = 0;
+    while (value >> (msb + 1)) {
+        ++msb;
+    }
+
+    // The top kSubBucketBits + 1 bits select the bucket within its power of
+    // two
+    uint64_t shift = msb - kSubBucketBits;
+    uint64_t mantissa = value >> shift;
+    return (shift + 1) * kSubBuckets + (mantissa - kSubBuckets);
+}
+
+uint64_t LatencyHistogram::BucketLowerBound(size_t bucket) {
+    if (bucket < kSubBuckets) {
+        return bucket;
+    }
+
+    uint64_t shift = bucket / kSubBuckets - 1;
+    uint64_t mantissa = kSubBuckets + bucket % kSubBuckets;
+    return mantissa << shift;
+}
@@ -14,203 +14,1460 @@
 
 #else
 #include <arpa/inet.h>
+#include <time.h>
 #endif
 
 #include <algorithm>
+#include <cerrno>
+#include <cmath>
 #include <cstring>
+#include <functional>
+#include <future>
+#include <limits>
+#include <mutex>
+#include <stdexcept>
 
 #include "livegrapher/Protocol.hpp"
 
-uint64_t HostToNetwork64(uint64_t in) {
-    uint64_t out;
-    auto outArr = reinterpret_cast<uint8_t*>(&out);
-    outArr[0] = in >> 56 & 0xff;
-    outArr[1] = in >> 48 & 0xff;
-    outArr[2] = in >> 40 & 0xff;
-    outArr[3] = in >> 32 & 0xff;
-    outArr[4] = in >> 24 & 0xff;
-    outArr[5] = in >> 16 & 0xff;
-    outArr[6] = in >> 8 & 0xff;
-    outArr[7] = in >> 0 & 0xff;
-    return out;
+namespace {
+
+/**
+ * Scoped lock that adds the time its mutex was held to a counter while
+ * telemetry is enabled.
+ */
+class TimedLock {
+public:
+    TimedLock(wpi::mutex& mutex, std::atomic<uint64_t>& heldTime, bool enabled)
+        : m_lock{mutex}, m_heldTime{heldTime}, m_enabled{enabled} {
+        if (m_enabled) {
+            m_startTime = std::chrono::steady_clock::now();
+        }
+    }
+
+    ~TimedLock() {
+        if (m_enabled) {
+            auto held = std::chrono::steady_clock::now() - m_startTime;
+            m_heldTime.fetch_add(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(held)
+                    .count(),
+                std::memory_order_relaxed);
+        }
+    }
+
+private:
+    std::scoped_lock<wpi::mutex> m_lock;
+    std::atomic<uint64_t>& m_heldTime;
+    bool m_enabled;
+    std::chrono::steady_clock::time_point m_startTime;
+};
+
+}  // namespace
+
+/**
+ * Returns the CPU time consumed by the calling thread.
+ */
+static std::chrono::nanoseconds ThreadCPUTime() {
+#ifdef _WIN32
+    FILETIME creationTime;
+    FILETIME exitTime;
+    FILETIME kernelTime;
+    FILETIME userTime;
+    if (!GetThreadTimes(GetCurrentThread(), &creationTime, &exitTime,
+                        &kernelTime, &userTime)) {
+        return std::chrono::nanoseconds{0};
+    }
+
+    // FILETIMEs count 100 ns intervals
+    auto toTicks = [](const FILETIME& time) {
+        return (static_cast<uint64_t>(time.dwHighDateTime) << 32) |
+               time.dwLowDateTime;
+    };
+    return std::chrono::nanoseconds{
+        (toTicks(kernelTime) + toTicks(userTime)) * 100};
+#else
+    timespec ts;
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) == -1) {
+        return std::chrono::nanoseconds{0};
+    }
+
+    return std::chrono::seconds{ts.tv_sec} +
+           std::chrono::nanoseconds{ts.tv_nsec};
+#endif
+}
+
+/**
+ * Returns a token bucket for a bandwidth budget.
+ *
+ * @param rate The limit in bytes per second, or zero for no limit.
+ */
+static TokenBucket MakeBudget(uint64_t rate) {
+    if (rate == 0) {
+        return TokenBucket{};
+    }
+
+    // The bucket must be able to hold several data packets for the priority
+    // thresholds to work
+    double burst =
+        std::chrono::duration<double>(LiveGrapher::kBandwidthBurst).count();
+    return TokenBucket{rate, std::max(rate * burst, 4.0 * 64.0)};
+}
+
+/**
+ * Returns true if a sample of the given priority fits in a bandwidth budget.
+ *
+ * Critical samples always fit. Normal samples fit while the budget isn't in
+ * debt, and low priority samples only fit while the budget is at least half
+ * full, so low priority datasets are paused before normal ones are decimated.
+ *
+ * @param budget   The bandwidth budget.
+ * @param priority The priority class of the sample's dataset.
+ * @param size     The size of the sample's packet in bytes.
+ */
+static bool FitsBudget(const TokenBucket& budget,
+                       LiveGrapher::Priority priority, size_t size) {
+    if (!budget.IsLimited()) {
+        return true;
+    }
+
+    switch (priority) {
+        case LiveGrapher::Priority::kCritical:
+            return true;
+        case LiveGrapher::Priority::kNormal:
+            return budget.Level() >= size;
+        case LiveGrapher::Priority::kLow:
+            return budget.Level() >= budget.Capacity() / 2 + size;
+    }
+
+    return true;
+}
+
+/**
+ * Returns the length of the host packet at the start of received data.
+ *
+ * @param data The received data, starting at a packet boundary.
+ * @return The length, zero if the packet hasn't been received completely yet,
+ *         or nothing if its payload is longer than the host accepts.
+ */
+static std::optional<size_t> PacketLength(std::string_view data) {
+    if (data.empty()) {
+        return 0;
+    }
+
+    uint8_t id = data[0];
+    if ((id & kHostExtendedPacket) != kHostExtendedPacket) {
+        return 1;
+    }
+
+    // The hello packet is followed by a version byte and a capabilities byte
+    if (id == kHostHelloPacket) {
+        return data.size() >= 3 ? 3 : 0;
+    }
+
+    constexpr size_t kHeaderLength = 1 + sizeof(uint32_t);
+    if (data.size() < kHeaderLength) {
+        return 0;
+    }
+
+    // Reject lengths that would make us buffer an unbounded amount of data
+    auto length = ReadNetworkOrder<uint32_t>(data.data() + 1);
+    if (length > kMaxHostExtendedLength) {
+        return std::nullopt;
+    }
+
+    if (data.size() < kHeaderLength + length) {
+        return 0;
+    }
+    return kHeaderLength + length;
+}
+
+LiveGrapher::LiveGrapher(uint16_t port, Threading threading,
+                         const ThreadScheduling& scheduling)
+    : m_threading{threading}, m_listener{port} {
+    m_priorities.fill(Priority::kNormal);
+
+    if (m_threading != Threading::kExternal) {
+        m_selector.emplace();
+        m_selector->Add(m_listener, SocketSelector::kRead);
+    }
+
+    if (m_threading == Threading::kThread) {
+        m_isRunning = true;
+
+        // The thread applies its scheduling settings before anything else and
+        // reports whether that succeeded, so errors reach the caller
+        std::promise<void> started;
+        auto result = started.get_future();
+        m_thread = std::thread(
+            [this, scheduling, started = std::move(started)]() mutable {
+                try {
+                    SetThreadScheduling(scheduling);
+                } catch (...) {
+                    started.set_exception(std::current_exception());
+                    return;
+                }
+                started.set_value();
+
+                ThreadMain();
+            });
+
+        try {
+            result.get();
+        } catch (...) {
+            m_thread.join();
+            throw;
+        }
+    }
+}
+
+LiveGrapher::~LiveGrapher() {
+    if (m_thread.joinable()) {
+        m_isRunning = false;
+        m_selector->Cancel();
+        m_thread.join();
+    }
+
+    // Wake consumers waiting on subscribers that outlive the host
+    for (auto& subscriber : m_subscribers) {
+        subscriber->Close();
+    }
+
+    // Sinks write the samples left in their subscribers before stopping
+    for (auto& sink : m_sinks) {
+        sink.thread.join();
+    }
+}
+
+void LiveGrapher::AddData(std::string_view dataset, float value) {
+    Sample sample{Now(), value};
+    AddDataImpl(dataset, &sample, 1);
+}
+
+void LiveGrapher::AddData(std::string_view dataset,
+                          std::chrono::milliseconds time, float value) {
+    Sample sample{time, value};
+    AddDataImpl(dataset, &sample, 1);
+}
+
+void LiveGrapher::AddData(std::string_view dataset, const Sample* samples,
+                          size_t count) {
+    if (count > 0) {
+        AddDataImpl(dataset, samples, count);
+    }
+}
+
+void LiveGrapher::SetClock(std::function<std::chrono::milliseconds()> clock) {
+    m_clock = std::move(clock);
+}
+
+std::chrono::milliseconds LiveGrapher::Now() const {
+    using std::chrono::duration_cast;
+    using std::chrono::milliseconds;
+    using std::chrono::steady_clock;
+
+    if (m_clock) {
+        return m_clock();
+    }
+    return duration_cast<milliseconds>(steady_clock::now().time_since_epoch());
+}
+
+void LiveGrapher::SetDeadband(std::string_view dataset, float absolute,
+                              float relative,
+                              std::chrono::milliseconds heartbeat) {
+    auto id = RegisterDataset(dataset);
+    if (!id) {
+        throw std::length_error("LiveGrapher: too many datasets");
+    }
+
+    auto& deadband = m_deadbands[id.value()];
+    std::scoped_lock lock(deadband.mutex);
+    deadband.absolute = absolute;
+    deadband.relative = relative;
+    deadband.heartbeat = heartbeat;
+    deadband.enabled.store(true, std::memory_order_release);
+}
+
+void LiveGrapher::EnableFlightRecorder(const std::string& path,
+                                       size_t capacity) {
+    m_recorder = std::make_unique<FlightRecorder>(path, capacity);
+
+    // Record the names of datasets registered before the recorder existed
+    for (size_t id = 0; id < DatasetRegistry::kCapacity; ++id) {
+        if (auto name = m_registry.Name(id)) {
+            m_recorder->SetName(id, name.value());
+        }
+    }
+}
+
+void LiveGrapher::EnableTelemetry(std::chrono::milliseconds period) {
+    auto registerDataset = [this](const std::string& dataset) {
+        auto id = RegisterDataset(dataset);
+        if (!id) {
+            throw std::length_error("LiveGrapher: too many datasets");
+        }
+        return id.value();
+    };
+
+    m_telemetry.period = period;
+    m_telemetry.ingestID = registerDataset("LiveGrapher: Ingest (samples/s)");
+    m_telemetry.droppedID = registerDataset("LiveGrapher: Dropped (samples)");
+    m_telemetry.wakeupsID = registerDataset("LiveGrapher: Wakeups (1/s)");
+    m_telemetry.lockHeldID = registerDataset("LiveGrapher: Lock Held (%)");
+    m_telemetry.cpuID = registerDataset("LiveGrapher: Network CPU (%)");
+    for (size_t i = 0; i < kTelemetryClients; ++i) {
+        auto client = "LiveGrapher: Client " + std::to_string(i);
+        m_telemetry.queuedIDs[i] = registerDataset(client + " Queued (B)");
+        m_telemetry.sentIDs[i] = registerDataset(client + " Sent (B/s)");
+    }
+
+    m_telemetryEnabled.store(true, std::memory_order_release);
+
+    // Wake the network thread so it starts sampling with a timeout
+    WakeNetworkThread();
+}
+
+void LiveGrapher::EnableResume(size_t capacity,
+                               std::chrono::seconds sessionTimeout) {
+    TimedLock lock(m_connListMutex, m_lockHeldTime,
+                   m_telemetryEnabled.load(std::memory_order_relaxed));
+
+    m_retained.resize(capacity);
+    m_sessionTimeout = sessionTimeout;
+    UpdateHasConsumers();
+}
+
+void LiveGrapher::SetBandwidthLimit(uint64_t total, uint64_t client) {
+    TimedLock lock(m_connListMutex, m_lockHeldTime,
+                   m_telemetryEnabled.load(std::memory_order_relaxed));
+
+    m_totalBudget = MakeBudget(total);
+    m_clientBandwidthLimit = client;
+    for (auto& conn : m_connList) {
+        conn.Budget() = MakeBudget(client);
+    }
+}
+
+void LiveGrapher::SetPriority(std::string_view dataset, Priority priority) {
+    auto id = RegisterDataset(dataset);
+    if (!id) {
+        throw std::length_error("LiveGrapher: too many datasets");
+    }
+
+    TimedLock lock(m_connListMutex, m_lockHeldTime,
+                   m_telemetryEnabled.load(std::memory_order_relaxed));
+    m_priorities[id.value()] = priority;
+}
+
+void LiveGrapher::SetDecimation(std::string_view dataset, uint32_t factor) {
+    auto id = RegisterDataset(dataset);
+    if (!id) {
+        throw std::length_error("LiveGrapher: too many datasets");
+    }
+
+    TimedLock lock(m_connListMutex, m_lockHeldTime,
+                   m_telemetryEnabled.load(std::memory_order_relaxed));
+    m_decimation[id.value()] = factor;
+    m_decimationCount[id.value()] = 0;
+}
+
+void LiveGrapher::EnableTriggers(size_t capacity) {
+    TimedLock lock(m_connListMutex, m_lockHeldTime,
+                   m_telemetryEnabled.load(std::memory_order_relaxed));
+
+    m_triggers = std::make_unique<TriggerCapture>(capacity);
+    UpdateHasConsumers();
+}
+
+void LiveGrapher::AddTrigger(std::string_view dataset,
+                             TriggerCondition condition, float threshold,
+                             std::chrono::microseconds preTrigger,
+                             std::chrono::microseconds postTrigger) {
+    auto id = RegisterDataset(dataset);
+    if (!id) {
+        throw std::length_error("LiveGrapher: too many datasets");
+    }
+
+    TimedLock lock(m_connListMutex, m_lockHeldTime,
+                   m_telemetryEnabled.load(std::memory_order_relaxed));
+    if (!m_triggers) {
+        throw std::runtime_error("LiveGrapher: triggers aren't enabled");
+    }
+    m_triggers->AddTrigger(id.value(), condition, threshold, preTrigger,
+                           postTrigger);
+}
+
+void LiveGrapher::SetFlushPolicy(size_t bytes,
+                                 std::chrono::microseconds delay) {
+    TimedLock lock(m_connListMutex, m_lockHeldTime,
+                   m_telemetryEnabled.load(std::memory_order_relaxed));
+
+    m_flushBytes = bytes;
+    m_flushDelay = delay;
+    for (auto& conn : m_connList) {
+        if (!conn.IsFlushPolicyRequested()) {
+            conn.SetFlushPolicy(bytes, delay);
+        }
+    }
+}
+
+void LiveGrapher::SetStallTimeout(std::chrono::milliseconds timeout) {
+    TimedLock lock(m_connListMutex, m_lockHeldTime,
+                   m_telemetryEnabled.load(std::memory_order_relaxed));
+
+    m_stallTimeout = timeout;
+    if (timeout.count() > 0) {
+        for (auto& conn : m_connList) {
+            conn.socket.SetDeadPeerTimeout(timeout);
+        }
+    }
+}
+
+std::optional<uint8_t> LiveGrapher::Register(std::string_view dataset) {
+    return RegisterDataset(dataset);
+}
+
+std::optional<std::string> LiveGrapher::DatasetName(uint8_t id) {
+    // Names are only stable while unregistration is excluded
+    TimedLock lock(m_connListMutex, m_lockHeldTime,
+                   m_telemetryEnabled.load(std::memory_order_relaxed));
+
+    if (auto name = m_registry.Name(id)) {
+        return std::string{name.value()};
+    }
+    return std::nullopt;
+}
+
+std::shared_ptr<Subscriber> LiveGrapher::Subscribe(size_t capacity) {
+    auto subscriber = std::make_shared<Subscriber>(capacity);
+
+    TimedLock lock(m_connListMutex, m_lockHeldTime,
+                   m_telemetryEnabled.load(std::memory_order_relaxed));
+    m_subscribers.emplace_back(subscriber);
+    UpdateHasConsumers();
+
+    return subscriber;
+}
+
+void LiveGrapher::Unsubscribe(const std::shared_ptr<Subscriber>& subscriber) {
+    {
+        TimedLock lock(m_connListMutex, m_lockHeldTime,
+                       m_telemetryEnabled.load(std::memory_order_relaxed));
+        m_subscribers.erase(std::remove(m_subscribers.begin(),
+                                        m_subscribers.end(), subscriber),
+                            m_subscribers.end());
+        UpdateHasConsumers();
+    }
+
+    subscriber->Close();
+}
+
+void LiveGrapher::AddSink(std::shared_ptr<Sink> sink,
+                          std::chrono::milliseconds period, size_t capacity) {
+    auto subscriber = Subscribe(capacity);
+    subscriber->SelectAll(true);
+
+    std::scoped_lock lock(m_sinkMutex);
+    auto& entry = m_sinks.emplace_back(SinkThread{sink, subscriber, {}});
+    entry.thread = std::thread{SinkThreadMain, std::ref(*sink),
+                               std::ref(*subscriber), period};
+}
+
+bool LiveGrapher::RemoveSink(const std::shared_ptr<Sink>& sink) {
+    std::scoped_lock lock(m_sinkMutex);
+
+    auto entry =
+        std::find_if(m_sinks.begin(), m_sinks.end(),
+                     [&](const auto& entry) { return entry.sink == sink; });
+    if (entry == m_sinks.end()) {
+        return false;
+    }
+
+    Unsubscribe(entry->subscriber);
+    entry->thread.join();
+    m_sinks.erase(entry);
+
+    return true;
+}
+
+void LiveGrapher::SinkThreadMain(Sink& sink, Subscriber& subscriber,
+                                 std::chrono::milliseconds period) {
+    // Samples stop arriving once the subscriber is closed, so the block taken
+    // after seeing it closed is the last one
+    bool closed;
+    do {
+        closed = subscriber.IsClosed();
+
+        // Waiting for a full block batches samples until the period elapses
+        auto samples = subscriber.Wait(period, SIZE_MAX);
+        if (!samples.empty()) {
+            sink.Write(samples);
+        }
+    } while (!closed);
+
+    sink.Close();
+}
+
+LiveGrapher::Stats LiveGrapher::GetStats() {
+    Stats stats;
+    stats.samplesAdded = m_samplesAdded.load(std::memory_order_relaxed);
+    stats.samplesSuppressed =
+        m_samplesSuppressed.load(std::memory_order_relaxed);
+    stats.samplesRejected = m_samplesRejected.load(std::memory_order_relaxed);
+
+    {
+        std::scoped_lock lock(m_sinkMutex);
+        for (const auto& sink : m_sinks) {
+            stats.sinkSamplesDropped.emplace_back(
+                sink.subscriber->SamplesDropped());
+        }
+    }
+
+    TimedLock lock(m_connListMutex, m_lockHeldTime,
+                   m_telemetryEnabled.load(std::memory_order_relaxed));
+
+    stats.samplesDropped = m_samplesDropped;
+    stats.clientsEvicted = m_clientsEvicted;
+    stats.capturesCompleted = m_capturesCompleted;
+    for (const auto& conn : m_connList) {
+        auto& client = stats.clients.emplace_back(
+            ClientStats{conn.BytesSent(), conn.BytesQueued(), conn.Latency(),
+                        {}, conn.Selection()});
+        for (size_t i = 0; i < ClientConnection::kNumPriorities; ++i) {
+            client.samplesShed[i] = conn.SamplesShed(i);
+        }
+    }
+
+    return stats;
+}
+
+void LiveGrapher::AddDataImpl(std::string_view dataset, const Sample* samples,
+                              size_t count) {
+    m_samplesAdded.fetch_add(count, std::memory_order_relaxed);
+
+    // Samples for datasets beyond the maximum number are dropped
+    auto registered = RegisterDataset(dataset);
+    if (!registered) {
+        m_samplesRejected.fetch_add(count, std::memory_order_relaxed);
+        return;
+    }
+    uint8_t id = registered.value();
+
+    bool wake = false;
+
+    auto& deadband = m_deadbands[id];
+    if (deadband.enabled.load(std::memory_order_acquire)) {
+        // Samples outside the deadband are published in chunks after the
+        // deadband lock is released, so a batch still locks the connection
+        // list once per chunk
+        std::array<Sample, 64> sent;
+        size_t next = 0;
+        while (next < count) {
+            size_t sentCount =
+                ApplyDeadband(deadband, samples, count, next, sent);
+            if (sentCount > 0) {
+                wake = PublishSamples(id, sent.data(), sentCount) || wake;
+            }
+        }
+    } else {
+        wake = PublishSamples(id, samples, count);
+    }
+
+    if (wake) {
+        WakeNetworkThread();
+    }
+}
+
+size_t LiveGrapher::ApplyDeadband(Deadband& deadband, const Sample* samples,
+                                 size_t count, size_t& next,
+                                 std::array<Sample, 64>& sent) {
+    std::scoped_lock lock(deadband.mutex);
+
+    // A sample can send two, so stop when there's less room than that
+    size_t sentCount = 0;
+    for (; next < count && sentCount + 2 <= sent.size(); ++next) {
+        auto [time, value] = samples[next];
+
+        // A change to or from NaN is always a change
+        float change = std::abs(value - deadband.sentValue);
+        bool changed =
+            std::isnan(value) != std::isnan(deadband.sentValue) ||
+            (change > deadband.absolute &&
+             change > deadband.relative * std::abs(deadband.sentValue));
+        bool heartbeatDue = deadband.heartbeat.count() > 0 &&
+                            time - deadband.sentTime >= deadband.heartbeat;
+
+        if (deadband.hasSent && !changed && !heartbeatDue) {
+            deadband.hasHeld = true;
+            deadband.heldTime = time;
+            deadband.heldValue = value;
+            m_samplesSuppressed.fetch_add(1, std::memory_order_relaxed);
+            continue;
+        }
+
+        // Send the held value's last sample so clients draw a step at the
+        // change instead of a ramp from the last sent sample
+        if (changed && deadband.hasHeld) {
+            sent[sentCount++] = {deadband.heldTime, deadband.heldValue};
+        }
+        deadband.hasHeld = false;
+        deadband.hasSent = true;
+        deadband.sentTime = time;
+        deadband.sentValue = value;
+
+        sent[sentCount++] = {time, value};
+    }
+
+    return sentCount;
+}
+
+std::optional<uint8_t> LiveGrapher::RegisterDataset(
+    std::string_view dataset) {
+    // Lookups of existing datasets don't lock
+    if (auto id = m_registry.Find(dataset)) {
+        return id;
+    }
+
+    // Give the dataset an ID since it doesn't already have one. This is done
+    // under the connection list lock so the catalog and announcements are
+    // updated in registration order.
+    uint8_t id;
+    bool notified = false;
+    {
+        TimedLock lock(m_connListMutex, m_lockHeldTime,
+                       m_telemetryEnabled.load(std::memory_order_relaxed));
+
+        bool inserted;
+        auto registered = m_registry.Register(dataset, inserted);
+        if (!registered || !inserted) {
+            return registered;
+        }
+        id = registered.value();
+
+        RebuildCatalog();
+
+        // Announce the dataset to clients that asked for new datasets, so they
+        // don't have to request the list again
+        std::string payload;
+        payload += static_cast<char>(id);
+        payload += dataset;
+        auto packet = MakeClientExtendedPacket(kClientDatasetAddedPacket,
+                                               payload);
+        for (auto& conn : m_connList) {
+            if (conn.IsCatalogSubscribed()) {
+                conn.AddData(packet);
+                notified = true;
+            }
+        }
+    }
+
+    if (m_recorder) {
+        m_recorder->SetName(id, dataset);
+    }
+
+    if (notified) {
+        WakeNetworkThread();
+    }
+
+    return id;
+}
+
+bool LiveGrapher::Unregister(std::string_view dataset) {
+    bool notified = false;
+    {
+        TimedLock lock(m_connListMutex, m_lockHeldTime,
+                       m_telemetryEnabled.load(std::memory_order_relaxed));
+
+        auto unregistered = m_registry.Unregister(dataset);
+        if (!unregistered) {
+            return false;
+        }
+        uint8_t id = unregistered.value();
+
+        RebuildCatalog();
+        ++m_retainedGenerations[id];
+        m_datasetLatency[id].Reset();
+        m_priorities[id] = Priority::kNormal;
+        m_decimation[id] = 0;
+        m_decimationCount[id] = 0;
+        if (m_triggers) {
+            m_triggers->RemoveTriggers(id);
+        }
+
+        // Samples already queued are sent before the announcement. Unselecting
+        // the graph ensures no client receives samples from the dataset that
+        // reuses the ID unless it selects that dataset again.
+        auto packet = MakeClientExtendedPacket(
+            kClientDatasetRemovedPacket, std::string(1, static_cast<char>(id)));
+        for (auto& conn : m_connList) {
+            conn.UnselectGraph(id);
+            if (conn.IsCatalogSubscribed()) {
+                conn.AddData(packet);
+                notified = true;
+            }
+        }
+        for (auto& [token, session] : m_sessions) {
+            session.selection &= ~(uint64_t{1} << id);
+        }
+        for (auto& subscriber : m_subscribers) {
+            subscriber->UnselectGraph(id);
+        }
+
+        auto& deadband = m_deadbands[id];
+        std::scoped_lock deadbandLock(deadband.mutex);
+        deadband.enabled.store(false, std::memory_order_relaxed);
+        deadband.hasSent = false;
+        deadband.hasHeld = false;
+    }
+
+    if (notified) {
+        WakeNetworkThread();
+    }
+
+    return true;
+}
+
+void LiveGrapher::RebuildCatalog() {
+    m_catalog.clear();
+
+    // Registration and unregistration hold m_connListMutex, so this is a
+    // consistent snapshot. Unregistered datasets leave gaps in the graph IDs.
+    std::optional<size_t> lastEntry;
+    for (size_t id = 0; id < DatasetRegistry::kCapacity; ++id) {
+        auto name = m_registry.Name(id);
+        if (!name) {
+            continue;
+        }
+
+        // Names longer than the 255 character maximum are truncated
+        size_t length = std::min<size_t>(name->length(), 255);
+
+        m_catalog += static_cast<char>(kClientListPacket | id);
+        m_catalog += static_cast<char>(length);
+        m_catalog += name->substr(0, length);
+
+        lastEntry = m_catalog.size();
+        m_catalog += '\0';
+    }
+
+    // The last entry is marked as the end of the list
+    if (lastEntry) {
+        m_catalog[lastEntry.value()] = 1;
+    }
+}
+
+void LiveGrapher::UpdateHasConsumers() {
+    m_hasConsumers.store(!m_connList.empty() || !m_subscribers.empty() ||
+                             !m_retained.empty() || m_triggers != nullptr,
+                         std::memory_order_release);
+}
+
+bool LiveGrapher::PublishSample(uint8_t id, std::chrono::milliseconds time,
+                                float value) {
+    Sample sample{time, value};
+    return PublishSamples(id, &sample, 1);
+}
+
+bool LiveGrapher::PublishSamples(uint8_t id, const Sample* samples,
+                                 size_t count) {
+    // Record the samples before anything else so they survive a crash
+    if (m_recorder) {
+        for (size_t i = 0; i < count; ++i) {
+            m_recorder->Write(id, samples[i].time.count(), samples[i].value);
+        }
+    }
+
+    // Do nothing if there's no active connections or subscribers to receive
+    // the data, no samples are retained for clients that reconnect, and no
+    // triggers need the samples before their firing
+    if (!m_hasConsumers.load(std::memory_order_acquire)) {
+        return false;
+    }
+
+    // Taken before locking so lock contention shows up in the latency
+    auto enqueueTime = std::chrono::steady_clock::now();
+
+    bool wake = false;
+
+    TimedLock lock(m_connListMutex, m_lockHeldTime,
+                   m_telemetryEnabled.load(std::memory_order_relaxed));
+
+    bool retain = !m_retained.empty();
+    auto priority = m_priorities[id];
+
+    // Captures and retained samples have microsecond resolution. Samples
+    // timestamped by the steady clock get their fraction of a millisecond from
+    // the enqueue time. If it's already the next millisecond, the sample was
+    // taken at the end of its millisecond, which keeps the times in order.
+    int64_t enqueueMicros =
+        std::chrono::duration_cast<std::chrono::microseconds>(
+            enqueueTime.time_since_epoch())
+            .count();
+    std::vector<Capture> captures;
+
+    for (size_t i = 0; i < count; ++i) {
+        auto [time, value] = samples[i];
+
+        int64_t preciseTime = time.count() * 1000;
+        if (!m_clock && enqueueMicros / 1000 == time.count()) {
+            preciseTime = enqueueMicros;
+        } else if (!m_clock && enqueueMicros / 1000 == time.count() + 1) {
+            preciseTime += 999;
+        }
+
+        if (m_triggers) {
+            m_triggers->Record({preciseTime, value, id}, captures);
+        }
+
+        // Subscribers are in the same process, so bandwidth budgets and
+        // decimation don't apply
+        for (auto& subscriber : m_subscribers) {
+            if (subscriber->IsGraphSelected(id)) {
+                subscriber->Push(id, time, value);
+            }
+        }
+
+        bool streamed = m_decimation[id] <= 1 ||
+                        m_decimationCount[id]++ % m_decimation[id] == 0;
+
+        // Decimated samples are retained too so clients can fetch them with
+        // range requests
+        if (retain) {
+            m_retained[m_nextSequence % m_retained.size()] = {
+                m_nextSequence, preciseTime, value, id, streamed,
+                m_retainedGenerations[id]};
+            ++m_nextSequence;
+        }
+
+        if (!streamed) {
+            continue;
+        }
+
+        auto packet = MakeClientDataPacket(id, time.count(), value);
+        auto nativePacket = MakeClientNativeDataPacket(id, time.count(), value);
+
+        // Send the point to connected clients
+        for (auto& conn : m_connList) {
+            if (!conn.IsGraphSelected(id)) {
+                continue;
+            }
+
+            size_t size =
+                conn.NativeSamples() ? sizeof(nativePacket) : sizeof(packet);
+            if (!AdmitSample(conn, priority, size, enqueueTime)) {
+                continue;
+            }
+
+            // The network thread only has to be woken up when a queue gets a
+            // new flush deadline or reaches its flush size. Otherwise, it's
+            // already waiting to send the queue.
+            if (conn.NativeSamples()) {
+                wake = conn.AddSample({reinterpret_cast<char*>(&nativePacket),
+                                       sizeof(nativePacket)},
+                                      id, enqueueTime) ||
+                       wake;
+            } else {
+                wake = conn.AddSample({reinterpret_cast<char*>(&packet),
+                                       sizeof(packet)},
+                                      id, enqueueTime) ||
+                       wake;
+            }
+        }
+    }
+
+    for (const auto& capture : captures) {
+        wake = SendCapture(capture) || wake;
+    }
+
+    return wake;
+}
+
+bool LiveGrapher::SendCapture(const Capture& capture) {
+    ++m_capturesCompleted;
+
+    bool wake = false;
+    for (auto& conn : m_connList) {
+        if (!conn.AcceptsExtendedPackets()) {
+            continue;
+        }
+
+        std::string payload;
+        AppendNetworkOrder(payload, capture.id);
+        AppendNetworkOrder(payload, static_cast<uint64_t>(capture.time));
+        size_t header = payload.size();
+        for (const auto& sample : capture.samples) {
+            if (conn.IsGraphSelected(sample.id)) {
+                uint32_t value;
+                std::memcpy(&value, &sample.value, sizeof(value));
+                AppendNetworkOrder(payload, sample.id);
+                AppendNetworkOrder(payload, static_cast<uint64_t>(sample.time));
+                AppendNetworkOrder(payload, value);
+            }
+        }
+
+        if (payload.size() > header) {
+            wake = conn.AddData(MakeClientExtendedPacket(kClientCapturePacket,
+                                                         payload)) ||
+                   wake;
+        }
+    }
+
+    return wake;
+}
+
+bool LiveGrapher::AdmitSample(ClientConnection& conn, Priority priority,
+                              size_t size,
+                              std::chrono::steady_clock::time_point now) {
+    auto& budget = conn.Budget();
+    m_totalBudget.Refill(now);
+    budget.Refill(now);
+
+    // Shed the sample if it doesn't fit in both the total budget and the
+    // client's budget
+    if (!FitsBudget(m_totalBudget, priority, size) ||
+        !FitsBudget(budget, priority, size)) {
+        conn.CountSample(static_cast<uint8_t>(priority), false);
+        return false;
+    }
+
+    m_totalBudget.Consume(size);
+    budget.Consume(size);
+    conn.CountSample(static_cast<uint8_t>(priority), true);
+    return true;
+}
+
+void LiveGrapher::SampleTelemetry(std::chrono::steady_clock::time_point now) {
+    using std::chrono::duration;
+
+    auto& t = m_telemetry;
+
+    // Telemetry is graphed against the same clock as the user's samples
+    auto time = Now();
+    double dt = duration<double>(now - t.lastTime).count();
+
+    uint64_t samplesAdded = m_samplesAdded.load(std::memory_order_relaxed);
+    uint64_t lockHeldTime = m_lockHeldTime.load(std::memory_order_relaxed);
+    // Inline and external hosts share their thread with the user's code, so
+    // only the time spent in Poll() or the entry points is counted
+    auto cpuTime = m_threading != Threading::kThread ? m_pollCPUTime
+                                                     : ThreadCPUTime();
+
+    // Rates are only meaningful once there's a previous sample
+    if (t.lastTime != std::chrono::steady_clock::time_point{}) {
+        PublishSample(t.ingestID, time,
+                      (samplesAdded - t.lastSamplesAdded) / dt);
+        PublishSample(t.wakeupsID, time, t.wakeups / dt);
+        PublishSample(t.lockHeldID, time,
+                      100.0 * (lockHeldTime - t.lastLockHeldTime) / 1e9 / dt);
+        PublishSample(
+            t.cpuID, time,
+            100.0 * duration<double>(cpuTime - t.lastCPUTime).count() / dt);
+    }
+
+    std::array<uint64_t, kTelemetryClients> bytesSent{};
+    std::array<size_t, kTelemetryClients> bytesQueued{};
+    size_t clientCount;
+    uint64_t samplesDropped;
+    {
+        TimedLock lock(m_connListMutex, m_lockHeldTime, true);
+
+        clientCount = std::min(m_connList.size(), kTelemetryClients);
+        for (size_t i = 0; i < clientCount; ++i) {
+            bytesSent[i] = m_connList[i].BytesSent();
+            bytesQueued[i] = m_connList[i].BytesQueued();
+        }
+        samplesDropped = m_samplesDropped;
+    }
+
+    PublishSample(t.droppedID, time, samplesDropped);
+
+    // Clients can connect and disconnect between samples, which shifts their
+    // indices. A client that sent fewer bytes than the one at its index last
+    // time is treated as new.
+    for (size_t i = 0; i < clientCount; ++i) {
+        if (bytesSent[i] < t.lastBytesSent[i]) {
+            t.lastBytesSent[i] = 0;
+        }
+        PublishSample(t.queuedIDs[i], time, bytesQueued[i]);
+        PublishSample(t.sentIDs[i], time,
+                      (bytesSent[i] - t.lastBytesSent[i]) / dt);
+    }
+
+    t.lastTime = now;
+    t.lastSamplesAdded = samplesAdded;
+    t.lastLockHeldTime = lockHeldTime;
+    t.lastCPUTime = cpuTime;
+    t.lastBytesSent = bytesSent;
+    t.wakeups = 0;
+}
+
+std::vector<ClientConnection>::iterator LiveGrapher::CloseConnection(
+    std::vector<ClientConnection>::iterator conn) {
+    if (m_selector) {
+        m_selector->Remove(conn->socket,
+                           SocketSelector::kRead | SocketSelector::kWrite);
+    }
+
+    m_samplesDropped += conn->SamplesQueued();
+
+    // Keep the session so the client can resume it after reconnecting, and
+    // forget sessions that can no longer be resumed
+    auto now = std::chrono::steady_clock::now();
+    auto session = m_sessions.begin();
+    while (session != m_sessions.end()) {
+        if (now - session->second.closeTime > m_sessionTimeout) {
+            session = m_sessions.erase(session);
+        } else {
+            ++session;
+        }
+    }
+    if (conn->SessionToken() != 0) {
+        m_sessions[conn->SessionToken()] = {
+            conn->Selection(), conn->IsCatalogSubscribed(), now};
+    }
+
+    auto next = m_connList.erase(conn);
+    UpdateHasConsumers();
+    return next;
+}
+
+void LiveGrapher::ThreadMain() {
+    while (m_isRunning) {
+        size_t byteBudget = std::numeric_limits<size_t>::max();
+        RunNetworkPass(true, byteBudget, std::nullopt);
+    }
 }
 
-LiveGrapher::LiveGrapher(uint16_t port) : m_listener{port} {
-    m_selector.Add(m_listener, SocketSelector::kRead);
+void LiveGrapher::Poll(std::chrono::microseconds budget, size_t maxBytes) {
+    if (m_threading != Threading::kInline) {
+        throw std::runtime_error(
+            "LiveGrapher: Poll() requires an inline host");
+    }
+
+    auto deadline = std::chrono::steady_clock::now() + budget;
+    auto cpuTime = ThreadCPUTime();
+
+    // A client's queue can be larger than its socket's send buffer, so passes
+    // are repeated while the socket keeps accepting data. Received packets are
+    // parsed until the deadline, and the rest wait for the next call.
+    size_t byteBudget =
+        maxBytes > 0 ? maxBytes : std::numeric_limits<size_t>::max();
+    while (RunNetworkPass(false, byteBudget, deadline) && byteBudget > 0 &&
+           std::chrono::steady_clock::now() < deadline) {
+    }
 
-    m_isRunning = true;
-    m_thread = std::thread([this] { ThreadMain(); });
+    m_pollCPUTime += ThreadCPUTime() - cpuTime;
 }
 
-LiveGrapher::~LiveGrapher() {
-    m_isRunning = false;
-    m_selector.Cancel();
-    m_thread.join();
+std::vector<LiveGrapher::SocketInterest> LiveGrapher::Interests() {
+    RequireExternal("Interests()");
+
+    TimedLock lock(m_connListMutex, m_lockHeldTime,
+                   m_telemetryEnabled.load(std::memory_order_relaxed));
+
+    // The listener is last, so an event loop that handles events in order
+    // doesn't accept a client that reuses the handle of one closed while
+    // handling the same batch of events
+    std::vector<SocketInterest> interests;
+    interests.reserve(m_connList.size() + 1);
+    for (const auto& conn : m_connList) {
+        interests.push_back(
+            {conn.socket.Handle(), true, conn.HasWriteInterest()});
+    }
+    interests.push_back({m_listener.Handle(), true, false});
+
+    return interests;
 }
 
-void LiveGrapher::AddData(const std::string& dataset, float value) {
-    // HACK: The dataset argument uses const std::string& instead of
-    // std::string_view because std::map doesn't have a find(std::string_view)
-    // overload.
+std::optional<std::chrono::steady_clock::time_point>
+LiveGrapher::NextTimerTime() const {
+    RequireExternal("NextTimerTime()");
 
-    using std::chrono::duration_cast;
-    using std::chrono::milliseconds;
-    using std::chrono::steady_clock;
+    return m_timerTime;
+}
 
-    auto currentTime =
-        duration_cast<milliseconds>(steady_clock::now().time_since_epoch());
+void LiveGrapher::OnReadable(Socket::NativeHandle handle) {
+    RequireExternal("OnReadable()");
+    HandleExternalEvent(handle, true, false);
+}
 
-    AddDataImpl(dataset, currentTime, value);
+void LiveGrapher::OnWritable(Socket::NativeHandle handle) {
+    RequireExternal("OnWritable()");
+    HandleExternalEvent(handle, false, true);
 }
 
-void LiveGrapher::AddData(const std::string& dataset,
-                          std::chrono::milliseconds time, float value) {
-    AddDataImpl(dataset, time, value);
+void LiveGrapher::OnTimer() {
+    RequireExternal("OnTimer()");
+    HandleExternalEvent(std::nullopt, false, false);
+}
+
+void LiveGrapher::SetWakeCallback(std::function<void()> callback) {
+    m_wakeCallback = std::move(callback);
+}
+
+void LiveGrapher::WakeNetworkThread() {
+    // Restart select() so new data is sent out by its flush deadline. Inline
+    // hosts send it on the next Poll() call instead, and external hosts on
+    // the OnTimer() call their event loop schedules.
+    if (m_threading == Threading::kThread) {
+        m_selector->Cancel();
+    } else if (m_threading == Threading::kExternal && m_wakeCallback) {
+        m_wakeCallback();
+    }
 }
 
-void LiveGrapher::AddDataImpl(const std::string& dataset,
-                              std::chrono::milliseconds time, float value) {
-    // HACK: The dataset argument uses const std::string& instead of
-    // std::string_view because std::map doesn't have a find(std::string_view)
-    // overload.
+void LiveGrapher::HandleExternalEvent(
+    std::optional<Socket::NativeHandle> handle, bool readable,
+    bool writable) {
+    auto cpuTime = ThreadCPUTime();
+    bool telemetryEnabled = m_telemetryEnabled.load(std::memory_order_acquire);
+    if (telemetryEnabled) {
+        ++m_telemetry.wakeups;
+    }
+
+    if (handle == m_listener.Handle()) {
+        AcceptClient(telemetryEnabled);
+    } else if (handle) {
+        TimedLock lock(m_connListMutex, m_lockHeldTime, telemetryEnabled);
+
+        auto conn = std::find_if(
+            m_connList.begin(), m_connList.end(), [&](const auto& conn) {
+                return conn.socket.Handle() == handle.value();
+            });
+        if (conn != m_connList.end()) {
+            size_t byteBudget = std::numeric_limits<size_t>::max();
+            ServiceConnection(conn, readable, writable, byteBudget,
+                              std::nullopt);
+        }
+    }
 
-    // This will only work if ints are the same size as floats
-    static_assert(sizeof(float) == sizeof(uint32_t),
-                  "float isn't 32 bits long");
+    // Servicing a client can queue data, close a connection, or take over
+    // another connection's session, so the interests and the timer are
+    // updated after every event
+    m_timerTime = PrepareNetworkPass(telemetryEnabled);
 
-    auto i = m_graphList.find(dataset);
+    m_pollCPUTime += ThreadCPUTime() - cpuTime;
+}
 
-    // Give the dataset an ID if it doesn't already have one
-    if (i == m_graphList.end()) {
-        m_graphList.emplace(dataset, static_cast<uint8_t>(m_graphList.size()));
+void LiveGrapher::RequireExternal(const char* function) const {
+    if (m_threading != Threading::kExternal) {
+        throw std::runtime_error(std::string{"LiveGrapher: "} + function +
+                                 " requires an external host");
     }
+}
 
-    // Do nothing if there's no active connections to receive the data
-    if (m_connList.empty()) {
+void LiveGrapher::SetWriteInterest(ClientConnection& conn, bool interest) {
+    conn.SetWriteInterest(interest);
+    if (!m_selector) {
         return;
     }
 
-    uint8_t id = i->second;
+    if (interest) {
+        m_selector->Add(conn.socket, SocketSelector::kWrite);
+    } else {
+        m_selector->Remove(conn.socket, SocketSelector::kWrite);
+    }
+}
 
-    ClientDataPacket packet;
-    packet.ID = kClientDataPacket | id;
+bool LiveGrapher::RunNetworkPass(
+    bool block, size_t& byteBudget,
+    std::optional<std::chrono::steady_clock::time_point> deadline) {
+    bool telemetryEnabled = m_telemetryEnabled.load(std::memory_order_acquire);
 
-    // Change to network byte order
-    // Swap bytes in x, and copy into the payload struct
-    uint64_t timeMs = time.count();
-    timeMs = HostToNetwork64(timeMs);
-    std::memcpy(&packet.x, &timeMs, sizeof(timeMs));
+    auto wakeTime = PrepareNetworkPass(telemetryEnabled);
 
-    // Swap bytes in y, and copy into the payload struct
-    uint32_t ytmp;
-    std::memcpy(&ytmp, &value, sizeof(ytmp));
-    ytmp = htonl(ytmp);
-    std::memcpy(&packet.y, &ytmp, sizeof(ytmp));
+    try {
+        bool ready;
+        if (!block) {
+            ready = m_selector->Select(std::chrono::microseconds{0});
+        } else if (wakeTime) {
+            ready = m_selector->Select(
+                std::chrono::duration_cast<std::chrono::microseconds>(
+                    wakeTime.value() - std::chrono::steady_clock::now()));
+        } else {
+            ready = m_selector->Select();
+        }
+        if (telemetryEnabled) {
+            ++m_telemetry.wakeups;
+        }
 
-    bool restartSelect = false;
+        // Packets left over from an earlier pass are parsed even if no
+        // socket is ready
+        if (!ready && !m_packetsDeferred) {
+            return false;
+        }
+    } catch (const std::system_error&) {
+        // If select() failed, one of the client socket descriptors is
+        // probably bad. We can't determine which, so we'll close all client
+        // connections. It's better than crashing the host.
+        TimedLock lock(m_connListMutex, m_lockHeldTime, telemetryEnabled);
+        auto conn = m_connList.begin();
+        while (conn != m_connList.end()) {
+            conn = CloseConnection(conn);
+        }
+        return false;
+    }
 
     {
-        std::scoped_lock lock(m_connListMutex);
+        TimedLock lock(m_connListMutex, m_lockHeldTime, telemetryEnabled);
 
-        // Send the point to connected clients
-        for (auto& conn : m_connList) {
-            if (conn.IsGraphSelected(id)) {
-                conn.AddData(
-                    {reinterpret_cast<char*>(&packet), sizeof(packet)});
-                restartSelect = true;
-            }
+        m_packetsDeferred = false;
+        auto conn = m_connList.begin();
+        while (conn != m_connList.end()) {
+            bool readable = m_selector->IsReadReady(conn->socket);
+            bool writable = m_selector->IsWriteReady(conn->socket);
+            conn = ServiceConnection(conn, readable, writable, byteBudget,
+                                     deadline);
         }
     }
 
-    if (restartSelect) {
-        // Restart select() with new data queued for write so it gets sent out
-        m_selector.Cancel();
+    if (m_selector->IsReadReady(m_listener)) {
+        AcceptClient(telemetryEnabled);
     }
+
+    return true;
 }
 
-void LiveGrapher::ThreadMain() {
-    while (m_isRunning) {
-        {
-            std::scoped_lock lock(m_connListMutex);
+std::optional<std::chrono::steady_clock::time_point>
+LiveGrapher::PrepareNetworkPass(bool telemetryEnabled) {
+    // Telemetry is sampled before sockets are marked for writing so its
+    // samples are sent out by this pass
+    if (telemetryEnabled) {
+        auto now = std::chrono::steady_clock::now();
+        if (now >= m_telemetry.nextTime) {
+            SampleTelemetry(now);
 
-            // Mark select on write for sockets with data queued
-            for (const auto& conn : m_connList) {
-                if (conn.HasDataToWrite()) {
-                    m_selector.Add(conn.socket, SocketSelector::kWrite);
-                }
+            // Skip missed samples instead of sending a burst of them
+            m_telemetry.nextTime += m_telemetry.period;
+            if (m_telemetry.nextTime <= now) {
+                m_telemetry.nextTime = now + m_telemetry.period;
             }
         }
+    }
 
-        try {
-            if (!m_selector.Select()) {
+    // Range responses and replayed samples are queued before sockets are
+    // marked for writing too
+    bool transfersPending = ServiceTransfers(telemetryEnabled);
+
+    bool hasClients;
+    bool replaysPending = false;
+    std::optional<std::chrono::steady_clock::time_point> flushTime;
+    {
+        TimedLock lock(m_connListMutex, m_lockHeldTime, telemetryEnabled);
+
+        // Tell clients with a session the sequence number they've been
+        // sent samples up to, so after a reconnect only the samples they
+        // missed are sent again. Markers are rate limited, so clients may
+        // be sent a few samples again.
+        auto now = std::chrono::steady_clock::now();
+        bool markersDue = !m_retained.empty() && now >= m_nextMarkerTime;
+        if (markersDue) {
+            m_nextMarkerTime = now + kSequenceMarkerPeriod;
+        }
+
+        bool heartbeatsDue = now >= m_nextHeartbeatTime;
+        if (heartbeatsDue) {
+            m_nextHeartbeatTime = now + kHeartbeatPeriod;
+        }
+
+        // Mark sockets with data due for writing
+        auto conn = m_connList.begin();
+        while (conn != m_connList.end()) {
+            // Close connections whose session was resumed on another
+            // connection
+            if (conn->IsCloseRequested()) {
+                conn = CloseConnection(conn);
+                continue;
+            }
+
+            // Evict clients that stopped accepting data, which frees the
+            // data queued for them
+            if (m_stallTimeout.count() > 0 && conn->HasDataToWrite() &&
+                now - conn->LastProgress() > m_stallTimeout) {
+                ++m_clientsEvicted;
+                conn = CloseConnection(conn);
                 continue;
             }
-        } catch (const std::system_error&) {
-            // If select() failed, one of the client socket descriptors is
-            // probably bad. We can't determine which, so we'll close all client
-            // connections. It's better than crashing the host.
-            for (const auto& conn : m_connList) {
-                m_selector.Remove(conn.socket, SocketSelector::kRead |
-                                                   SocketSelector::kWrite);
+
+            // A resumed session's missed samples are replayed while the
+            // client accepts them quickly enough to keep its write queue short
+            if (conn->IsReplaying() &&
+                conn->BytesQueued() < kMaxReplayQueued) {
+                ReplayRetained(*conn);
+                replaysPending = replaysPending || conn->IsReplaying();
             }
-            m_connList.clear();
-            continue;
-        }
 
-        {
-            std::scoped_lock lock(m_connListMutex);
-
-            auto conn = m_connList.begin();
-            while (conn != m_connList.end()) {
-                if (m_selector.IsReadReady(conn->socket)) {
-                    // If the read failed, remove the socket from the selector
-                    // and close the connection
-                    if (ReadPackets(*conn) == -1) {
-                        m_selector.Remove(
-                            conn->socket,
-                            SocketSelector::kRead | SocketSelector::kWrite);
-                        conn = m_connList.erase(conn);
-                        continue;
-                    }
-                }
+            // Idle clients are sent heartbeats so a dead peer leaves data
+            // unacknowledged, which the kernel and the stall check detect
+            if (heartbeatsDue && conn->AcceptsExtendedPackets() &&
+                !conn->HasDataToWrite()) {
+                conn->AddData(
+                    MakeClientExtendedPacket(kClientHeartbeatPacket, {}));
+            }
+
+            // A marker would claim the samples still being replayed were
+            // sent, so it's held back until they are
+            if (markersDue && conn->HasDataToWrite() &&
+                conn->SessionToken() != 0 && !conn->IsReplaying() &&
+                conn->MarkedSequence() != m_nextSequence) {
+                std::string payload;
+                AppendNetworkOrder(payload, m_nextSequence);
+                conn->AddData(MakeClientExtendedPacket(
+                    kClientSequencePacket, payload));
+                conn->SetMarkedSequence(m_nextSequence);
+            }
 
-                if (m_selector.IsWriteReady(conn->socket)) {
-                    // If the write failed, remove the socket from the selector
-                    // and close the connection
-                    if (!conn->WriteToSocket()) {
-                        m_selector.Remove(
-                            conn->socket,
-                            SocketSelector::kRead | SocketSelector::kWrite);
-                        conn = m_connList.erase(conn);
-                        continue;
-                    }
-
-                    if (!conn->HasDataToWrite()) {
-                        m_selector.Remove(conn->socket, SocketSelector::kWrite);
-                    }
+            // Queued data is coalesced until its flush policy says to send
+            // it, so only writes that are due are waited on
+            if (conn->IsFlushDue(now)) {
+                SetWriteInterest(*conn, true);
+            } else {
+                SetWriteInterest(*conn, false);
+                if (conn->HasDataToWrite()) {
+                    auto deadline = conn->FlushDeadline();
+                    flushTime =
+                        std::min(flushTime.value_or(deadline), deadline);
                 }
+            }
+
+            ++conn;
+        }
+
+        hasClients = !m_connList.empty();
+    }
+
+    // Wake up in time for the next telemetry sample, the next flush deadline,
+    // and, while there are clients, the next heartbeat. Pending replays and
+    // range requests are continued right away.
+    auto wakeTime = flushTime;
+    if (replaysPending || transfersPending) {
+        wakeTime = std::chrono::steady_clock::now();
+    }
+    if (telemetryEnabled) {
+        wakeTime = std::min(wakeTime.value_or(m_telemetry.nextTime),
+                            m_telemetry.nextTime);
+    }
+    if (hasClients) {
+        wakeTime = std::min(wakeTime.value_or(m_nextHeartbeatTime),
+                            m_nextHeartbeatTime);
+    }
+
+    return wakeTime;
+}
+
+std::vector<ClientConnection>::iterator LiveGrapher::ServiceConnection(
+    std::vector<ClientConnection>::iterator conn, bool readable, bool writable,
+    size_t& byteBudget,
+    std::optional<std::chrono::steady_clock::time_point> deadline) {
+    // Close connections whose session was resumed on another connection
+    if (conn->IsCloseRequested()) {
+        return CloseConnection(conn);
+    }
+
+    // The kernel reports a peer that stopped answering keepalive probes or
+    // acknowledging data as a timeout
+    Socket::ClearLastError();
 
-                ++conn;
+    if (readable || !conn->ReceivedData().empty()) {
+        // If the read failed, remove the socket from the selector and close
+        // the connection
+        if (ReadPackets(*conn, readable, deadline) == -1) {
+            if (Socket::LastError() == Socket::kTimedOut) {
+                ++m_clientsEvicted;
             }
+            return CloseConnection(conn);
         }
+    }
 
-        if (m_selector.IsReadReady(m_listener)) {
-            auto socket = m_listener.Accept();
-            m_selector.Add(socket, SocketSelector::kRead);
+    if (byteBudget > 0 && writable) {
+        // If the write failed, remove the socket from the selector and close
+        // the connection
+        uint64_t bytesSent = conn->BytesSent();
+        if (!conn->WriteToSocket(m_datasetLatency.data(), byteBudget)) {
+            if (Socket::LastError() == Socket::kTimedOut) {
+                ++m_clientsEvicted;
+            }
+            return CloseConnection(conn);
+        }
+        byteBudget -= conn->BytesSent() - bytesSent;
 
-            std::scoped_lock lock(m_connListMutex);
-            m_connList.emplace_back(std::move(socket));
+        if (!conn->HasDataToWrite()) {
+            SetWriteInterest(*conn, false);
         }
     }
+
+    return ++conn;
 }
 
-int LiveGrapher::ReadPackets(ClientConnection& conn) {
-    char packetID;
+void LiveGrapher::AcceptClient(bool telemetryEnabled) {
+    // The client may have disconnected since the listener became readable
+    std::optional<TcpSocket> socket;
+    try {
+        socket.emplace(m_listener.Accept());
+    } catch (const std::system_error&) {
+        return;
+    }
+
+    if (m_selector) {
+        m_selector->Add(socket.value(), SocketSelector::kRead);
+    }
+
+    TimedLock lock(m_connListMutex, m_lockHeldTime, telemetryEnabled);
+    auto& conn = m_connList.emplace_back(std::move(socket.value()));
+    UpdateHasConsumers();
+    conn.Budget() = MakeBudget(m_clientBandwidthLimit);
+    conn.SetFlushPolicy(m_flushBytes, m_flushDelay);
+    if (m_stallTimeout.count() > 0) {
+        conn.socket.SetDeadPeerTimeout(m_stallTimeout);
+    }
+}
 
-    if (!conn.socket.Read(&packetID, 1)) {
+int LiveGrapher::ReadPackets(
+    ClientConnection& conn, bool readable,
+    std::optional<std::chrono::steady_clock::time_point> deadline) {
+    // Packets are at most this long, so a buffer at least this long already
+    // holds a complete packet and nothing more is received until it's parsed
+    constexpr size_t kMaxPacketLength =
+        1 + sizeof(uint32_t) + kMaxHostExtendedLength;
+    if (readable && conn.ReceivedData().size() < kMaxPacketLength &&
+        !conn.ReceiveFromSocket()) {
         return -1;
     }
 
+    // Taken right after receiving so time sync responses include as little of
+    // the host's processing time as possible
+    auto receiveTime = std::chrono::steady_clock::now();
+
+    // Only complete packets are parsed. A partial packet stays in the buffer
+    // until the rest of it is received.
+    auto data = conn.ReceivedData();
+    size_t pos = 0;
+    while (true) {
+        auto length = PacketLength(data.substr(pos));
+        if (!length) {
+            return -1;
+        }
+        if (length.value() == 0) {
+            break;
+        }
+
+        HandlePacket(conn, data.substr(pos, length.value()), receiveTime);
+        pos += length.value();
+
+        // Poll() stops parsing once its time budget runs out
+        if (deadline && std::chrono::steady_clock::now() >= deadline.value()) {
+            m_packetsDeferred = true;
+            break;
+        }
+    }
+    conn.ConsumeReceived(pos);
+
+    return 0;
+}
+
+void LiveGrapher::HandlePacket(
+    ClientConnection& conn, std::string_view packet,
+    std::chrono::steady_clock::time_point receiveTime) {
+    uint8_t packetID = packet[0];
+
     switch (PacketType(packetID)) {
         case kHostConnectPacket:
             // Start sending data for the graph specified by the ID
@@ -220,37 +1477,561 @@ int LiveGrapher::ReadPackets(ClientConnection& conn) {
             // Stop sending data for the graph specified by the ID
             conn.UnselectGraph(GraphID(packetID));
             break;
+        case kHostExtendedPacket:
+            if (packetID == kHostHelloPacket) {
+                HandleHelloPacket(conn, packet.substr(1));
+            } else {
+                HandleExtendedPacket(conn, packetID,
+                                     packet.substr(1 + sizeof(uint32_t)),
+                                     receiveTime);
+            }
+            break;
         case kHostListPacket:
-            // 255 is the max graph name length
-            char buf[1 + 1 + 255 + 1];
-
-            // A graph count is compared against instead of the graph ID for
-            // terminating list traversal because the std::map is sorted by
-            // graph name instead of the ID. Since, the IDs are not necessarily
-            // in order, early traversal termination could occur.
-            size_t graphCount = 0;
-            for (const auto& [graph, graphID] : m_graphList) {
-                buf[0] = kClientListPacket | graphID;
-                buf[1] = static_cast<char>(graph.length());
-                std::copy(graph.c_str(), graph.c_str() + graph.length(),
-                          &buf[2]);
-
-                // Is this the last element in the list?
-                if (graphCount + 1 == m_graphList.size()) {
-                    buf[2 + buf[1]] = 1;
-                } else {
-                    buf[2 + buf[1]] = 0;
+            // The catalog is serialized when datasets are registered, so
+            // answering a list request is a single copy
+            conn.AddData(m_catalog);
+            break;
+    }
+}
+
+void LiveGrapher::HandleExtendedPacket(
+    ClientConnection& conn, uint8_t id, std::string_view payload,
+    std::chrono::steady_clock::time_point receiveTime) {
+    // Unknown extended packets are ignored so newer clients can talk to
+    // older hosts
+    switch (id) {
+        case kHostStatsPacket:
+            SendStats(conn);
+            break;
+        case kHostTimeSyncPacket:
+            SendTimeSync(conn, payload, receiveTime);
+            break;
+        case kHostCatalogSubscribePacket:
+            conn.SubscribeCatalog();
+            break;
+        case kHostBandwidthPacket:
+            SendBandwidth(conn);
+            break;
+        case kHostResumePacket:
+            ResumeSession(conn, payload);
+            break;
+        case kHostRangePacket:
+            SendRange(conn, payload);
+            break;
+        case kHostFlushPolicyPacket:
+            if (payload.size() == 2 * sizeof(uint32_t)) {
+                // Clients can only trade their own latency for efficiency up
+                // to a point
+                auto bytes = ReadNetworkOrder<uint32_t>(payload.data());
+                auto delay = std::min(
+                    std::chrono::microseconds{ReadNetworkOrder<uint32_t>(
+                        payload.data() + sizeof(uint32_t))},
+                    std::chrono::microseconds{kMaxFlushDelay});
+                conn.RequestFlushPolicy(bytes, delay);
+            }
+            break;
+    }
+}
+
+void LiveGrapher::HandleHelloPacket(ClientConnection& conn,
+                                    std::string_view payload) {
+    // The six low-order bits of each byte hold the value
+    uint8_t capabilities = payload[1] & 0x3F;
+
+    // Native data packets are little-endian
+    uint8_t supported = 0;
+    if (IsLittleEndian()) {
+        supported |= kCapNativeSamples;
+    }
+    if (m_clock) {
+        supported |= kCapCustomClock;
+    }
+    capabilities &= supported;
+
+    conn.AcceptExtendedPackets();
+    conn.SetNativeSamples(capabilities & kCapNativeSamples);
+
+    // Samples queued from here on use the agreed format, and the response is
+    // queued before them so the client knows which format to expect
+    std::string response;
+    AppendNetworkOrder(response, kProtocolVersion);
+    AppendNetworkOrder(response, capabilities);
+    conn.AddData(MakeClientExtendedPacket(kClientHelloPacket, response));
+}
+
+/**
+ * Appends a latency histogram to a stats packet payload.
+ *
+ * Only non-empty buckets are included.
+ *
+ * @param buf       The payload.
+ * @param kind      The kind of histogram.
+ * @param index     The connection index or graph ID.
+ * @param flags     The histogram flags.
+ * @param histogram The histogram.
+ */
+static void AppendHistogram(std::string& buf, uint8_t kind, uint8_t index,
+                            uint8_t flags, const LatencyHistogram& histogram) {
+    AppendNetworkOrder(buf, kind);
+    AppendNetworkOrder(buf, index);
+    AppendNetworkOrder(buf, flags);
+    AppendNetworkOrder(buf, histogram.Count());
+    AppendNetworkOrder(buf, histogram.Sum());
+    AppendNetworkOrder(buf, histogram.Max());
+
+    uint16_t bucketCount = 0;
+    for (size_t i = 0; i < LatencyHistogram::kNumBuckets; ++i) {
+        if (histogram.BucketCount(i) > 0) {
+            ++bucketCount;
+        }
+    }
+    AppendNetworkOrder(buf, bucketCount);
+
+    for (size_t i = 0; i < LatencyHistogram::kNumBuckets; ++i) {
+        if (histogram.BucketCount(i) > 0) {
+            AppendNetworkOrder(buf, static_cast<uint16_t>(i));
+            AppendNetworkOrder(buf, histogram.BucketCount(i));
+        }
+    }
+}
+
+void LiveGrapher::SendStats(ClientConnection& conn) {
+    // Called from ReadPackets(), so m_connListMutex is already held
+    std::string payload;
+    AppendNetworkOrder(payload,
+                       static_cast<uint8_t>(LatencyHistogram::kSubBucketBits));
+
+    // Connections beyond the 255th aren't reported individually
+    size_t connCount = std::min<size_t>(m_connList.size(), 255);
+    uint16_t histogramCount = connCount;
+    for (const auto& histogram : m_datasetLatency) {
+        if (histogram.Count() > 0) {
+            ++histogramCount;
+        }
+    }
+    AppendNetworkOrder(payload, histogramCount);
+
+    for (size_t i = 0; i < connCount; ++i) {
+        AppendHistogram(payload, kStatsConnectionHistogram, i,
+                        &m_connList[i] == &conn ? kStatsRequesterFlag : 0,
+                        m_connList[i].Latency());
+    }
+    for (size_t id = 0; id < m_datasetLatency.size(); ++id) {
+        if (m_datasetLatency[id].Count() > 0) {
+            AppendHistogram(payload, kStatsDatasetHistogram, id, 0,
+                            m_datasetLatency[id]);
+        }
+    }
+
+    conn.AddData(MakeClientExtendedPacket(kClientStatsPacket, payload));
+}
+
+void LiveGrapher::SendBandwidth(ClientConnection& conn) {
+    std::string payload;
+    AppendNetworkOrder<uint64_t>(payload, m_totalBudget.Rate());
+    AppendNetworkOrder<uint64_t>(payload, conn.Budget().Rate());
+
+    AppendNetworkOrder(payload,
+                       static_cast<uint8_t>(ClientConnection::kNumPriorities));
+    for (size_t i = 0; i < ClientConnection::kNumPriorities; ++i) {
+        AppendNetworkOrder(payload, conn.SamplesAdmitted(i));
+        AppendNetworkOrder(payload, conn.SamplesShed(i));
+    }
+
+    // The priority class of every registered dataset
+    std::string priorities;
+    for (size_t id = 0; id < DatasetRegistry::kCapacity; ++id) {
+        if (m_registry.Name(id)) {
+            priorities += static_cast<char>(id);
+            priorities += static_cast<char>(m_priorities[id]);
+        }
+    }
+    AppendNetworkOrder(payload, static_cast<uint8_t>(priorities.size() / 2));
+    payload += priorities;
+
+    conn.AddData(MakeClientExtendedPacket(kClientBandwidthPacket, payload));
+}
+
+void LiveGrapher::ResumeSession(ClientConnection& conn,
+                                std::string_view payload) {
+    // The request contains the client's session token, or zero if it doesn't
+    // have one, and the sequence number in the last sequence marker it
+    // received
+    if (payload.size() != 2 * sizeof(uint64_t)) {
+        return;
+    }
+    auto token = ReadNetworkOrder<uint64_t>(payload.data());
+    auto sequence = ReadNetworkOrder<uint64_t>(payload.data() + sizeof(token));
+
+    auto sendSession = [&](uint8_t status, uint64_t selection) {
+        std::string response;
+        AppendNetworkOrder(response, conn.SessionToken());
+        AppendNetworkOrder(response, status);
+        AppendNetworkOrder(response, selection);
+        AppendNetworkOrder(response, sequence);
+        conn.AddData(MakeClientExtendedPacket(kClientSessionPacket, response));
+    };
+
+    // A token of zero tells the client that resuming is disabled
+    if (m_retained.empty()) {
+        sequence = 0;
+        sendSession(kSessionNew, 0);
+        return;
+    }
+
+    std::optional<Session> session;
+    if (token != 0) {
+        auto now = std::chrono::steady_clock::now();
+        if (auto it = m_sessions.find(token); it != m_sessions.end()) {
+            if (now - it->second.closeTime <= m_sessionTimeout) {
+                session = it->second;
+            }
+            m_sessions.erase(it);
+        } else {
+            // After a radio drop, the client may reconnect before its old
+            // connection is found to be dead. The old connection's session is
+            // taken over and the connection closed.
+            for (auto& other : m_connList) {
+                if (&other != &conn && other.SessionToken() == token) {
+                    session = Session{other.Selection(),
+                                      other.IsCatalogSubscribed(), now};
+                    other.SetSessionToken(0);
+                    other.RequestClose();
+                    break;
                 }
+            }
+        }
+    }
+
+    if (!session) {
+        // Start a new session. Zero means no session, so it's never a token.
+        do {
+            token = m_tokenGenerator();
+        } while (token == 0 || m_sessions.count(token) > 0);
+
+        conn.SetSessionToken(token);
+        sequence = m_nextSequence;
+        conn.SetMarkedSequence(sequence);
+        sendSession(kSessionNew, 0);
+        return;
+    }
+
+    conn.SetSessionToken(token);
+    conn.SetSelection(session->selection);
+    if (session->catalogSubscribed) {
+        conn.SubscribeCatalog();
+    }
+
+    // Samples that fell out of the ring buffer are lost
+    uint64_t oldest =
+        m_nextSequence - std::min<uint64_t>(m_nextSequence, m_retained.size());
+    uint8_t status = kSessionResumed;
+    if (sequence < oldest) {
+        status = kSessionResumedWithLoss;
+        sequence = oldest;
+    }
+    sequence = std::min(sequence, m_nextSequence);
+
+    sendSession(status, session->selection);
+    conn.SetMarkedSequence(sequence);
+
+    // The missed samples are replayed a chunk at a time by later network
+    // passes, so a long outage doesn't hold the lock for long or fill the
+    // write queue all at once
+    conn.SetReplay(sequence, m_nextSequence);
+}
+
+void LiveGrapher::ReplayRetained(ClientConnection& conn) {
+    if (m_retained.empty()) {
+        conn.SetReplay(0, 0);
+        return;
+    }
 
-                // Send graph name. The data size is computed explicitly here
-                // because the buffer string's current length may be larger than
-                // that.
-                conn.AddData({buf, 1 + 1 + graph.length() + 1});
+    // Samples that fell out of the ring buffer while the replay waited are
+    // lost
+    uint64_t oldest =
+        m_nextSequence - std::min<uint64_t>(m_nextSequence, m_retained.size());
+    uint64_t cursor = std::max(conn.ReplayCursor(), oldest);
+    uint64_t end = std::min(conn.ReplayEnd(), cursor + kRetainedScanSamples);
+
+    // The missed samples of the selected datasets are sent in order. They're
+    // subject to the bandwidth budget like new samples, and samples withheld
+    // by decimation stay withheld.
+    auto now = std::chrono::steady_clock::now();
+    for (; cursor < end; ++cursor) {
+        const auto& sample = m_retained[cursor % m_retained.size()];
+        if (!sample.streamed || !conn.IsGraphSelected(sample.id) ||
+            sample.generation != m_retainedGenerations[sample.id]) {
+            continue;
+        }
 
-                graphCount++;
+        auto priority = m_priorities[sample.id];
+        uint64_t time = sample.time / 1000;
+        if (conn.NativeSamples()) {
+            auto packet =
+                MakeClientNativeDataPacket(sample.id, time, sample.value);
+            if (AdmitSample(conn, priority, sizeof(packet), now)) {
+                conn.AddSample(
+                    {reinterpret_cast<char*>(&packet), sizeof(packet)},
+                    sample.id, now);
             }
-            break;
+        } else {
+            auto packet = MakeClientDataPacket(sample.id, time, sample.value);
+            if (AdmitSample(conn, priority, sizeof(packet), now)) {
+                conn.AddSample(
+                    {reinterpret_cast<char*>(&packet), sizeof(packet)},
+                    sample.id, now);
+            }
+        }
     }
 
-    return 0;
+    conn.SetReplay(cursor, conn.ReplayEnd());
+}
+
+void LiveGrapher::SendRange(ClientConnection& conn, std::string_view payload) {
+    // The request contains the graph ID and the first and last millisecond of
+    // the range
+    if (payload.size() != 1 + 2 * sizeof(uint64_t)) {
+        return;
+    }
+    uint8_t id = GraphID(payload[0]);
+    auto first = static_cast<int64_t>(
+        ReadNetworkOrder<uint64_t>(payload.data() + 1));
+    auto last = static_cast<int64_t>(
+        ReadNetworkOrder<uint64_t>(payload.data() + 1 + sizeof(uint64_t)));
+
+    // A client can only have so many requests waiting, so it can't make the
+    // host hold an unbounded number of them
+    auto& transfers = conn.RangeTransfers();
+    if (transfers.size() >= kMaxRangeRequests) {
+        std::string response;
+        AppendNetworkOrder(response, id);
+        conn.AddBulkData(
+            MakeClientExtendedPacket(kClientRangePacket, response));
+        return;
+    }
+
+    // Requests that can't be answered are queued too, so responses are sent
+    // in the order the requests were received
+    ClientConnection::RangeTransfer transfer;
+    transfer.id = id;
+    transfer.generation = m_retainedGenerations[id];
+    transfer.first = 1;
+    transfer.last = 0;
+    transfer.cursor = m_nextSequence;
+    transfer.end = m_nextSequence;
+
+    // The range is clamped to the retained history. Once the ring buffer
+    // wrapped, the oldest millisecond in it may be missing samples.
+    if (!m_retained.empty() && m_nextSequence > 0) {
+        uint64_t oldest = m_nextSequence -
+                          std::min<uint64_t>(m_nextSequence, m_retained.size());
+        int64_t oldestTime = m_retained[oldest % m_retained.size()].time / 1000;
+        transfer.first =
+            std::max(first, oldest > 0 ? oldestTime + 1 : oldestTime);
+        transfer.last = last;
+        transfer.cursor = oldest;
+    }
+
+    transfers.emplace_back(std::move(transfer));
+}
+
+bool LiveGrapher::ServiceTransfers(bool telemetryEnabled) {
+    struct Job {
+        size_t index;
+        ClientConnection::RangeTransfer transfer;
+        size_t room;
+        std::vector<std::string> packets;
+        bool done;
+    };
+
+    // Only the network thread adds and removes connections, so the indices
+    // of the connections jobs were taken from stay valid while the lock is
+    // released
+    bool pending = false;
+    std::vector<Job> jobs;
+    {
+        TimedLock lock(m_connListMutex, m_lockHeldTime, telemetryEnabled);
+
+        for (size_t i = 0; i < m_connList.size(); ++i) {
+            auto& conn = m_connList[i];
+            if (conn.BulkBytesQueued() >= kMaxRangeQueued) {
+                continue;
+            }
+
+            auto& transfers = conn.RangeTransfers();
+            if (transfers.empty()) {
+                continue;
+            }
+
+            auto& transfer = transfers.front();
+            if (transfer.cursor < transfer.end) {
+                ScanRange(transfer);
+            }
+            if (transfer.cursor < transfer.end) {
+                pending = true;
+                continue;
+            }
+
+            // Samples that were all scanned are moved out so they can be
+            // sorted and serialized without the lock
+            jobs.push_back({i, std::move(transfer),
+                            kMaxRangeQueued - conn.BulkBytesQueued(),
+                            {},
+                            false});
+            transfers.pop_front();
+        }
+    }
+
+    if (jobs.empty()) {
+        return pending;
+    }
+
+    for (auto& job : jobs) {
+        job.done = SerializeRange(job.transfer, job.room, job.packets);
+    }
+
+    {
+        TimedLock lock(m_connListMutex, m_lockHeldTime, telemetryEnabled);
+
+        for (auto& job : jobs) {
+            auto& conn = m_connList[job.index];
+            for (auto& packet : job.packets) {
+                conn.AddBulkData(std::move(packet));
+            }
+            if (!job.done) {
+                conn.RangeTransfers().emplace_front(std::move(job.transfer));
+            }
+            pending = pending || !conn.RangeTransfers().empty();
+        }
+    }
+
+    return pending;
+}
+
+void LiveGrapher::ScanRange(ClientConnection::RangeTransfer& transfer) {
+    if (m_retained.empty()) {
+        transfer.cursor = transfer.end;
+        return;
+    }
+
+    // Samples that fell out of the ring buffer while the request waited are
+    // lost, so the range starts after the oldest millisecond still retained
+    uint64_t oldest =
+        m_nextSequence - std::min<uint64_t>(m_nextSequence, m_retained.size());
+    if (transfer.cursor < oldest) {
+        transfer.cursor = oldest;
+        int64_t oldestTime = m_retained[oldest % m_retained.size()].time / 1000;
+        transfer.first = std::max(transfer.first, oldestTime + 1);
+
+        auto& samples = transfer.samples;
+        samples.erase(std::remove_if(samples.begin(), samples.end(),
+                                     [&](const auto& sample) {
+                                         return sample.first / 1000 <
+                                                transfer.first;
+                                     }),
+                      samples.end());
+    }
+
+    // Samples of a dataset unregistered since the request was received
+    // belong to a different dataset than the one it was for
+    uint64_t end =
+        std::min(transfer.end, transfer.cursor + kRetainedScanSamples);
+    for (; transfer.cursor < end; ++transfer.cursor) {
+        const auto& sample = m_retained[transfer.cursor % m_retained.size()];
+        int64_t time = sample.time / 1000;
+        if (sample.id == transfer.id && time >= transfer.first &&
+            time <= transfer.last &&
+            sample.generation == transfer.generation) {
+            transfer.samples.emplace_back(sample.time, sample.value);
+        }
+    }
+}
+
+bool LiveGrapher::SerializeRange(ClientConnection::RangeTransfer& transfer,
+                                 size_t room,
+                                 std::vector<std::string>& packets) {
+    // A request that can't be answered gets a packet with only the graph ID
+    if (transfer.first > transfer.last) {
+        std::string response;
+        AppendNetworkOrder(response, transfer.id);
+        packets.emplace_back(
+            MakeClientExtendedPacket(kClientRangePacket, response));
+        return true;
+    }
+
+    auto& samples = transfer.samples;
+    if (!transfer.sorted) {
+        std::stable_sort(
+            samples.begin(), samples.end(),
+            [](const auto& a, const auto& b) { return a.first < b.first; });
+        transfer.sorted = true;
+    }
+
+    // The response is split into packets that each cover a range of whole
+    // milliseconds, so the client can replace the points in each one's range
+    // as it arrives. An empty range still gets a packet, which tells the
+    // client there are no points in it.
+    size_t bytes = 0;
+    do {
+        size_t begin = transfer.sent;
+        size_t end = std::min(begin + kRangePacketSamples, samples.size());
+        while (end < samples.size() &&
+               samples[end].first / 1000 == samples[end - 1].first / 1000) {
+            ++end;
+        }
+
+        int64_t packetFirst =
+            begin == 0 ? transfer.first : samples[begin].first / 1000;
+        int64_t packetLast = end == samples.size()
+                                 ? transfer.last
+                                 : samples[end].first / 1000 - 1;
+
+        std::string response;
+        AppendNetworkOrder(response, transfer.id);
+        AppendNetworkOrder(response, static_cast<uint64_t>(packetFirst));
+        AppendNetworkOrder(response, static_cast<uint64_t>(packetLast));
+        for (size_t i = begin; i < end; ++i) {
+            uint32_t value;
+            std::memcpy(&value, &samples[i].second, sizeof(value));
+            AppendNetworkOrder(response,
+                               static_cast<uint64_t>(samples[i].first));
+            AppendNetworkOrder(response, value);
+        }
+        packets.emplace_back(
+            MakeClientExtendedPacket(kClientRangePacket, response));
+        bytes += packets.back().size();
+
+        transfer.sent = end;
+    } while (transfer.sent < samples.size() && bytes < room);
+
+    return transfer.sent == samples.size();
+}
+
+void LiveGrapher::SendTimeSync(
+    ClientConnection& conn, std::string_view payload,
+    std::chrono::steady_clock::time_point receiveTime) {
+    using std::chrono::duration_cast;
+    using std::chrono::microseconds;
+    using std::chrono::steady_clock;
+
+    // The request contains the client's transmit time
+    if (payload.size() != sizeof(uint64_t)) {
+        return;
+    }
+
+    // The client's transmit time is echoed back so the client doesn't have to
+    // match responses to requests. The transmit time is taken when the
+    // response is queued, so time spent in the write queue shows up as a
+    // longer round-trip time and the client can discard that exchange.
+    std::string response{payload};
+    AppendNetworkOrder<uint64_t>(
+        response,
+        duration_cast<microseconds>(receiveTime.time_since_epoch()).count());
+    AppendNetworkOrder<uint64_t>(
+        response,
+        duration_cast<microseconds>(steady_clock::now().time_since_epoch())
+            .count());
+
+    conn.AddData(MakeClientExtendedPacket(kClientTimeSyncPacket, response));
 }
@@ -0,0 +1,215 @@
+// Copyright (c) 2020 FRC Team 3512. All Rights Reserved.
+
+#include "livegrapher/MappedFile.hpp"
+
+#include <stdint.h>
+
+#ifdef _WIN32
+#define _WIN32_LEAN_AND_MEAN
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+
+#include <winsock2.h>
+#include <windows.h>
+
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <cerrno>
+#include <system_error>
+#include <utility>
+
+#ifdef _WIN32
+MappedFile::MappedFile(const std::string& path) {
+    m_file = CreateFileA(path.c_str(), GENERIC_READ,
+                         FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr,
+                         OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (m_file == INVALID_HANDLE_VALUE) {
+        m_file = nullptr;
+        throw std::system_error(GetLastError(), std::system_category(),
+                                "MappedFile");
+    }
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(m_file, &size)) {
+        int error = GetLastError();
+        CloseHandle(m_file);
+        throw std::system_error(error, std::system_category(), "MappedFile");
+    }
+    m_size = static_cast<size_t>(size.QuadPart);
+
+    // Windows can't map empty files
+    if (m_size == 0) {
+        return;
+    }
+
+    m_mapping =
+        CreateFileMappingA(m_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (m_mapping == nullptr) {
+        int error = GetLastError();
+        CloseHandle(m_file);
+        throw std::system_error(error, std::system_category(), "MappedFile");
+    }
+
+    m_data = static_cast<char*>(
+        MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, m_size));
+    if (m_data == nullptr) {
+        int error = GetLastError();
+        CloseHandle(m_mapping);
+        CloseHandle(m_file);
+        throw std::system_error(error, std::system_category(), "MappedFile");
+    }
+}
+
+MappedFile::MappedFile(const std::string& path, size_t size) : m_size{size} {
+    m_file = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE,
+                         FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr,
+                         CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (m_file == INVALID_HANDLE_VALUE) {
+        m_file = nullptr;
+        throw std::system_error(GetLastError(), std::system_category(),
+                                "MappedFile");
+    }
+
+    // Creating the mapping with an explicit size resizes the file to match
+    m_mapping = CreateFileMappingA(m_file, nullptr, PAGE_READWRITE,
+                                   static_cast<DWORD>(uint64_t{size} >> 32),
+                                   static_cast<DWORD>(size), nullptr);
+    if (m_mapping == nullptr) {
+        int error = GetLastError();
+        CloseHandle(m_file);
+        throw std::system_error(error, std::system_category(), "MappedFile");
+    }
+
+    m_data = static_cast<char*>(
+        MapViewOfFile(m_mapping, FILE_MAP_ALL_ACCESS, 0, 0, m_size));
+    if (m_data == nullptr) {
+        int error = GetLastError();
+        CloseHandle(m_mapping);
+        CloseHandle(m_file);
+        throw std::system_error(error, std::system_category(), "MappedFile");
+    }
+}
+
+MappedFile::~MappedFile() {
+    if (m_data != nullptr) {
+        UnmapViewOfFile(m_data);
+    }
+    if (m_mapping != nullptr) {
+        CloseHandle(m_mapping);
+    }
+    if (m_file != nullptr) {
+        CloseHandle(m_file);
+    }
+}
+
+MappedFile::MappedFile(MappedFile&& rhs) {
+    std::swap(m_data, rhs.m_data);
+    std::swap(m_size, rhs.m_size);
+    std::swap(m_file, rhs.m_file);
+    std::swap(m_mapping, rhs.m_mapping);
+}
+
+MappedFile& MappedFile::operator=(MappedFile&& rhs) {
+    std::swap(m_data, rhs.m_data);
+    std::swap(m_size, rhs.m_size);
+    std::swap(m_file, rhs.m_file);
+    std::swap(m_mapping, rhs.m_mapping);
+
+    return *this;
+}
+
+void MappedFile::Flush() {
+    if (m_data != nullptr) {
+        FlushViewOfFile(m_data, m_size);
+    }
+}
+#else
+MappedFile::MappedFile(const std::string& path) {
+    m_fd = open(path.c_str(), O_RDONLY);
+    if (m_fd == -1) {
+        throw std::system_error(errno, std::system_category(), "MappedFile");
+    }
+
+    struct stat info;
+    if (fstat(m_fd, &info) == -1) {
+        int error = errno;
+        close(m_fd);
+        throw std::system_error(error, std::system_category(), "MappedFile");
+    }
+    m_size = info.st_size;
+
+    // mmap(2) rejects zero-length mappings
+    if (m_size == 0) {
+        return;
+    }
+
+    void* data = mmap(nullptr, m_size, PROT_READ, MAP_SHARED, m_fd, 0);
+    if (data == MAP_FAILED) {
+        int error = errno;
+        close(m_fd);
+        throw std::system_error(error, std::system_category(), "mmap");
+    }
+    m_data = static_cast<char*>(data);
+}
+
+MappedFile::MappedFile(const std::string& path, size_t size) : m_size{size} {
+    m_fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (m_fd == -1) {
+        throw std::system_error(errno, std::system_category(), "MappedFile");
+    }
+
+    if (ftruncate(m_fd, m_size) == -1) {
+        int error = errno;
+        close(m_fd);
+        throw std::system_error(error, std::system_category(), "ftruncate");
+    }
+
+    void* data =
+        mmap(nullptr, m_size, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0);
+    if (data == MAP_FAILED) {
+        int error = errno;
+        close(m_fd);
+        throw std::system_error(error, std::system_category(), "mmap");
+    }
+    m_data = static_cast<char*>(data);
+}
+
+MappedFile::~MappedFile() {
+    if (m_data != nullptr) {
+        munmap(m_data, m_size);
+    }
+    if (m_fd != -1) {
+        close(m_fd);
+    }
+}
+
+MappedFile::MappedFile(MappedFile&& rhs) {
+    std::swap(m_data, rhs.m_data);
+    std::swap(m_size, rhs.m_size);
+    std::swap(m_fd, rhs.m_fd);
+}
+
+MappedFile& MappedFile::operator=(MappedFile&& rhs) {
+    std::swap(m_data, rhs.m_data);
+    std::swap(m_size, rhs.m_size);
+    std::swap(m_fd, rhs.m_fd);
+
+    return *this;
+}
+
+void MappedFile::Flush() {
+    if (m_data != nullptr) {
+        msync(m_data, m_size, MS_ASYNC);
+    }
+}
+#endif
+
+char* MappedFile::Data() const { return m_data; }
+
+size_t MappedFile::Size() const { return m_size; }
@@ -0,0 +1,57 @@
+// Copyright (c) 2020 FRC Team 3512. All Rights Reserved.
+
+#include "livegrapher/PriorityMutex.hpp"
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+#include <system_error>
+
+#ifdef _WIN32
+PriorityMutex::PriorityMutex() = default;
+
+PriorityMutex::~PriorityMutex() = default;
+
+void PriorityMutex::lock() { m_mutex.lock(); }
+
+bool PriorityMutex::try_lock() { return m_mutex.try_lock(); }
+
+void PriorityMutex::unlock() { m_mutex.unlock(); }
+#else
+PriorityMutex::PriorityMutex() {
+    pthread_mutexattr_t attr;
+    int error = pthread_mutexattr_init(&attr);
+    if (error != 0) {
+        throw std::system_error(error, std::system_category(),
+                                "PriorityMutex");
+    }
+
+#if defined(_POSIX_THREAD_PRIO_INHERIT) && _POSIX_THREAD_PRIO_INHERIT > 0
+    error = pthread_mutexattr_setprotocol(&attr, PTHREAD_PRIO_INHERIT);
+#endif
+    if (error == 0) {
+        error = pthread_mutex_init(&m_mutex, &attr);
+    }
+    pthread_mutexattr_destroy(&attr);
+
+    if (error != 0) {
+        throw std::system_error(error, std::system_category(),
+                                "PriorityMutex");
+    }
+}
+
+PriorityMutex::~PriorityMutex() { pthread_mutex_destroy(&m_mutex); }
+
+void PriorityMutex::lock() {
+    int error = pthread_mutex_lock(&m_mutex);
+    if (error != 0) {
+        throw std::system_error(error, std::system_category(),
+                                "PriorityMutex");
+    }
+}
+
+bool PriorityMutex::try_lock() { return pthread_mutex_trylock(&m_mutex) == 0; }
+
+void PriorityMutex::unlock() { pthread_mutex_unlock(&m_mutex); }
+#endif
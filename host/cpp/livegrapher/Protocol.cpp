@@ -0,0 +1,78 @@
+// Copyright (c) 2013-2020 FRC Team 3512. All Rights Reserved.
+
+#include "livegrapher/Protocol.hpp"
+
+#ifdef _WIN32
+#define _WIN32_LEAN_AND_MEAN
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+
+#include <winsock2.h>
+
+#else
+#include <arpa/inet.h>
+#endif
+
+#include <cstring>
+
+uint64_t HostToNetwork64(uint64_t in) {
+    uint64_t out;
+    auto outArr = reinterpret_cast<uint8_t*>(&out);
+    outArr[0] = in >> 56 & 0xff;
+    outArr[1] = in >> 48 & 0xff;
+    outArr[2] = in >> 40 & 0xff;
+    outArr[3] = in >> 32 & 0xff;
+    outArr[4] = in >> 24 & 0xff;
+    outArr[5] = in >> 16 & 0xff;
+    outArr[6] = in >> 8 & 0xff;
+    outArr[7] = in >> 0 & 0xff;
+    return out;
+}
+
+ClientDataPacket MakeClientDataPacket(uint8_t id, uint64_t time, float value) {
+    // This will only work if ints are the same size as floats
+    static_assert(sizeof(float) == sizeof(uint32_t),
+                  "float isn't 32 bits long");
+
+    ClientDataPacket packet;
+    packet.ID = kClientDataPacket | id;
+
+    // Change to network byte order
+    // Swap bytes in x, and copy into the payload struct
+    time = HostToNetwork64(time);
+    std::memcpy(&packet.x, &time, sizeof(time));
+
+    // Swap bytes in y, and copy into the payload struct
+    uint32_t ytmp;
+    std::memcpy(&ytmp, &value, sizeof(ytmp));
+    ytmp = htonl(ytmp);
+    std::memcpy(&packet.y, &ytmp, sizeof(ytmp));
+
+    return packet;
+}
+
+ClientNativeDataPacket MakeClientNativeDataPacket(uint8_t id, uint64_t time,
+                                                  float value) {
+    ClientNativeDataPacket packet{};
+    packet.ID = kClientDataPacket | id;
+    packet.y = value;
+    packet.x = time;
+    return packet;
+}
+
+bool IsLittleEndian() {
+    uint16_t value = 1;
+    uint8_t firstByte;
+    std::memcpy(&firstByte, &value, sizeof(firstByte));
+    return firstByte == 1;
+}
+
+std::string MakeClientExtendedPacket(uint8_t id, std::string_view payload) {
+    std::string packet;
+    packet.reserve(1 + sizeof(uint32_t) + payload.size());
+    packet += static_cast<char>(id);
+    AppendNetworkOrder(packet, static_cast<uint32_t>(payload.size()));
+    packet += payload;
+    return packet;
+}
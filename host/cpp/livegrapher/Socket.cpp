@@ -14,6 +14,7 @@
 
 #else
 #include <fcntl.h>
+#include <sys/select.h>
 #include <unistd.h>
 #endif
 
@@ -48,7 +49,19 @@ bool Socket::Read(char* buf, size_t length) {
     size_t pos = 0;
     while (pos < length) {
         int count = recv(m_fd, buf + pos, length - pos, 0);
-        if (count == 0 || (count == -1 && errno != EAGAIN)) {
+        if (count == -1 && (errno == EAGAIN || errno == EWOULDBLOCK ||
+                            errno == EINTR)) {
+            // A nonblocking socket has no data yet, so wait until it does
+            fd_set readFds;
+            FD_ZERO(&readFds);
+            FD_SET(m_fd, &readFds);
+            if (select(m_fd + 1, &readFds, nullptr, nullptr, nullptr) == -1 &&
+                errno != EINTR) {
+                return false;
+            }
+            continue;
+        }
+        if (count <= 0) {
             return false;
         }
         pos += count;
@@ -57,6 +70,10 @@ bool Socket::Read(char* buf, size_t length) {
     return true;
 }
 
+int Socket::ReadAvailable(char* buf, size_t length) {
+    return recv(m_fd, buf, length, 0);
+}
+
 size_t Socket::Write(std::string_view data) {
     return send(m_fd, data.data(), data.length(), 0);
 }
@@ -94,6 +111,22 @@ void Socket::SetBlocking(bool blocking) {
 #endif
 }
 
+int Socket::LastError() {
+#ifdef _WIN32
+    return WSAGetLastError();
+#else
+    return errno;
+#endif
+}
+
+void Socket::ClearLastError() {
+#ifdef _WIN32
+    WSASetLastError(0);
+#else
+    errno = 0;
+#endif
+}
+
 #ifdef _WIN32
 struct SocketInitializer {
     SocketInitializer() {
@@ -45,26 +45,17 @@ void SocketSelector::Remove(const Pipe& pipe, int selectFlags) {
     }
 }
 
-bool SocketSelector::Select() {
-    m_selectReadFds = m_readFds;
-    m_selectWriteFds = m_writeFds;
-    m_selectErrorFds = m_errorFds;
+bool SocketSelector::Select() { return SelectImpl(nullptr); }
 
-    int ret = select(m_maxFd + 1, &m_selectReadFds, &m_selectWriteFds,
-                     &m_selectErrorFds, nullptr);
-
-    // If the select() was cancelled via IPC, clear the IPC channel
-    if (IsReadReady(m_pipe)) {
-        char ipc;
-        m_pipe.Read(&ipc, 1);
+bool SocketSelector::Select(std::chrono::microseconds timeout) {
+    if (timeout.count() < 0) {
+        timeout = std::chrono::microseconds{0};
     }
 
-    if (ret == -1) {
-        throw std::system_error(errno, std::system_category(),
-                                "SocketSelector");
-    }
-
-    return ret > 0;
+    timeval tv;
+    tv.tv_sec = timeout.count() / 1000000;
+    tv.tv_usec = timeout.count() % 1000000;
+    return SelectImpl(&tv);
 }
 
 bool SocketSelector::IsReadReady(const Socket& socket) {
@@ -89,6 +80,28 @@ bool SocketSelector::IsWriteReady(const Pipe& pipe) {
 
 void SocketSelector::Cancel() { m_pipe.Write("x"); }
 
+bool SocketSelector::SelectImpl(timeval* timeout) {
+    m_selectReadFds = m_readFds;
+    m_selectWriteFds = m_writeFds;
+    m_selectErrorFds = m_errorFds;
+
+    int ret = select(m_maxFd + 1, &m_selectReadFds, &m_selectWriteFds,
+                     &m_selectErrorFds, timeout);
+
+    // If the select() was cancelled via IPC, clear the IPC channel
+    if (IsReadReady(m_pipe)) {
+        char ipc;
+        m_pipe.Read(&ipc, 1);
+    }
+
+    if (ret == -1) {
+        throw std::system_error(errno, std::system_category(),
+                                "SocketSelector");
+    }
+
+    return ret > 0;
+}
+
 #ifdef _WIN32
 void SocketSelector::Add(SOCKET fd, int selectFlags) {
 #else
@@ -100,9 +113,11 @@ void SocketSelector::Add(int fd, int selectFlags) {
 
     if (selectFlags & kRead) {
         FD_SET(fd, &m_readFds);
-    } else if (selectFlags & kWrite) {
+    }
+    if (selectFlags & kWrite) {
         FD_SET(fd, &m_writeFds);
-    } else if (selectFlags & kError) {
+    }
+    if (selectFlags & kError) {
         FD_SET(fd, &m_errorFds);
     }
 }
@@ -114,9 +129,11 @@ void SocketSelector::Remove(int fd, int selectFlags) {
 #endif
     if (selectFlags & kRead) {
         FD_CLR(fd, &m_readFds);
-    } else if (selectFlags & kWrite) {
+    }
+    if (selectFlags & kWrite) {
         FD_CLR(fd, &m_writeFds);
-    } else if (selectFlags & kError) {
+    }
+    if (selectFlags & kError) {
         FD_CLR(fd, &m_errorFds);
     }
 }
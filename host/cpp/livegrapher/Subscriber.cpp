@@ -0,0 +1,98 @@
+// Copyright (c) 2020 FRC Team 3512. All Rights Reserved.
+
+#include "livegrapher/Subscriber.hpp"
+
+#include <algorithm>
+
+Subscriber::Subscriber(size_t capacity) : m_capacity{capacity} {
+    m_filling.reserve(capacity);
+    m_taken.reserve(capacity);
+}
+
+void Subscriber::SelectGraph(uint8_t id) {
+    m_selection.fetch_or(uint64_t{1} << id, std::memory_order_relaxed);
+}
+
+void Subscriber::UnselectGraph(uint8_t id) {
+    m_selection.fetch_and(~(uint64_t{1} << id), std::memory_order_relaxed);
+}
+
+bool Subscriber::IsGraphSelected(uint8_t id) const {
+    return m_allSelected.load(std::memory_order_relaxed) ||
+           (Selection() >> id) & 1;
+}
+
+uint64_t Subscriber::Selection() const {
+    return m_selection.load(std::memory_order_relaxed);
+}
+
+void Subscriber::SetSelection(uint64_t selection) {
+    m_selection.store(selection, std::memory_order_relaxed);
+}
+
+void Subscriber::SelectAll(bool enabled) {
+    m_allSelected.store(enabled, std::memory_order_relaxed);
+}
+
+SampleBlock Subscriber::Poll() {
+    std::scoped_lock lock(m_mutex);
+    return Take();
+}
+
+SampleBlock Subscriber::Wait(std::chrono::milliseconds timeout,
+                             size_t count) {
+    std::unique_lock lock(m_mutex);
+    m_wakeSize = std::max<size_t>(std::min(count, m_capacity), 1);
+    m_ready.wait_for(lock, timeout, [&] {
+        return m_filling.size() >= m_wakeSize || m_closed;
+    });
+    return Take();
+}
+
+uint64_t Subscriber::SamplesDropped() const {
+    std::scoped_lock lock(m_mutex);
+    return m_samplesDropped;
+}
+
+bool Subscriber::IsClosed() const {
+    std::scoped_lock lock(m_mutex);
+    return m_closed;
+}
+
+void Subscriber::Push(uint8_t id, std::chrono::milliseconds time,
+                      float value) {
+    bool wake;
+    {
+        std::scoped_lock lock(m_mutex);
+        if (m_closed) {
+            return;
+        }
+        if (m_filling.size() == m_capacity) {
+            ++m_samplesDropped;
+            return;
+        }
+
+        m_filling.push_back({time, value, id});
+        wake = m_filling.size() == m_wakeSize;
+    }
+
+    // The consumer only has to be woken up once the block reaches the size
+    // it's waiting for
+    if (wake) {
+        m_ready.notify_one();
+    }
+}
+
+void Subscriber::Close() {
+    {
+        std::scoped_lock lock(m_mutex);
+        m_closed = true;
+    }
+    m_ready.notify_one();
+}
+
+SampleBlock Subscriber::Take() {
+    m_taken.clear();
+    m_taken.swap(m_filling);
+    return {m_taken.data(), m_taken.size()};
+}
@@ -31,7 +31,6 @@ TcpListener::TcpListener(uint16_t port) {
 #endif
         throw std::system_error(errno, std::system_category(), "TcpListener");
     }
-    DisableNagle();
 
     // Allow rebinding to the socket later if the connection is interrupted
     int reuse = 1;
@@ -62,6 +61,10 @@ TcpListener::TcpListener(uint16_t port) {
         throw std::system_error(errno, std::system_category(), "listen");
     }
 
+    // A client that disconnects before it's accepted leaves nothing to
+    // accept, so accepting mustn't block
+    SetBlocking(false);
+
 #ifndef _WIN32
     // Make sure we aren't killed by SIGPIPE
     signal(SIGPIPE, SIG_IGN);
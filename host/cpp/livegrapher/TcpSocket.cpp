@@ -9,15 +9,19 @@
 #endif
 
 #include <winsock2.h>
+#include <ws2tcpip.h>
 
 #else
+#include <arpa/inet.h>
 #include <netinet/in.h>
 #include <netinet/tcp.h>
 #include <sys/socket.h>
 #include <sys/types.h>
 #endif
 
+#include <algorithm>
 #include <cstdio>
+#include <cstring>
 #include <system_error>
 
 TcpSocket::TcpSocket() {
@@ -44,3 +48,47 @@ void TcpSocket::DisableNagle() {
     setsockopt(m_fd, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<char*>(&yes),
                sizeof(yes));
 }
+
+void TcpSocket::SetDeadPeerTimeout(std::chrono::milliseconds timeout) {
+    using std::chrono::duration_cast;
+    using std::chrono::seconds;
+
+    auto setOption = [&](int level, int option, int value) {
+        setsockopt(m_fd, level, option, reinterpret_cast<char*>(&value),
+                   sizeof(value));
+    };
+
+    setOption(SOL_SOCKET, SO_KEEPALIVE, 1);
+
+    // Probe after half the timeout, then every second until it runs out
+    int idle = std::max<int>(1, duration_cast<seconds>(timeout).count() / 2);
+    constexpr int kProbeInterval = 1;
+#ifdef TCP_KEEPIDLE
+    setOption(IPPROTO_TCP, TCP_KEEPIDLE, idle);
+#endif
+#ifdef TCP_KEEPINTVL
+    setOption(IPPROTO_TCP, TCP_KEEPINTVL, kProbeInterval);
+#endif
+#ifdef TCP_KEEPCNT
+    setOption(IPPROTO_TCP, TCP_KEEPCNT, std::max(1, idle / kProbeInterval));
+#endif
+
+    // Keepalives only cover idle connections. When data is in flight, the
+    // peer has to acknowledge it in time.
+#ifdef TCP_USER_TIMEOUT
+    setOption(IPPROTO_TCP, TCP_USER_TIMEOUT, timeout.count());
+#endif
+}
+
+bool TcpSocket::Connect(const std::string& address, uint16_t port) {
+    sockaddr_in addr;
+    std::memset(&addr, 0, sizeof(sockaddr_in));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, address.c_str(), &addr.sin_addr) != 1) {
+        return false;
+    }
+
+    return connect(m_fd, reinterpret_cast<sockaddr*>(&addr),
+                   sizeof(sockaddr_in)) == 0;
+}
@@ -0,0 +1,124 @@
+// Copyright (c) 2020 FRC Team 3512. All Rights Reserved.
+
+#include "livegrapher/ThreadScheduling.hpp"
+
+#ifdef _WIN32
+#define _WIN32_LEAN_AND_MEAN
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+
+#include <winsock2.h>
+#include <windows.h>
+
+#else
+#include <pthread.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+#endif
+
+#include <cerrno>
+#include <system_error>
+
+#ifdef _WIN32
+void SetThreadScheduling(const ThreadScheduling& scheduling) {
+    HANDLE thread = GetCurrentThread();
+
+    if (scheduling.affinity != 0 &&
+        SetThreadAffinityMask(thread, scheduling.affinity) == 0) {
+        throw std::system_error(GetLastError(), std::system_category(),
+                                "SetThreadScheduling");
+    }
+
+    // Windows has a handful of priority levels instead of nice levels and
+    // real-time priorities
+    int priority = THREAD_PRIORITY_NORMAL;
+    switch (scheduling.policy) {
+        case SchedulingPolicy::kInherit:
+            return;
+        case SchedulingPolicy::kOther:
+            if (scheduling.nice < 0) {
+                priority = THREAD_PRIORITY_ABOVE_NORMAL;
+            } else if (scheduling.nice > 0) {
+                priority = THREAD_PRIORITY_BELOW_NORMAL;
+            } else {
+                priority = THREAD_PRIORITY_NORMAL;
+            }
+            break;
+        case SchedulingPolicy::kFifo:
+            priority = THREAD_PRIORITY_TIME_CRITICAL;
+            break;
+    }
+
+    if (!SetThreadPriority(thread, priority)) {
+        throw std::system_error(GetLastError(), std::system_category(),
+                                "SetThreadScheduling");
+    }
+}
+#else
+void SetThreadScheduling(const ThreadScheduling& scheduling) {
+    pthread_t thread = pthread_self();
+
+    if (scheduling.affinity != 0) {
+#ifdef __linux__
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        for (int cpu = 0; cpu < 64; ++cpu) {
+            if (scheduling.affinity & (uint64_t{1} << cpu)) {
+                CPU_SET(cpu, &cpus);
+            }
+        }
+
+        int error = pthread_setaffinity_np(thread, sizeof(cpus), &cpus);
+        if (error != 0) {
+            throw std::system_error(error, std::system_category(),
+                                    "SetThreadScheduling");
+        }
+#else
+        throw std::system_error(std::make_error_code(std::errc::not_supported),
+                                "SetThreadScheduling");
+#endif
+    }
+
+    if (scheduling.policy == SchedulingPolicy::kInherit) {
+        return;
+    }
+
+    // A thread created by a real-time thread inherits its policy, so the
+    // time-shared policy is set explicitly too
+    sched_param param{};
+    int policy = SCHED_OTHER;
+    if (scheduling.policy == SchedulingPolicy::kFifo) {
+        policy = SCHED_FIFO;
+        param.sched_priority = scheduling.priority;
+    }
+    int error = pthread_setschedparam(thread, policy, &param);
+    if (error != 0) {
+        throw std::system_error(error, std::system_category(),
+                                "SetThreadScheduling");
+    }
+
+    if (scheduling.policy == SchedulingPolicy::kOther) {
+#ifdef __linux__
+        // Linux applies nice levels to the thread with the given ID rather
+        // than to the whole process
+        if (setpriority(PRIO_PROCESS, syscall(SYS_gettid), scheduling.nice) ==
+            -1) {
+            throw std::system_error(errno, std::system_category(),
+                                    "SetThreadScheduling");
+        }
+#else
+        if (scheduling.nice != 0) {
+            throw std::system_error(
+                std::make_error_code(std::errc::not_supported),
+                "SetThreadScheduling");
+        }
+#endif
+    }
+}
+#endif
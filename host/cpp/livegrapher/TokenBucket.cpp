@@ -0,0 +1,37 @@
+// Copyright (c) 2020 FRC Team 3512. All Rights Reserved.
+
+#include "livegrapher/TokenBucket.hpp"
+
+#include <algorithm>
+
+TokenBucket::TokenBucket(uint64_t rate, double capacity)
+    : m_rate{rate},
+      m_capacity{capacity},
+      m_level{capacity},
+      m_lastRefill{std::chrono::steady_clock::now()} {}
+
+void TokenBucket::Refill(std::chrono::steady_clock::time_point now) {
+    if (!IsLimited() || now <= m_lastRefill) {
+        return;
+    }
+
+    double elapsed = std::chrono::duration<double>(now - m_lastRefill).count();
+    m_level = std::min(m_level + elapsed * m_rate, m_capacity);
+    m_lastRefill = now;
+}
+
+void TokenBucket::Consume(double tokens) {
+    // Debt is capped at one bucket's worth so a burst doesn't starve later
+    // users of the bucket for long
+    if (IsLimited()) {
+        m_level = std::max(m_level - tokens, -m_capacity);
+    }
+}
+
+bool TokenBucket::IsLimited() const { return m_rate > 0; }
+
+uint64_t TokenBucket::Rate() const { return m_rate; }
+
+double TokenBucket::Level() const { return m_level; }
+
+double TokenBucket::Capacity() const { return m_capacity; }
@@ -0,0 +1,119 @@
+// Copyright (c) 2020 FRC Team 3512. All Rights Reserved.
+
+#include "livegrapher/TriggerCapture.hpp"
+
+#include <algorithm>
+
+TriggerCapture::TriggerCapture(size_t capacity)
+    : m_ring(std::max<size_t>(capacity, 1)) {}
+
+void TriggerCapture::AddTrigger(uint8_t id, TriggerCondition condition,
+                                float threshold,
+                                std::chrono::microseconds preTrigger,
+                                std::chrono::microseconds postTrigger) {
+    auto& trigger = m_triggers.emplace_back();
+    trigger.id = id;
+    trigger.condition = condition;
+    trigger.threshold = threshold;
+    trigger.preTrigger = preTrigger;
+    trigger.postTrigger = postTrigger;
+}
+
+void TriggerCapture::RemoveTriggers(uint8_t id) {
+    m_triggers.erase(
+        std::remove_if(m_triggers.begin(), m_triggers.end(),
+                       [&](const auto& trigger) { return trigger.id == id; }),
+        m_triggers.end());
+}
+
+void TriggerCapture::Record(const CapturedSample& sample,
+                            std::vector<Capture>& completed) {
+    // A capture is complete once a sample arrives after its post-trigger
+    // window, or if this sample would overwrite its first one
+    for (auto& trigger : m_triggers) {
+        if (trigger.fired &&
+            (sample.time > trigger.fireTime + trigger.postTrigger.count() ||
+             m_nextSequence - trigger.startSequence == m_ring.size())) {
+            completed.emplace_back(Complete(trigger, m_nextSequence));
+        }
+    }
+
+    m_ring[m_nextSequence % m_ring.size()] = sample;
+    ++m_nextSequence;
+
+    for (auto& trigger : m_triggers) {
+        if (trigger.id != sample.id) {
+            continue;
+        }
+
+        bool holds = Evaluate(trigger, sample.value);
+        trigger.previous = sample.value;
+        if (!holds) {
+            trigger.armed = !trigger.fired;
+            continue;
+        }
+        if (!trigger.armed) {
+            continue;
+        }
+
+        trigger.armed = false;
+        trigger.fired = true;
+        trigger.fireTime = sample.time;
+
+        // The capture starts at the oldest retained sample within the
+        // pre-trigger window
+        uint64_t oldest =
+            m_nextSequence - std::min<uint64_t>(m_nextSequence, m_ring.size());
+        int64_t startTime = sample.time - trigger.preTrigger.count();
+        uint64_t start = m_nextSequence - 1;
+        while (start > oldest &&
+               m_ring[(start - 1) % m_ring.size()].time >= startTime) {
+            --start;
+        }
+        trigger.startSequence = start;
+    }
+}
+
+bool TriggerCapture::Evaluate(const Trigger& trigger, float value) {
+    bool above = value > trigger.threshold;
+    bool below = value < trigger.threshold;
+
+    // Edges need a previous value on the other side of the threshold
+    bool rising = trigger.previous && *trigger.previous < trigger.threshold &&
+                  !below;
+    bool falling = trigger.previous &&
+                   *trigger.previous > trigger.threshold && !above;
+
+    switch (trigger.condition) {
+        case TriggerCondition::kRising:
+            return rising;
+        case TriggerCondition::kFalling:
+            return falling;
+        case TriggerCondition::kCrossing:
+            return rising || falling;
+        case TriggerCondition::kAbove:
+            return above;
+        case TriggerCondition::kBelow:
+            return below;
+    }
+
+    return false;
+}
+
+Capture TriggerCapture::Complete(Trigger& trigger, uint64_t end) {
+    Capture capture{trigger.id, trigger.fireTime, {}};
+
+    int64_t endTime = trigger.fireTime + trigger.postTrigger.count();
+    uint64_t begin = std::max<uint64_t>(
+        trigger.startSequence, end - std::min<uint64_t>(end, m_ring.size()));
+    for (uint64_t sequence = begin; sequence < end; ++sequence) {
+        const auto& sample = m_ring[sequence % m_ring.size()];
+        if (sample.time <= endTime) {
+            capture.samples.push_back(sample);
+        }
+    }
+
+    trigger.fired = false;
+
+    return capture;
+}
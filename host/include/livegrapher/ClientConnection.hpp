@@ -2,17 +2,60 @@
 
 #pragma once
 
+#include <stddef.h>
 #include <stdint.h>
 
+#include <array>
+#include <chrono>
+#include <deque>
+#include <limits>
+#include <string>
+#include <string_view>
+#include <utility>
 #include <vector>
 
+#include "livegrapher/LatencyHistogram.hpp"
 #include "livegrapher/TcpSocket.hpp"
+#include "livegrapher/TokenBucket.hpp"
 
 /**
  * Wrapper around graph client socket.
  */
 class ClientConnection {
 public:
+    // Number of dataset priority classes
+    static constexpr size_t kNumPriorities = 3;
+
+    /**
+     * A range request being answered from the host's retained samples a chunk
+     * at a time.
+     */
+    struct RangeTransfer {
+        // Graph ID of the dataset and the ID's generation when the request
+        // was received
+        uint8_t id;
+        uint16_t generation;
+
+        // First and last millisecond of the range clamped to the retained
+        // history. If first is after last, the request can't be answered.
+        int64_t first;
+        int64_t last;
+
+        // Next sequence number to scan and one past the last one
+        uint64_t cursor;
+        uint64_t end;
+
+        // Microsecond times and values of the samples found in the range so
+        // far
+        std::vector<std::pair<int64_t, float>> samples;
+
+        // True once the samples are sorted by time
+        bool sorted = false;
+
+        // Number of samples already serialized into packets
+        size_t sent = 0;
+    };
+
     TcpSocket socket;
 
     /**
@@ -46,32 +89,373 @@ public:
      */
     bool IsGraphSelected(uint8_t id);
 
+    /**
+     * Returns a bitfield of the selected graphs. Bit n is set if graph ID n is
+     * selected.
+     */
+    uint64_t Selection() const;
+
+    /**
+     * Replace the selected graphs.
+     *
+     * @param selection A bitfield of the graphs to select.
+     */
+    void SetSelection(uint64_t selection);
+
+    /**
+     * Request notifications of datasets registered after this call.
+     */
+    void SubscribeCatalog();
+
+    /**
+     * Returns true if the client requested notifications of new datasets.
+     */
+    bool IsCatalogSubscribed() const;
+
+    /**
+     * Record that the client sent a hello packet, so it understands extended
+     * client packets it didn't ask for.
+     */
+    void AcceptExtendedPackets();
+
+    /**
+     * Returns true if the client sent a hello packet.
+     */
+    bool AcceptsExtendedPackets() const;
+
+    /**
+     * Set whether data packets are sent as ClientNativeDataPackets.
+     *
+     * @param enabled True to send native data packets.
+     */
+    void SetNativeSamples(bool enabled);
+
+    /**
+     * Returns true if data packets are sent as ClientNativeDataPackets.
+     */
+    bool NativeSamples() const;
+
+    /**
+     * Set the token of the resumable session this connection belongs to.
+     *
+     * @param token The session token, or zero for none.
+     */
+    void SetSessionToken(uint64_t token);
+
+    /**
+     * Returns the token of the resumable session this connection belongs to,
+     * or zero if it doesn't belong to one.
+     */
+    uint64_t SessionToken() const;
+
+    /**
+     * Record the sequence number in the last sequence marker queued.
+     *
+     * @param sequence The sequence number.
+     */
+    void SetMarkedSequence(uint64_t sequence);
+
+    /**
+     * Returns the sequence number in the last sequence marker queued.
+     */
+    uint64_t MarkedSequence() const;
+
+    /**
+     * Set the retained samples left to replay after the session was resumed.
+     *
+     * @param cursor The sequence number of the next sample to replay.
+     * @param end    One past the sequence number of the last sample to
+     *               replay.
+     */
+    void SetReplay(uint64_t cursor, uint64_t end);
+
+    /**
+     * Returns the sequence number of the next sample to replay.
+     */
+    uint64_t ReplayCursor() const;
+
+    /**
+     * Returns one past the sequence number of the last sample to replay.
+     */
+    uint64_t ReplayEnd() const;
+
+    /**
+     * Returns true if retained samples are left to replay.
+     */
+    bool IsReplaying() const;
+
+    /**
+     * Returns the range requests not completely queued yet in the order they
+     * were received. Only the network thread accesses them.
+     */
+    std::deque<RangeTransfer>& RangeTransfers();
+
+    /**
+     * Ask the network thread to close this connection.
+     */
+    void RequestClose();
+
+    /**
+     * Returns true if the connection should be closed.
+     */
+    bool IsCloseRequested() const;
+
+    /**
+     * Set when queued data is sent.
+     *
+     * Queued data is held until the queue reaches the given size or the oldest
+     * data in it has waited for the given delay, so samples are coalesced into
+     * fewer, larger TCP segments at the cost of latency.
+     *
+     * @param bytes The queue size at which data is sent, or zero to only send
+     *              at the deadline.
+     * @param delay The maximum time data waits in the queue.
+     */
+    void SetFlushPolicy(size_t bytes, std::chrono::microseconds delay);
+
+    /**
+     * Set the flush policy requested by the client, which takes precedence
+     * over the host's default from then on.
+     *
+     * @param bytes The queue size at which data is sent, or zero to only send
+     *              at the deadline.
+     * @param delay The maximum time data waits in the queue.
+     */
+    void RequestFlushPolicy(size_t bytes, std::chrono::microseconds delay);
+
+    /**
+     * Returns true if the client requested its own flush policy.
+     */
+    bool IsFlushPolicyRequested() const;
+
     /**
      * Add data to write queue.
      *
      * @param data The data to enqueue.
+     * @return True if the data started a flush deadline or made the queue
+     *         reach the flush size, so the network thread has to be woken up
+     *         to send it.
      */
-    void AddData(std::string_view data);
+    bool AddData(std::string_view data);
 
     /**
-     * Returns true if there's data in the write queue.
+     * Add a data packet to the write queue.
+     *
+     * The time between enqueueTime and when the last byte of the packet is
+     * passed to send() is recorded in the latency histograms.
+     *
+     * @param data        The data packet to enqueue.
+     * @param id          The graph ID of the sample.
+     * @param enqueueTime The time at which the sample was added to the host.
+     * @return True if the network thread has to be woken up to send the
+     *         packet. See AddData().
+     */
+    bool AddSample(std::string_view data, uint8_t id,
+                   std::chrono::steady_clock::time_point enqueueTime);
+
+    /**
+     * Add a packet to the bulk queue.
+     *
+     * Bulk packets are a lower-priority lane for large transfers. Each one is
+     * moved to the write queue whole once the write queue is empty, so live
+     * data waits behind at most one bulk packet.
+     *
+     * @param packet The packet to enqueue.
+     */
+    void AddBulkData(std::string packet);
+
+    /**
+     * Returns the token bucket limiting the rate at which data packets are
+     * queued for this client.
+     */
+    TokenBucket& Budget();
+
+    /**
+     * Count a data packet as queued or shed for the bandwidth budget.
+     *
+     * @param priority The priority class of the packet's dataset.
+     * @param queued   True if the packet was queued or false if it was shed.
+     */
+    void CountSample(uint8_t priority, bool queued);
+
+    /**
+     * Returns the number of data packets of a priority class queued so far.
+     *
+     * @param priority The priority class.
+     */
+    uint64_t SamplesAdmitted(uint8_t priority) const;
+
+    /**
+     * Returns the number of data packets of a priority class shed so far
+     * because they didn't fit in the bandwidth budget.
+     *
+     * @param priority The priority class.
+     */
+    uint64_t SamplesShed(uint8_t priority) const;
+
+    /**
+     * Returns true if there's data in the write queue or bulk queue.
      */
     bool HasDataToWrite() const;
 
+    /**
+     * Returns true if the write queue should be sent according to the flush
+     * policy.
+     *
+     * @param now The current time.
+     */
+    bool IsFlushDue(std::chrono::steady_clock::time_point now) const;
+
+    /**
+     * Returns the time at which the data in the write queue has to be sent.
+     */
+    std::chrono::steady_clock::time_point FlushDeadline() const;
+
+    /**
+     * Set whether the network code waits for the socket to become writable.
+     *
+     * @param interest True if it should wait.
+     */
+    void SetWriteInterest(bool interest);
+
+    /**
+     * Returns true if the network code waits for the socket to become
+     * writable.
+     */
+    bool HasWriteInterest() const;
+
+    /**
+     * Receive the bytes available on the socket without waiting for more and
+     * append them to the receive buffer.
+     *
+     * At most kReceiveChunkSize bytes are received per call.
+     *
+     * @return False if the connection was closed or the read failed.
+     */
+    bool ReceiveFromSocket();
+
+    /**
+     * Returns the received bytes that haven't been consumed yet, which start
+     * at a packet boundary.
+     */
+    std::string_view ReceivedData() const;
+
+    /**
+     * Remove parsed packets from the front of the receive buffer.
+     *
+     * @param count The number of bytes to remove.
+     */
+    void ConsumeReceived(size_t count);
+
     /**
      * Attempt to send queued data on socket.
      *
+     * @param datasetLatency An array of histograms indexed by graph ID in which
+     *                       to also record the latency of each sample sent, or
+     *                       nullptr.
+     * @param maxBytes       The maximum number of bytes to send.
      * @return True if write succeeded. This doesn't necessarily mean all data
      *         was sent.
      */
-    bool WriteToSocket();
+    bool WriteToSocket(
+        LatencyHistogram* datasetLatency = nullptr,
+        size_t maxBytes = std::numeric_limits<size_t>::max());
+
+    /**
+     * Returns the last time the write queue went from empty to nonempty or
+     * bytes from it were sent.
+     *
+     * If the write queue has data, the client hasn't been accepting it since
+     * then.
+     */
+    std::chrono::steady_clock::time_point LastProgress() const;
+
+    /**
+     * Returns the number of bytes sent on the socket so far.
+     */
+    uint64_t BytesSent() const;
+
+    /**
+     * Returns the number of bytes waiting in the write queue.
+     */
+    size_t BytesQueued() const;
+
+    /**
+     * Returns the number of bytes waiting in the bulk queue.
+     */
+    size_t BulkBytesQueued() const;
+
+    /**
+     * Returns the number of data packets waiting in the write queue.
+     */
+    size_t SamplesQueued() const;
+
+    /**
+     * Returns the histogram of latencies from AddSample() to send().
+     */
+    const LatencyHistogram& Latency() const;
 
 private:
+    struct QueuedSample {
+        // Stream offset one past the sample's last byte
+        uint64_t end;
+
+        std::chrono::steady_clock::time_point enqueueTime;
+        uint8_t id;
+    };
+
+    // Write queue capacity above which memory is released once the queue
+    // drains
+    static constexpr size_t kMaxIdleQueueCapacity = 64 * 1024;
+
+    // Maximum number of bytes received per ReceiveFromSocket() call
+    static constexpr size_t kReceiveChunkSize = 4096;
+
+    // Bytes received from the client that don't form a complete packet yet
+    // or haven't been parsed yet
+    std::string m_receiveBuffer;
+
     std::vector<char> m_writeQueue;
+    uint64_t m_bytesSent = 0;
+    std::chrono::steady_clock::time_point m_lastProgress;
+
+    size_t m_flushBytes = 0;
+    std::chrono::microseconds m_flushDelay{0};
+    std::chrono::steady_clock::time_point m_flushDeadline;
+    bool m_flushPolicyRequested = false;
+
+    // Total number of bytes ever added to the write queue. Together with
+    // m_bytesSent, this maps queued samples to stream offsets.
+    uint64_t m_bytesAdded = 0;
+
+    std::deque<QueuedSample> m_queuedSamples;
+
+    // Bulk packets waiting for the write queue to empty
+    std::deque<std::string> m_bulkQueue;
+    size_t m_bulkBytes = 0;
+    LatencyHistogram m_latency;
 
     // A bitfield representing the selection state of each graph ID. The LSB is
     // the selection state of graph ID 0 and the MSB is the selection state of
     // graph ID 63. Graph IDs are 6 bits wide, so there are 2^6 = 64 possible
     // graph IDs.
     uint64_t m_datasets = 0;
+
+    TokenBucket m_budget;
+    std::array<uint64_t, kNumPriorities> m_samplesAdmitted{};
+    std::array<uint64_t, kNumPriorities> m_samplesShed{};
+
+    uint64_t m_sessionToken = 0;
+    uint64_t m_markedSequence = 0;
+
+    uint64_t m_replayCursor = 0;
+    uint64_t m_replayEnd = 0;
+
+    std::deque<RangeTransfer> m_rangeTransfers;
+
+    bool m_catalogSubscribed = false;
+    bool m_acceptsExtendedPackets = false;
+    bool m_nativeSamples = false;
+    bool m_closeRequested = false;
+    bool m_writeInterest = false;
 };
@@ -0,0 +1,141 @@
+// Copyright (c) 2020 FRC Team 3512. All Rights Reserved.
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+
+/**
+ * Map from dataset names to graph IDs with lock-free lookups.
+ *
+ * Entries are immutable once published. Lookups don't lock and are wait-free:
+ * a lookup probes at most kNumSlots slots of a fixed-size open-addressed hash
+ * table. Registration and unregistration take a mutex and publish changes with
+ * release stores, so a reader that sees an entry also sees its contents.
+ *
+ * An unregistered dataset's entry is replaced with a tombstone and freed once
+ * every lookup that could have seen it has finished. Its graph ID isn't reused
+ * until a grace period has passed, which gives clients time to drop the old
+ * mapping and lets samples already in flight drain.
+ */
+class DatasetRegistry {
+public:
+    // Graph IDs are 6 bits wide, so at most 64 datasets can exist
+    static constexpr size_t kCapacity = 64;
+
+    /**
+     * Constructs a dataset registry.
+     *
+     * @param gracePeriod The minimum time between a graph ID being
+     *                    unregistered and it being reused.
+     */
+    explicit DatasetRegistry(
+        std::chrono::steady_clock::duration gracePeriod =
+            std::chrono::seconds{10});
+
+    ~DatasetRegistry();
+
+    DatasetRegistry(const DatasetRegistry&) = delete;
+    DatasetRegistry& operator=(const DatasetRegistry&) = delete;
+
+    /**
+     * Returns the graph ID of a dataset, or std::nullopt if it isn't
+     * registered.
+     *
+     * This is safe to call concurrently with every other member function.
+     *
+     * @param name The name of the dataset.
+     */
+    std::optional<uint8_t> Find(std::string_view name) const;
+
+    /**
+     * Returns the graph ID of a dataset, registering it first if needed.
+     *
+     * Graph IDs that were never used are assigned first, then IDs whose grace
+     * period has passed.
+     *
+     * @param name     The name of the dataset.
+     * @param inserted Set to true if the dataset was registered by this call.
+     * @return The graph ID, or std::nullopt if no graph ID is available.
+     */
+    std::optional<uint8_t> Register(std::string_view name, bool& inserted);
+
+    /**
+     * Unregisters a dataset.
+     *
+     * This waits for lookups that could still see the dataset's entry to
+     * finish before freeing it.
+     *
+     * @param name The name of the dataset.
+     * @return The dataset's former graph ID, or std::nullopt if it wasn't
+     *         registered.
+     */
+    std::optional<uint8_t> Unregister(std::string_view name);
+
+    /**
+     * Returns the name of the dataset with the given graph ID, or std::nullopt
+     * if the graph ID isn't in use.
+     *
+     * The returned name is only valid until the dataset is unregistered, so
+     * calls must be serialized with Unregister().
+     *
+     * @param id The graph ID.
+     */
+    std::optional<std::string_view> Name(uint8_t id) const;
+
+private:
+    // Twice the capacity keeps probe sequences short
+    static constexpr size_t kNumSlots = 2 * kCapacity;
+
+    struct Entry {
+        std::string name;
+        size_t hash;
+        uint8_t id;
+    };
+
+    enum class IDState { kUnused, kActive, kReleased };
+
+    std::array<std::atomic<const Entry*>, kNumSlots> m_slots{};
+
+    // The remaining members are guarded by m_mutex
+    std::array<const Entry*, kCapacity> m_entries{};
+    std::array<IDState, kCapacity> m_idStates{};
+    std::array<std::chrono::steady_clock::time_point, kCapacity>
+        m_releaseTimes{};
+    std::chrono::steady_clock::duration m_gracePeriod;
+    std::mutex m_mutex;
+
+    // Lookups in progress, split by the epoch in which they started so
+    // Synchronize() isn't starved by a steady stream of new lookups
+    mutable std::array<std::atomic<uint32_t>, 2> m_readers{};
+    std::atomic<uint32_t> m_epoch{0};
+
+    /**
+     * Returns the entry with the given name and hash, or nullptr if it isn't
+     * registered.
+     *
+     * @param name The name of the dataset.
+     * @param hash The hash of the name.
+     */
+    const Entry* FindEntry(std::string_view name, size_t hash) const;
+
+    /**
+     * Waits until every lookup that started before this call has finished.
+     */
+    void Synchronize();
+
+    /**
+     * Returns the marker left in a slot whose entry was unregistered.
+     *
+     * It's distinct from an empty slot so probe sequences continue past it.
+     */
+    static const Entry* Tombstone();
+};
@@ -0,0 +1,243 @@
+// Copyright (c) 2020 FRC Team 3512. All Rights Reserved.
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <array>
+#include <atomic>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "livegrapher/MappedFile.hpp"
+
+// Flight recorder file format. All fields are in host byte order.
+//
+// The file starts with a FlightRecorderHeader, followed by `capacity`
+// FlightRecords at kFlightRecordOffset. Sample N is stored in record
+// N % capacity. A record's sequence number is N + 1 once it holds sample N, so
+// a reader can tell an overwritten or half-written record from a valid one.
+//
+// Graph IDs are reused after a dataset is unregistered, so dataset names are
+// kept in a ring of kFlightRecorderNames entries instead of by graph ID. Name
+// change N is stored in entry N % kFlightRecorderNames with serial number
+// N + 1, and each record holds the serial number of its dataset's name when it
+// was written. Samples recorded before a graph ID was reused keep their name.
+
+// Number of dataset name changes retained
+constexpr size_t kFlightRecorderNames = 128;
+
+// Mask of the name serial number bits stored in records
+constexpr uint32_t kFlightRecorderNameMask = (uint32_t{1} << 26) - 1;
+
+struct FlightRecorderName {
+    // Serial number of the name change stored in the entry, or zero while the
+    // entry is unused or being written
+    std::atomic<uint32_t> serial;
+
+    uint8_t length;
+    char data[255];
+};
+
+struct FlightRecorderHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t recordSize;
+    uint64_t capacity;
+
+    // Number of samples ever written. The newest sample is writeIndex - 1.
+    std::atomic<uint64_t> writeIndex;
+
+    // Number of name changes ever recorded
+    std::atomic<uint32_t> nameCount;
+
+    // The most recent name changes
+    FlightRecorderName names[kFlightRecorderNames];
+};
+
+struct FlightRecord {
+    std::atomic<uint64_t> seq;
+    std::atomic<uint64_t> time;
+
+    // Bits 0-31 contain the value's IEEE 754 representation, bits 32-37
+    // contain the graph ID, and bits 38-63 contain the low bits of the serial
+    // number of the dataset's name, or zero if it had none.
+    std::atomic<uint64_t> payload;
+};
+
+constexpr char kFlightRecorderMagic[8] = {'L', 'G', 'F', 'L',
+                                          'I', 'G', 'H', 'T'};
+constexpr uint32_t kFlightRecorderVersion = 2;
+constexpr size_t kFlightRecordOffset = 36864;
+
+static_assert(sizeof(FlightRecorderHeader) <= kFlightRecordOffset,
+              "FlightRecorderHeader overlaps records");
+
+/**
+ * A sample read back from a flight recorder file.
+ */
+struct FlightRecorderSample {
+    uint8_t id;
+    uint64_t time;
+    float value;
+
+    // Serial number of the dataset's name when the sample was written. Pass
+    // it to FlightRecorderReader::Name().
+    uint32_t name;
+};
+
+/**
+ * Fixed-size circular sample log backed by a memory-mapped file.
+ *
+ * Samples are stored directly in the mapping, so the kernel's page cache keeps
+ * the most recent `capacity` samples even if the process crashes before they
+ * could be sent to a client. Use FlightRecorderReader to extract them.
+ *
+ * Write() is safe to call from multiple threads.
+ */
+class FlightRecorder {
+public:
+    /**
+     * Constructs a flight recorder.
+     *
+     * If a file already exists at the given path, it's renamed to
+     * `<path>.prev` first so a restart after a crash doesn't overwrite the
+     * samples recorded before it.
+     *
+     * @param path     The path of the recorder file.
+     * @param capacity The maximum number of samples retained.
+     * @throws std::system_error if the existing file couldn't be renamed or
+     *         the new one couldn't be created.
+     */
+    FlightRecorder(const std::string& path, size_t capacity);
+
+    ~FlightRecorder();
+
+    /**
+     * Record the name of a dataset.
+     *
+     * Samples written afterward are labeled with the name, and samples written
+     * before keep the name their graph ID had then.
+     *
+     * @param id   The graph ID of the dataset.
+     * @param name The name of the dataset. Names longer than 255 characters
+     *             are truncated.
+     */
+    void SetName(uint8_t id, std::string_view name);
+
+    /**
+     * Append a sample to the log, overwriting the oldest one if it's full.
+     *
+     * @param id    The graph ID of the dataset.
+     * @param time  The x value.
+     * @param value The y value.
+     */
+    void Write(uint8_t id, uint64_t time, float value);
+
+    /**
+     * Schedules the file to be written back to disk.
+     *
+     * This isn't required for the samples to survive a process crash; it only
+     * shortens the window in which they could be lost to a power failure.
+     */
+    void Flush();
+
+private:
+    MappedFile m_file;
+    FlightRecorderHeader* m_header;
+    FlightRecord* m_records;
+
+    // Serial number of each graph ID's current name, masked like in records
+    std::array<std::atomic<uint32_t>, 64> m_nameSerials{};
+};
+
+/**
+ * Reads samples back from a flight recorder file.
+ *
+ * The file can be read after the process that wrote it crashed or while it's
+ * still being written.
+ */
+class FlightRecorderReader {
+public:
+    /**
+     * Opens a flight recorder file.
+     *
+     * @param path The path of the recorder file.
+     * @throws std::runtime_error if the file isn't a flight recorder file.
+     */
+    explicit FlightRecorderReader(const std::string& path);
+
+    /**
+     * Returns the name a sample's dataset had when the sample was written, or
+     * an empty string if it had none or the name is no longer retained.
+     *
+     * @param serial The serial number in FlightRecorderSample::name.
+     */
+    std::string Name(uint32_t serial) const;
+
+    /**
+     * Returns the distinct dataset names retained in the file in the order
+     * they were recorded.
+     */
+    std::vector<std::string> Names() const;
+
+    /**
+     * Returns the sequence index of the oldest retained sample.
+     */
+    uint64_t Begin() const;
+
+    /**
+     * Returns one past the sequence index of the newest sample.
+     */
+    uint64_t End() const;
+
+    /**
+     * Reads the sample with the given sequence index.
+     *
+     * @param index  The sequence index of the sample in [Begin(), End()).
+     * @param sample The sample read.
+     * @return False if the sample was overwritten or only partially written.
+     */
+    bool Read(uint64_t index, FlightRecorderSample& sample) const;
+
+private:
+    MappedFile m_file;
+    const FlightRecorderHeader* m_header;
+    const FlightRecord* m_records;
+};
+
+/**
+ * Looks up the names of the datasets of samples read from a flight recorder
+ * file.
+ *
+ * The last name of each graph ID is cached, since names rarely change.
+ */
+class FlightRecorderNames {
+public:
+    /**
+     * Constructs a name lookup.
+     *
+     * @param reader The flight recorder file the samples are read from.
+     */
+    explicit FlightRecorderNames(const FlightRecorderReader& reader);
+
+    /**
+     * Returns the name a sample's dataset had when the sample was written, or
+     * "Graph <id>" like the client's default name if it's no longer retained.
+     *
+     * @param sample The sample.
+     */
+    const std::string& Get(const FlightRecorderSample& sample);
+
+private:
+    struct Entry {
+        bool valid = false;
+        uint32_t serial = 0;
+        std::string name;
+    };
+
+    const FlightRecorderReader& m_reader;
+    std::array<Entry, 64> m_entries;
+};
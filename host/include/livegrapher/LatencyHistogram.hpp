@@ -0,0 +1,102 @@
+// Copyright (c) 2020 FRC Team 3512. All Rights Reserved.
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <array>
+
+/**
+ * HDR-style histogram of latencies in microseconds.
+ *
+ * Values below kSubBuckets are recorded exactly. Larger values are grouped
+ * into buckets whose width doubles every kSubBuckets buckets, so every value
+ * is recorded with a relative error of at most 1 / kSubBuckets regardless of
+ * magnitude. Recording is O(1) and the memory use is fixed.
+ *
+ * Bucket i covers [BucketLowerBound(i), BucketLowerBound(i + 1)).
+ */
+class LatencyHistogram {
+public:
+    // Number of buckets per power of two. Must be a power of two.
+    static constexpr uint64_t kSubBucketBits = 3;
+    static constexpr uint64_t kSubBuckets = 1 << kSubBucketBits;
+
+    // Values at or above 2^32 us (about 71 minutes) are clamped
+    static constexpr uint64_t kMaxValue = (uint64_t{1} << 32) - 1;
+
+    static constexpr size_t kNumBuckets =
+        (32 - kSubBucketBits + 1) * kSubBuckets;
+
+    /**
+     * Record a latency.
+     *
+     * @param value The latency in microseconds.
+     */
+    void Record(uint64_t value);
+
+    /**
+     * Add all of another histogram's values to this one.
+     *
+     * @param other The other histogram.
+     */
+    void Merge(const LatencyHistogram& other);
+
+    /**
+     * Remove all recorded values.
+     */
+    void Reset();
+
+    /**
+     * Returns the number of recorded values.
+     */
+    uint64_t Count() const;
+
+    /**
+     * Returns the sum of all recorded values in microseconds.
+     */
+    uint64_t Sum() const;
+
+    /**
+     * Returns the largest recorded value in microseconds.
+     */
+    uint64_t Max() const;
+
+    /**
+     * Returns the value at the given percentile in microseconds.
+     *
+     * The upper bound of the bucket containing the percentile is returned, so
+     * the result never underestimates the latency.
+     *
+     * @param percentile The percentile in [0, 100].
+     */
+    uint64_t Percentile(double percentile) const;
+
+    /**
+     * Returns the number of values recorded in a bucket.
+     *
+     * @param bucket The bucket index.
+     */
+    uint64_t BucketCount(size_t bucket) const;
+
+    /**
+     * Returns the index of the bucket containing the given value.
+     *
+     * @param value The value in microseconds.
+     */
+    static size_t BucketIndex(uint64_t value);
+
+    /**
+     * Returns the smallest value that falls in the given bucket.
+     *
+     * @param bucket The bucket index.
+     */
+    static uint64_t BucketLowerBound(size_t bucket);
+
+private:
+    std::array<uint64_t, kNumBuckets> m_buckets{};
+    uint64_t m_count = 0;
+    uint64_t m_sum = 0;
+    uint64_t m_max = 0;
+};
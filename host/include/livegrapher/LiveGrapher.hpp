@@ -4,26 +4,43 @@
 
 #include <stdint.h>
 
+#include <array>
 #include <atomic>
 #include <chrono>
-#include <map>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <random>
 #include <string>
+#include <string_view>
 #include <thread>
+#include <unordered_map>
 #include <vector>
 
+// The state shared with the user's threads is guarded by priority-inheritance
+// mutexes, so a control loop waiting on the network thread isn't delayed by
+// threads of intermediate priority. wpi::mutex is one on the roboRIO.
 #if defined(__FRC_ROBORIO__)
 #include <wpi/mutex.h>
 #else
-#include <mutex>
+#include "livegrapher/PriorityMutex.hpp"
 
 namespace wpi {
-using mutex = ::std::mutex;
+using mutex = ::PriorityMutex;
 }  // namespace wpi
 #endif
 
 #include "livegrapher/ClientConnection.hpp"
+#include "livegrapher/DatasetRegistry.hpp"
+#include "livegrapher/FlightRecorder.hpp"
+#include "livegrapher/LatencyHistogram.hpp"
+#include "livegrapher/Sink.hpp"
 #include "livegrapher/SocketSelector.hpp"
+#include "livegrapher/Subscriber.hpp"
 #include "livegrapher/TcpListener.hpp"
+#include "livegrapher/ThreadScheduling.hpp"
+#include "livegrapher/TokenBucket.hpp"
+#include "livegrapher/TriggerCapture.hpp"
 
 /**
  * The host for the LiveGrapher real-time graphing application.
@@ -46,12 +63,185 @@ using mutex = ::std::mutex;
  */
 class LiveGrapher {
 public:
+    // Number of clients for which EnableTelemetry() publishes datasets
+    static constexpr size_t kTelemetryClients = 4;
+
+    // Number of datasets EnableTelemetry() registers
+    static constexpr size_t kTelemetryDatasets = 5 + 2 * kTelemetryClients;
+
+    // Minimum time before an unregistered dataset's graph ID is reused
+    static constexpr std::chrono::seconds kUnregisterGracePeriod{10};
+
+    // Length of the burst a bandwidth budget allows
+    static constexpr std::chrono::milliseconds kBandwidthBurst{100};
+
+    // Minimum time between sequence markers sent to a client with a session
+    static constexpr std::chrono::milliseconds kSequenceMarkerPeriod{100};
+
+    // Longest flush delay a client can request
+    static constexpr std::chrono::milliseconds kMaxFlushDelay{100};
+
+    // Time between heartbeats sent to clients that understand them and have
+    // nothing else queued
+    static constexpr std::chrono::seconds kHeartbeatPeriod{1};
+
+    // Default number of samples in a Subscriber's block
+    static constexpr size_t kSubscriberCapacity = 4096;
+
+    // Default time a sink's thread waits for its block to fill up
+    static constexpr std::chrono::milliseconds kSinkPeriod{20};
+
+    // Number of samples after which a range response is split into another
+    // packet, so live data waits behind at most one of them
+    static constexpr size_t kRangePacketSamples = 256;
+
+    // Size of a client's bulk queue above which no more range responses are
+    // added to it until it drains
+    static constexpr size_t kMaxRangeQueued = 1024 * 1024;
+
+    // Number of range requests a client can have waiting. Requests beyond
+    // that are answered as unavailable.
+    static constexpr size_t kMaxRangeRequests = 64;
+
+    // Number of retained samples scanned per network pass for each session
+    // replay or range request, which bounds how long the connection list lock
+    // is held for them
+    static constexpr size_t kRetainedScanSamples = 4096;
+
+    // Size of a client's write queue above which a session replay waits for
+    // it to drain
+    static constexpr size_t kMaxReplayQueued = 64 * 1024;
+
+    /**
+     * Where the host's network work runs.
+     */
+    enum class Threading {
+        // A background thread started by the constructor
+        kThread,
+
+        // Poll(), which the user calls periodically, like at the end of each
+        // robot loop iteration
+        kInline,
+
+        // The user's event loop, which watches the sockets returned by
+        // Interests() and calls OnReadable(), OnWritable(), and OnTimer()
+        kExternal
+    };
+
+    /**
+     * A socket an external event loop watches for the host.
+     */
+    struct SocketInterest {
+        Socket::NativeHandle handle;
+
+        // Call OnReadable() while the socket is readable
+        bool read;
+
+        // Call OnWritable() while the socket is writable
+        bool write;
+    };
+
+    /**
+     * Priority classes for datasets under a bandwidth budget.
+     */
+    enum class Priority : uint8_t {
+        // Never shed
+        kCritical = 0,
+
+        // Decimated when the budget is exhausted
+        kNormal = 1,
+
+        // Paused when the budget is more than half used
+        kLow = 2
+    };
+
+    /**
+     * A sample passed to the bulk AddData() overload.
+     */
+    struct Sample {
+        // The x value
+        std::chrono::milliseconds time;
+
+        // The y value
+        float value;
+    };
+
+    /**
+     * Statistics for one client connection.
+     */
+    struct ClientStats {
+        // Number of bytes sent to the client
+        uint64_t bytesSent;
+
+        // Number of bytes waiting to be sent to the client
+        size_t bytesQueued;
+
+        // Latencies from AddData() to the send() that carried each sample
+        LatencyHistogram latency;
+
+        // Number of samples not sent because they didn't fit in the bandwidth
+        // budget, indexed by priority class
+        std::array<uint64_t, ClientConnection::kNumPriorities> samplesShed;
+
+        // Bitmask of the graph IDs the client selected
+        uint64_t selection;
+    };
+
+    /**
+     * Statistics for the host as a whole.
+     */
+    struct Stats {
+        // Number of samples passed to AddData()
+        uint64_t samplesAdded;
+
+        // Number of samples discarded because their client disconnected
+        // before they could be sent
+        uint64_t samplesDropped;
+
+        // Number of samples not sent because they were within their dataset's
+        // deadband
+        uint64_t samplesSuppressed;
+
+        // Number of samples discarded because all graph IDs were taken when
+        // their dataset was first used
+        uint64_t samplesRejected;
+
+        // Number of clients disconnected because they stopped responding for
+        // the stall timeout
+        uint64_t clientsEvicted;
+
+        // Number of trigger captures completed
+        uint64_t capturesCompleted;
+
+        // One entry per connected client
+        std::vector<ClientStats> clients;
+
+        // Number of samples each sink dropped because it fell behind, in the
+        // order the sinks were added
+        std::vector<uint64_t> sinkSamplesDropped;
+    };
+
     /**
      * Constructs a LiveGrapher host.
      *
-     * @param port The port on which to listen for new clients.
+     * On the dual-core roboRIO, the network thread can take the control loop's
+     * CPU when it wakes up. Pinning it to the other core, raising its nice
+     * level, or giving it a SCHED_FIFO priority below the control loop's keeps
+     * it out of the way.
+     *
+     * @param port       The port on which to listen for new clients.
+     * @param threading  Where the network work runs. With Threading::kInline,
+     *                   no thread is started and Poll() has to be called
+     *                   periodically. With Threading::kExternal, neither a
+     *                   thread nor a wakeup pipe is created, and the user's
+     *                   event loop calls the host.
+     * @param scheduling The network thread's CPU affinity and scheduling
+     *                   policy. Inline hosts ignore it.
+     * @throws std::system_error if the scheduling settings couldn't be applied.
      */
-    explicit LiveGrapher(uint16_t port);
+    explicit LiveGrapher(uint16_t port,
+                         Threading threading = Threading::kThread,
+                         const ThreadScheduling& scheduling = {});
 
     ~LiveGrapher();
 
@@ -60,10 +250,13 @@ public:
      *
      * The current time is sent as the x value.
      *
+     * At most 64 datasets can exist. Samples for datasets beyond that are
+     * discarded and counted in Stats::samplesRejected.
+     *
      * @param dataset The name of the dataset to which the value belongs.
      * @param value   The y value.
      */
-    void AddData(const std::string& dataset, float value);
+    void AddData(std::string_view dataset, float value);
 
     /**
      * Send time (x value) and data (y value) for a given dataset to remote
@@ -73,22 +266,673 @@ public:
      * @param time    The x value.
      * @param value   The y value.
      */
-    void AddData(const std::string& dataset, std::chrono::milliseconds time,
+    void AddData(std::string_view dataset, std::chrono::milliseconds time,
                  float value);
 
+    /**
+     * Send a batch of samples for a given dataset to remote clients.
+     *
+     * This is equivalent to calling AddData() for each sample in order, but
+     * the dataset is looked up and the connection list is locked once for
+     * the whole batch, and the network thread is woken up at most once. Use
+     * it when samples are produced much faster than real time, like from a
+     * simulation, or are already buffered.
+     *
+     * @param dataset The name of the dataset to which the samples belong.
+     * @param samples The samples.
+     * @param count   The number of samples.
+     */
+    void AddData(std::string_view dataset, const Sample* samples,
+                 size_t count);
+
+    /**
+     * Set the clock that timestamps samples passed to AddData() without a
+     * time.
+     *
+     * By default, samples are timestamped with the steady clock. A simulation
+     * running faster or slower than real time can pass its own clock so
+     * clients graph samples against simulated time. Clients are told the
+     * host uses its own clock, so they don't compare sample times with the
+     * host's steady clock to measure latency.
+     *
+     * This must be called before AddData() is called from other threads or
+     * any client connects, and the clock must be safe to call from every
+     * thread that adds samples.
+     *
+     * @param clock Returns the current time, or nullptr for the steady clock.
+     */
+    void SetClock(std::function<std::chrono::milliseconds()> clock);
+
+    /**
+     * Returns the current time of the clock that timestamps samples.
+     */
+    std::chrono::milliseconds Now() const;
+
+    /**
+     * Only send a dataset's samples when its value changes by more than a
+     * deadband (report by exception).
+     *
+     * A sample is sent if its value differs from the last sent value by more
+     * than both the absolute deadband and the relative deadband times the
+     * magnitude of the last sent value, or if the heartbeat interval has
+     * elapsed since the last sent sample. When a change is sent after samples
+     * were suppressed, the last suppressed sample is sent first so clients
+     * draw the held value up to the change instead of a ramp.
+     *
+     * With both deadbands set to zero, only exact repeats are suppressed. Each
+     * dataset with a deadband should only have samples added from one thread
+     * at a time, or its samples may be published out of order.
+     *
+     * @param dataset   The name of the dataset.
+     * @param absolute  The absolute deadband.
+     * @param relative  The deadband as a fraction of the last sent value.
+     * @param heartbeat The maximum time between sent samples, or zero to only
+     *                  send on change.
+     * @throws std::length_error if all graph IDs are in use.
+     */
+    void SetDeadband(
+        std::string_view dataset, float absolute, float relative = 0.f,
+        std::chrono::milliseconds heartbeat = std::chrono::milliseconds{1000});
+
+    /**
+     * Record every sample to a memory-mapped flight recorder file in addition
+     * to sending it to clients.
+     *
+     * The most recent samples survive the robot program crashing. Any file
+     * already at the given path is renamed to `<path>.prev` first, so the
+     * recording from before an automatic restart is kept. Use the
+     * FlightRecorderDump tool to extract the samples.
+     *
+     * This must be called before AddData() is called from other threads.
+     *
+     * @param path     The path of the recorder file.
+     * @param capacity The number of samples to retain (the sample rate of all
+     *                 datasets combined times the number of seconds to keep).
+     */
+    void EnableFlightRecorder(const std::string& path, size_t capacity);
+
+    /**
+     * Publish the host's own health as datasets that clients can graph next to
+     * the robot's data.
+     *
+     * The network thread, or Poll() for inline hosts and the entry points for
+     * external hosts, samples the following at the given period and sends
+     * them as datasets whose names start with "LiveGrapher: ".
+     *
+     * - Samples passed to AddData() per second
+     * - Total samples dropped because their client disconnected
+     * - Network thread wakeups (or Poll() passes or external events) per
+     *   second
+     * - Percentage of time the connection list lock was held
+     * - Percentage of one CPU used by the network thread (or Poll() or the
+     *   entry points)
+     * - Bytes queued for and bytes per second sent to each of the first
+     *   kTelemetryClients clients
+     *
+     * The datasets use kTelemetryDatasets of the 64 available graph IDs. This
+     * must be called at most once, before AddData() is called from other
+     * threads.
+     *
+     * @param period The time between samples.
+     * @throws std::length_error if there aren't enough free graph IDs.
+     */
+    void EnableTelemetry(std::chrono::milliseconds period =
+                             std::chrono::milliseconds{100});
+
+    /**
+     * Let clients resume their session after a reconnect without missing
+     * samples.
+     *
+     * The most recent samples are retained with sequence numbers, and clients
+     * are periodically told the sequence number they've received up to. When a
+     * client reconnects within the session timeout and presents its session
+     * token, its dataset selection is restored and the retained samples it
+     * missed are replayed a chunk at a time alongside new ones.
+     *
+     * Clients can also request a dataset's retained samples over a time range
+     * to replace the decimated points they were sent with every sample. These
+     * are sent when the client has no live data queued, so they don't delay
+     * it. Samples withheld by SetDecimation() are retained too, so the
+     * capacity has to cover the undecimated sample rate.
+     *
+     * This must be called at most once, before AddData() is called from other
+     * threads.
+     *
+     * @param capacity       The number of samples to retain (the sample rate
+     *                       of all datasets combined times the longest outage
+     *                       to bridge).
+     * @param sessionTimeout How long a disconnected client's session can be
+     *                       resumed.
+     */
+    void EnableResume(size_t capacity, std::chrono::seconds sessionTimeout =
+                                           std::chrono::seconds{60});
+
+    /**
+     * Limit the rate at which data packets are sent to clients.
+     *
+     * The budgets are enforced by token buckets that allow bursts of
+     * kBandwidthBurst. When a sample doesn't fit in the total budget or its
+     * client's budget, it's shed according to its dataset's priority: low
+     * priority datasets are paused first, then normal priority datasets are
+     * decimated, while critical datasets always keep their full rate. Critical
+     * samples still use up the budget, so it should leave room for them.
+     * Control packets like list responses aren't limited.
+     *
+     * @param total  The combined limit for all clients in bytes per second, or
+     *               zero for no limit.
+     * @param client The limit for each client in bytes per second, or zero for
+     *               no limit.
+     */
+    void SetBandwidthLimit(uint64_t total, uint64_t client = 0);
+
+    /**
+     * Set the priority class that decides when a dataset's samples are shed
+     * under a bandwidth budget. Datasets have normal priority by default.
+     *
+     * @param dataset  The name of the dataset.
+     * @param priority The priority class.
+     * @throws std::length_error if all graph IDs are in use.
+     */
+    void SetPriority(std::string_view dataset, Priority priority);
+
+    /**
+     * Only send every nth sample of a dataset to clients.
+     *
+     * The flight recorder, subscribers, triggers, and the samples retained by
+     * EnableResume() still see every sample, so a dataset sampled too fast to
+     * stream can be sent at a lower rate while trigger captures and range
+     * requests show it at full resolution.
+     *
+     * @param dataset The name of the dataset.
+     * @param factor  The n in every nth sample, or 1 to send every sample.
+     * @throws std::length_error if all graph IDs are in use.
+     */
+    void SetDecimation(std::string_view dataset, uint32_t factor);
+
+    /**
+     * Keep a pre-trigger buffer of every sample so triggers can capture the
+     * samples around events at full resolution.
+     *
+     * This must be called at most once, before AddData() is called from other
+     * threads.
+     *
+     * @param capacity The number of samples to keep (the sample rate of all
+     *                 datasets combined times the longest pre-trigger plus
+     *                 post-trigger window).
+     */
+    void EnableTriggers(size_t capacity);
+
+    /**
+     * Capture every dataset around the times a condition on a dataset holds.
+     *
+     * The condition is checked against every sample of the dataset. When it
+     * fires, the samples of all datasets from the pre-trigger window before
+     * the firing sample through the post-trigger window after it are sent to
+     * each client that sent a hello packet as one capture packet. A client
+     * only receives the samples of datasets it selected. Captures include the
+     * samples that decimation withholds from the live stream, but not samples
+     * suppressed by a deadband.
+     *
+     * A trigger fires again once its capture is complete and its condition
+     * stopped holding. For boolean datasets sampled as 0 and 1, use
+     * TriggerCondition::kRising or kFalling with a threshold of 0.5.
+     *
+     * @param dataset     The name of the dataset.
+     * @param condition   The condition that fires the trigger.
+     * @param threshold   The threshold the condition compares against.
+     * @param preTrigger  How long before the firing sample to capture.
+     * @param postTrigger How long after the firing sample to capture.
+     * @throws std::length_error if all graph IDs are in use.
+     * @throws std::runtime_error if EnableTriggers() wasn't called.
+     */
+    void AddTrigger(std::string_view dataset, TriggerCondition condition,
+                    float threshold, std::chrono::microseconds preTrigger,
+                    std::chrono::microseconds postTrigger);
+
+    /**
+     * Set when data queued for clients is sent.
+     *
+     * Sending every sample in its own TCP segment wastes most of the radio's
+     * bandwidth on headers. Instead, data queued for a client is held until
+     * the queue reaches the given size or the oldest data in it has waited for
+     * the given delay, then sent with one send() call. The default is 1400
+     * bytes (about one segment) or 2 ms.
+     *
+     * Clients can request their own policy, which takes precedence. This
+     * applies to existing clients that haven't.
+     *
+     * @param bytes The queue size at which data is sent, or zero to only send
+     *              at the deadline.
+     * @param delay The maximum time data waits to be sent. Zero sends data as
+     *              soon as it's queued.
+     */
+    void SetFlushPolicy(size_t bytes, std::chrono::microseconds delay);
+
+    /**
+     * Set how long a client can stop responding before it's disconnected.
+     *
+     * A laptop that sleeps or leaves WiFi range doesn't close its connection,
+     * so the host would otherwise queue data for it forever. A client is
+     * evicted and its queued data freed when it hasn't accepted any of its
+     * queued data for the timeout. The kernel is also told to give up on
+     * connections whose peer doesn't acknowledge sent data or keepalive probes
+     * within the timeout. Clients that sent a hello packet are sent a
+     * heartbeat every kHeartbeatPeriod while they're idle, so they always
+     * have data to acknowledge and can detect a dead host themselves.
+     *
+     * The default timeout is 10 seconds. It applies to existing clients too.
+     *
+     * @param timeout The stall timeout, or zero to never evict clients.
+     */
+    void SetStallTimeout(std::chrono::milliseconds timeout);
+
+    /**
+     * Remove a dataset so its graph ID can be reused.
+     *
+     * Clients that subscribed to new datasets are told the dataset was
+     * removed, and no client receives samples for the graph ID again until it
+     * selects the dataset that reuses it. The dataset's deadband, priority, and
+     * latency statistics are discarded. The graph ID is only reused after
+     * kUnregisterGracePeriod, so clients have time to drop the old name and
+     * samples already queued are sent under it.
+     *
+     * Adding a sample to the dataset afterward registers it again. Samples for
+     * the dataset shouldn't be added concurrently with this call.
+     *
+     * @param dataset The name of the dataset.
+     * @return True if the dataset was registered.
+     */
+    bool Unregister(std::string_view dataset);
+
+    /**
+     * Returns the graph ID of a dataset, registering the dataset first if it
+     * isn't already.
+     *
+     * This lets a Subscriber select a dataset before its first sample.
+     *
+     * @param dataset The name of the dataset.
+     * @return The graph ID, or std::nullopt if all graph IDs are in use.
+     */
+    std::optional<uint8_t> Register(std::string_view dataset);
+
+    /**
+     * Returns the name of the dataset with the given graph ID, or
+     * std::nullopt if no dataset has it.
+     *
+     * @param id The graph ID.
+     */
+    std::optional<std::string> DatasetName(uint8_t id);
+
+    /**
+     * Receive samples in this process without connecting a client.
+     *
+     * The subscriber receives the samples of the datasets it selects as they
+     * would be sent to a client, except that bandwidth budgets don't apply.
+     * Samples are delivered in blocks that are read in place, so a consumer
+     * like a logging thread doesn't copy or parse them.
+     *
+     * Samples are only delivered until Unsubscribe() is called or the host is
+     * destroyed, after which the subscriber reports it's closed.
+     *
+     * @param capacity The maximum number of samples in a block. Samples that
+     *                 arrive while the block is full are dropped.
+     * @return The subscriber, which has no datasets selected.
+     */
+    std::shared_ptr<Subscriber> Subscribe(
+        size_t capacity = kSubscriberCapacity);
+
+    /**
+     * Stop delivering samples to a subscriber and close it.
+     *
+     * @param subscriber The subscriber.
+     */
+    void Unsubscribe(const std::shared_ptr<Subscriber>& subscriber);
+
+    /**
+     * Feed every sample to a sink on its own thread.
+     *
+     * The sink receives the samples a subscriber that selected every dataset
+     * would, in blocks taken once they're full or the period has elapsed. A
+     * sink that can't keep up drops samples instead of delaying anything
+     * else.
+     *
+     * @param sink     The sink.
+     * @param period   The maximum time samples wait to be written.
+     * @param capacity The maximum number of samples in a block.
+     */
+    void AddSink(std::shared_ptr<Sink> sink,
+                 std::chrono::milliseconds period = kSinkPeriod,
+                 size_t capacity = kSubscriberCapacity);
+
+    /**
+     * Write the sink's remaining samples, close it, and stop its thread.
+     *
+     * @param sink The sink.
+     * @return True if the sink was added to this host.
+     */
+    bool RemoveSink(const std::shared_ptr<Sink>& sink);
+
+    /**
+     * Returns a snapshot of the host's statistics.
+     */
+    Stats GetStats();
+
+    /**
+     * Accept clients, read their requests, and send their queued data without
+     * blocking.
+     *
+     * This is for hosts constructed with Threading::kInline, which don't have
+     * a network thread. Calling it at the end of each robot loop iteration
+     * schedules the network work deterministically, and AddData() never has
+     * to wake another thread. Sockets are serviced in passes until none are
+     * ready or a budget runs out. Each pass receives at most one chunk of
+     * data per client without waiting for more, and received packets are
+     * handled until the time budget runs out, with the rest left for the next
+     * call. A pass may still overrun the time budget by the time it takes to
+     * service every client once. Data is still only sent according to the
+     * flush policy, and telemetry is sampled when Poll() is called after its
+     * period elapsed.
+     *
+     * @param budget   The time after which no new pass is started.
+     * @param maxBytes The maximum number of bytes to send to clients, or zero
+     *                 for no limit. Clients are sent data in the order they
+     *                 connected.
+     * @throws std::runtime_error if the host has a network thread.
+     */
+    void Poll(std::chrono::microseconds budget = std::chrono::microseconds{500},
+              size_t maxBytes = 0);
+
+    /**
+     * Returns the sockets the host's event loop has to watch and what to watch
+     * them for.
+     *
+     * This is for hosts constructed with Threading::kExternal, which run
+     * inside the user's event loop, like one built on epoll or Asio. The
+     * interests are level-triggered and only change when OnReadable(),
+     * OnWritable(), or OnTimer() is called, so the event loop updates its
+     * registrations after each call. Interests() and the entry points must
+     * be called from the event loop's thread. The listener comes last, so
+     * handling events in order never accepts a client before handling the
+     * events of one it replaces.
+     *
+     * @throws std::runtime_error if the host isn't external.
+     */
+    std::vector<SocketInterest> Interests();
+
+    /**
+     * Returns when the event loop has to call OnTimer() next, or nothing if
+     * the host is idle until a socket is ready or the wake callback is
+     * called.
+     *
+     * Like Interests(), this only changes when an entry point is called.
+     *
+     * @throws std::runtime_error if the host isn't external.
+     */
+    std::optional<std::chrono::steady_clock::time_point> NextTimerTime() const;
+
+    /**
+     * Accept a client or read a client's requests.
+     *
+     * This never blocks. It receives what a single recv() returns, handles
+     * the complete packets received so far, and keeps a partial packet until
+     * a later call receives the rest of it. Sockets the host no longer knows,
+     * like one closed by an earlier call for the same batch of events, are
+     * ignored.
+     *
+     * @param handle A socket that Interests() wants read that is readable.
+     * @throws std::runtime_error if the host isn't external.
+     */
+    void OnReadable(Socket::NativeHandle handle);
+
+    /**
+     * Send a client's queued data.
+     *
+     * Sockets the host no longer knows are ignored.
+     *
+     * @param handle A socket that Interests() wants written that is writable.
+     * @throws std::runtime_error if the host isn't external.
+     */
+    void OnWritable(Socket::NativeHandle handle);
+
+    /**
+     * Do the host's periodic work: sample telemetry, queue heartbeats and
+     * sequence markers, evict stalled clients, and mark clients whose data is
+     * due for writing.
+     *
+     * Call this when NextTimerTime() is reached and after the wake callback
+     * is called.
+     *
+     * @throws std::runtime_error if the host isn't external.
+     */
+    void OnTimer();
+
+    /**
+     * Set the function called when an external host has new data to send
+     * sooner than NextTimerTime(), or when NextTimerTime() would change.
+     *
+     * It replaces waking the network thread, so it's called by whichever
+     * thread adds data, including the event loop's own. It should only
+     * schedule OnTimer() on the event loop, like with asio::post(), and must
+     * not call into the host. This must be called before AddData() is called.
+     *
+     * @param callback The function, or nullptr for none.
+     */
+    void SetWakeCallback(std::function<void()> callback);
+
 private:
+    Threading m_threading;
     std::thread m_thread;
     wpi::mutex m_connListMutex;
     std::atomic<bool> m_isRunning{false};
     TcpListener m_listener;
-    SocketSelector m_selector;
 
-    // Sorted by graph name instead of ID because the user passes in a string.
-    // (They don't know the ID.) This makes graph ID lookups take O(log n).
-    std::map<std::string, uint8_t> m_graphList;
+    // Waits on the sockets in the network thread or Poll(). External hosts
+    // don't have one, since the user's event loop does the waiting.
+    std::optional<SocketSelector> m_selector;
+
+    // Called instead of waking the network thread by external hosts. Written
+    // before any samples are added.
+    std::function<void()> m_wakeCallback;
+
+    // When an external host's OnTimer() has to be called next
+    std::optional<std::chrono::steady_clock::time_point> m_timerTime;
+
+    // Maps the dataset names the user passes in to graph IDs. Lookups don't
+    // lock, so AddData() for existing datasets never waits on registration.
+    // Registration and unregistration are done under m_connListMutex.
+    DatasetRegistry m_registry{kUnregisterGracePeriod};
+
+    // List packets for every registered dataset, ready to be sent in
+    // response to a list request. Rebuilt when a dataset is registered or
+    // unregistered.
+    // Guarded by m_connListMutex.
+    std::string m_catalog;
 
     std::vector<ClientConnection> m_connList;
 
+    // In-process subscribers. Guarded by m_connListMutex.
+    std::vector<std::shared_ptr<Subscriber>> m_subscribers;
+
+    // A sink and the thread that feeds it from a subscriber
+    struct SinkThread {
+        std::shared_ptr<Sink> sink;
+        std::shared_ptr<Subscriber> subscriber;
+        std::thread thread;
+    };
+
+    // Guarded by m_sinkMutex. Sink threads are joined under it, so it's
+    // never taken by them or while m_connListMutex is held.
+    std::vector<SinkThread> m_sinks;
+    wpi::mutex m_sinkMutex;
+
+    // Latencies from AddData() to send() of each sample indexed by graph ID.
+    // Guarded by m_connListMutex.
+    std::array<LatencyHistogram, 64> m_datasetLatency;
+
+    std::unique_ptr<FlightRecorder> m_recorder;
+
+    // Clock set by SetClock(), or empty for the steady clock. Written before
+    // any samples are added.
+    std::function<std::chrono::milliseconds()> m_clock;
+
+    // A sample retained so clients can resume without missing it or fetch it
+    // at full resolution
+    struct RetainedSample {
+        uint64_t sequence;
+
+        // Time in microseconds on the same clock as data packets' milliseconds
+        int64_t time;
+
+        float value;
+        uint8_t id;
+
+        // False if decimation kept the sample from being sent to clients
+        bool streamed;
+
+        // The value of m_retainedGenerations[id] when the sample was added
+        uint16_t generation;
+    };
+
+    // Ring buffer of the most recent samples indexed by sequence number modulo
+    // its size, and the sequence number of the next sample. The ring buffer is
+    // empty if resuming is disabled. Guarded by m_connListMutex.
+    std::vector<RetainedSample> m_retained;
+    uint64_t m_nextSequence = 0;
+
+    // Incremented when a graph ID is unregistered, so retained samples of the
+    // unregistered dataset are never replayed under the dataset that reuses
+    // the ID. Reusing an ID takes at least the unregister grace period, so
+    // the counters can't wrap around while the samples are retained in
+    // practice. Guarded by m_connListMutex.
+    std::array<uint16_t, 64> m_retainedGenerations{};
+
+    // State of a disconnected client's session
+    struct Session {
+        uint64_t selection;
+        bool catalogSubscribed;
+        std::chrono::steady_clock::time_point closeTime;
+    };
+
+    // Sessions of disconnected clients indexed by token. Guarded by
+    // m_connListMutex.
+    std::unordered_map<uint64_t, Session> m_sessions;
+    std::chrono::seconds m_sessionTimeout{0};
+
+    // Used by the network thread to rate limit sequence markers
+    std::chrono::steady_clock::time_point m_nextMarkerTime;
+    std::mt19937_64 m_tokenGenerator{std::random_device{}()};
+
+    // Bandwidth budget shared by all clients and the limit of each client's
+    // budget in bytes per second. Guarded by m_connListMutex.
+    TokenBucket m_totalBudget;
+    uint64_t m_clientBandwidthLimit = 0;
+
+    // Priority class of each dataset indexed by graph ID. Guarded by
+    // m_connListMutex.
+    std::array<Priority, 64> m_priorities;
+
+    // Decimation factor of each dataset's live stream and the number of its
+    // samples seen so far indexed by graph ID. Zero and one send every sample.
+    // Guarded by m_connListMutex.
+    std::array<uint32_t, 64> m_decimation{};
+    std::array<uint32_t, 64> m_decimationCount{};
+
+    // Written by EnableTriggers() before samples are added. Guarded by
+    // m_connListMutex.
+    std::unique_ptr<TriggerCapture> m_triggers;
+    uint64_t m_capturesCompleted = 0;
+
+    // Default flush policy of new clients. Guarded by m_connListMutex.
+    size_t m_flushBytes = 1400;
+    std::chrono::microseconds m_flushDelay{2000};
+
+    // Guarded by m_connListMutex
+    std::chrono::milliseconds m_stallTimeout{10000};
+    uint64_t m_clientsEvicted = 0;
+
+    // Used by the network thread to send heartbeats and check for stalled
+    // clients
+    std::chrono::steady_clock::time_point m_nextHeartbeatTime;
+
+    std::atomic<uint64_t> m_samplesAdded{0};
+    uint64_t m_samplesDropped = 0;
+    std::atomic<uint64_t> m_samplesSuppressed{0};
+    std::atomic<uint64_t> m_samplesRejected{0};
+
+    // Report-by-exception state of a dataset. Each dataset has its own lock so
+    // datasets added from different threads don't contend, and samples are
+    // published after it's released.
+    struct Deadband {
+        // Set after the settings are written so AddData() only takes the
+        // lock for datasets with a deadband
+        std::atomic<bool> enabled{false};
+
+        // Guards the rest of the state
+        wpi::mutex mutex;
+
+        float absolute = 0.f;
+        float relative = 0.f;
+        std::chrono::milliseconds heartbeat{0};
+
+        // The last sample sent
+        bool hasSent = false;
+        std::chrono::milliseconds sentTime{0};
+        float sentValue = 0.f;
+
+        // The last sample suppressed since then
+        bool hasHeld = false;
+        std::chrono::milliseconds heldTime{0};
+        float heldValue = 0.f;
+    };
+
+    // Indexed by graph ID
+    std::array<Deadband, 64> m_deadbands;
+
+    // Graph IDs of the telemetry datasets and the previous sample of each
+    // counter they're derived from. Written by EnableTelemetry() before
+    // m_telemetryEnabled is set and only used by the network thread afterward.
+    struct Telemetry {
+        std::chrono::steady_clock::duration period;
+        std::chrono::steady_clock::time_point nextTime;
+        std::chrono::steady_clock::time_point lastTime;
+
+        uint8_t ingestID;
+        uint8_t droppedID;
+        uint8_t wakeupsID;
+        uint8_t lockHeldID;
+        uint8_t cpuID;
+        std::array<uint8_t, kTelemetryClients> queuedIDs;
+        std::array<uint8_t, kTelemetryClients> sentIDs;
+
+        uint64_t lastSamplesAdded = 0;
+        uint64_t lastLockHeldTime = 0;
+        std::chrono::nanoseconds lastCPUTime{0};
+        std::array<uint64_t, kTelemetryClients> lastBytesSent{};
+
+        // Number of times select() returned since the last sample
+        uint64_t wakeups = 0;
+    } m_telemetry;
+
+    // True if a pass left received packets for the next one because Poll()
+    // ran out of time
+    bool m_packetsDeferred = false;
+
+    // CPU time spent in Poll() by inline hosts or in the entry points of
+    // external hosts, which the telemetry reports instead of the CPU time of
+    // the thread calling them
+    std::chrono::nanoseconds m_pollCPUTime{0};
+
+    std::atomic<bool> m_telemetryEnabled{false};
+
+    // True if there's a connection, subscriber, resume buffer, or trigger set
+    // that published samples go to. Written under m_connListMutex so
+    // PublishSamples() can skip taking it when there's nothing to do.
+    std::atomic<bool> m_hasConsumers{false};
+
+    // Total nanoseconds m_connListMutex has been held while telemetry was
+    // enabled
+    std::atomic<uint64_t> m_lockHeldTime{0};
+
     /**
      * Extract the packet type from the ID field of a received client packet.
      *
@@ -110,15 +954,122 @@ private:
     }
 
     /**
-     * Send time (x value) and data (y value) for a given dataset to remote
-     * client.
+     * Send samples for a given dataset to remote clients.
      *
-     * @param dataset The name of the dataset to which the value belongs.
-     * @param time    The x value.
-     * @param value   The y value.
+     * @param dataset The name of the dataset to which the samples belong.
+     * @param samples The samples.
+     * @param count   The number of samples.
      */
-    void AddDataImpl(const std::string& dataset, std::chrono::milliseconds time,
-                     float value);
+    void AddDataImpl(std::string_view dataset, const Sample* samples,
+                     size_t count);
+
+    /**
+     * Filter samples through a dataset's deadband under its lock until the
+     * samples run out or the output is nearly full.
+     *
+     * @param deadband The dataset's deadband.
+     * @param samples  The samples.
+     * @param count    The number of samples.
+     * @param next     The index of the next sample to filter. Advanced past
+     *                 the filtered samples.
+     * @param sent     Receives the samples to publish.
+     * @return The number of samples written to sent.
+     */
+    size_t ApplyDeadband(Deadband& deadband, const Sample* samples,
+                         size_t count, size_t& next,
+                         std::array<Sample, 64>& sent);
+
+    /**
+     * Returns the graph ID of the given dataset, assigning it one first if it
+     * doesn't already have one.
+     *
+     * @param dataset The name of the dataset.
+     * @return The graph ID, or std::nullopt if all graph IDs are in use.
+     */
+    std::optional<uint8_t> RegisterDataset(std::string_view dataset);
+
+    /**
+     * Rebuild the catalog from the registry.
+     *
+     * m_connListMutex must be held.
+     */
+    void RebuildCatalog();
+
+    /**
+     * Update m_hasConsumers after a connection, subscriber, resume buffer, or
+     * trigger set was added or removed.
+     *
+     * m_connListMutex must be held.
+     */
+    void UpdateHasConsumers();
+
+    /**
+     * Record a sample and queue it for every client and subscriber that
+     * selected its graph.
+     *
+     * @param id    The graph ID of the dataset.
+     * @param time  The x value.
+     * @param value The y value.
+     * @return True if the network thread has to be woken up to send the
+     *         sample.
+     */
+    bool PublishSample(uint8_t id, std::chrono::milliseconds time, float value);
+
+    /**
+     * Record samples and queue them for every client and subscriber that
+     * selected their graph, locking the connection list once.
+     *
+     * @param id      The graph ID of the dataset.
+     * @param samples The samples.
+     * @param count   The number of samples.
+     * @return True if the network thread has to be woken up to send the
+     *         samples.
+     */
+    bool PublishSamples(uint8_t id, const Sample* samples, size_t count);
+
+    /**
+     * Returns true if a sample fits in the total and client bandwidth budgets,
+     * and uses up budget for it if so.
+     *
+     * m_connListMutex must be held.
+     *
+     * @param conn     The client connection.
+     * @param priority The priority class of the sample's dataset.
+     * @param size     The size of the sample's packet in bytes.
+     * @param now      The current time.
+     */
+    bool AdmitSample(ClientConnection& conn, Priority priority, size_t size,
+                     std::chrono::steady_clock::time_point now);
+
+    /**
+     * Queue a capture packet for every client that selected a captured
+     * dataset.
+     *
+     * m_connListMutex must be held.
+     *
+     * @param capture The capture.
+     * @return True if the network thread has to be woken up to send it.
+     */
+    bool SendCapture(const Capture& capture);
+
+    /**
+     * Publish one sample of each telemetry dataset.
+     *
+     * This must only be called by the network thread, Poll(), or the entry
+     * points of external hosts.
+     *
+     * @param now The current time.
+     */
+    void SampleTelemetry(std::chrono::steady_clock::time_point now);
+
+    /**
+     * Remove a client connection from the selector and close it.
+     *
+     * @param conn The client connection.
+     * @return The iterator following the removed connection.
+     */
+    std::vector<ClientConnection>::iterator CloseConnection(
+        std::vector<ClientConnection>::iterator conn);
 
     /**
      * Function for thread that reads and writes graph data.
@@ -126,10 +1077,258 @@ private:
     void ThreadMain();
 
     /**
-     * Read packets from the given client.
+     * Do the network work that doesn't wait on sockets.
+     *
+     * Telemetry is sampled if it's due, range responses, replayed samples,
+     * sequence markers, and heartbeats are queued, stalled clients are
+     * evicted, and sockets with data due are marked for writing.
+     *
+     * @param telemetryEnabled True if telemetry is enabled.
+     * @return When the work has to be done next, or nothing if it only has to
+     *         be done once a socket is ready.
+     */
+    std::optional<std::chrono::steady_clock::time_point> PrepareNetworkPass(
+        bool telemetryEnabled);
+
+    /**
+     * Read from and write to a client whose socket is ready.
+     *
+     * m_connListMutex must be held.
+     *
+     * @param conn       The client connection.
+     * @param readable   True if the socket is readable.
+     * @param writable   True if the socket is writable.
+     * @param byteBudget The maximum number of bytes to send, which is reduced
+     *                   by the number of bytes sent.
+     * @param deadline   The time after which received packets are left for
+     *                   the next pass, or nothing to handle all of them.
+     * @return The iterator following the connection, which is closed if
+     *         reading or writing failed.
+     */
+    std::vector<ClientConnection>::iterator ServiceConnection(
+        std::vector<ClientConnection>::iterator conn, bool readable,
+        bool writable, size_t& byteBudget,
+        std::optional<std::chrono::steady_clock::time_point> deadline);
+
+    /**
+     * Accept a client from the listener if one is pending.
+     *
+     * @param telemetryEnabled True if telemetry is enabled.
+     */
+    void AcceptClient(bool telemetryEnabled);
+
+    /**
+     * Set whether to wait for a client's socket to become writable.
+     *
+     * @param conn     The client connection.
+     * @param interest True to wait.
+     */
+    void SetWriteInterest(ClientConnection& conn, bool interest);
+
+    /**
+     * Handle an event from an external host's event loop.
+     *
+     * @param handle   The ready socket, or nothing for a timer event.
+     * @param readable True if the socket is readable.
+     * @param writable True if the socket is writable.
+     */
+    void HandleExternalEvent(std::optional<Socket::NativeHandle> handle,
+                             bool readable, bool writable);
+
+    /**
+     * Throws if the host isn't external.
+     *
+     * @param function The name of the function that requires it.
+     */
+    void RequireExternal(const char* function) const;
+
+    /**
+     * Do one pass of the network work.
+     *
+     * PrepareNetworkPass() is run, then ready clients are read from and
+     * written to, and new clients are accepted.
+     *
+     * @param block      True to wait until a socket is ready or the next flush,
+     *                   telemetry, or heartbeat deadline. Otherwise, only
+     *                   sockets that are already ready are serviced.
+     * @param byteBudget The maximum number of bytes to send to clients, which
+     *                   is reduced by the number of bytes sent.
+     * @param deadline   The time after which received packets are left for
+     *                   the next pass, or nothing to handle all of them.
+     * @return True if any socket was ready or packets left by an earlier pass
+     *         were handled.
+     */
+    bool RunNetworkPass(
+        bool block, size_t& byteBudget,
+        std::optional<std::chrono::steady_clock::time_point> deadline);
+
+    /**
+     * Wake the network thread so it sends new data by its flush deadline.
+     *
+     * Inline hosts don't have a network thread, so this does nothing for them.
+     * External hosts call the wake callback instead.
+     */
+    void WakeNetworkThread();
+
+    /**
+     * Function for a thread that writes a subscriber's samples to a sink until
+     * the subscriber is closed.
+     *
+     * @param sink       The sink.
+     * @param subscriber The subscriber.
+     * @param period     The maximum time samples wait to be written.
+     */
+    static void SinkThreadMain(Sink& sink, Subscriber& subscriber,
+                               std::chrono::milliseconds period);
+
+    /**
+     * Receive data from the given client without blocking and handle the
+     * complete packets received so far.
+     *
+     * A partial packet is kept in the client's receive buffer until the rest
+     * of it is received.
+     *
+     * @param conn     The client connection.
+     * @param readable True if the socket is readable. Otherwise, only packets
+     *                 already received are handled.
+     * @param deadline The time after which the remaining packets are left for
+     *                 the next call, or nothing to handle all of them.
+     * @return 0 if the read succeeded and -1 if it failed or a packet was
+     *         malformed.
+     */
+    int ReadPackets(
+        ClientConnection& conn, bool readable,
+        std::optional<std::chrono::steady_clock::time_point> deadline);
+
+    /**
+     * Handle a complete packet from the given client.
+     *
+     * @param conn        The client connection.
+     * @param packet      The packet, including its ID.
+     * @param receiveTime The time at which the packet was received.
+     */
+    void HandlePacket(ClientConnection& conn, std::string_view packet,
+                      std::chrono::steady_clock::time_point receiveTime);
+
+    /**
+     * Handle an extended packet from the given client.
+     *
+     * @param conn        The client connection.
+     * @param id          The packet ID.
+     * @param payload     The packet's payload.
+     * @param receiveTime The time at which the packet was received.
+     */
+    void HandleExtendedPacket(
+        ClientConnection& conn, uint8_t id, std::string_view payload,
+        std::chrono::steady_clock::time_point receiveTime);
+
+    /**
+     * Respond to a hello packet from the given client with the protocol
+     * version and the capabilities both ends support.
+     *
+     * @param conn    The client connection.
+     * @param payload The version byte and the capabilities byte.
+     */
+    void HandleHelloPacket(ClientConnection& conn, std::string_view payload);
+
+    /**
+     * Queue a stats packet containing the latency histograms for the given
+     * client.
+     *
+     * @param conn The client connection that requested the stats.
+     */
+    void SendStats(ClientConnection& conn);
+
+    /**
+     * Queue a bandwidth allocation packet for a client.
+     *
+     * m_connListMutex must be held.
+     *
+     * @param conn The client connection.
+     */
+    void SendBandwidth(ClientConnection& conn);
+
+    /**
+     * Start or resume a client's session and queue a session packet for it.
+     *
+     * If the session is resumed, the retained samples it missed are replayed
+     * by later network passes.
+     *
+     * m_connListMutex must be held.
+     *
+     * @param conn    The client connection that sent the resume request.
+     * @param payload The resume request payload.
+     */
+    void ResumeSession(ClientConnection& conn, std::string_view payload);
+
+    /**
+     * Queue the next chunk of a client's session replay.
+     *
+     * At most kRetainedScanSamples retained samples are scanned per call.
+     *
+     * m_connListMutex must be held.
      *
      * @param conn The client connection.
-     * @return 0 if the read succeeded and -1 if it failed.
      */
-    int ReadPackets(ClientConnection& conn);
+    void ReplayRetained(ClientConnection& conn);
+
+    /**
+     * Queue a range request to be answered by later network passes, or answer
+     * it as unavailable if it can't be.
+     *
+     * m_connListMutex must be held.
+     *
+     * @param conn    The client connection that sent the range request.
+     * @param payload The range request payload.
+     */
+    void SendRange(ClientConnection& conn, std::string_view payload);
+
+    /**
+     * Continue the range responses of every client.
+     *
+     * The retained samples are scanned under m_connListMutex at most
+     * kRetainedScanSamples per client at a time. Range responses are sorted
+     * and serialized with the lock released, and nothing more is queued for
+     * a client while its bulk queue holds kMaxRangeQueued bytes.
+     *
+     * Must only be called by the network thread, since connections are looked
+     * up again by index after the lock was released.
+     *
+     * @param telemetryEnabled True if telemetry is enabled.
+     * @return True if a range request has samples left to scan, so the next
+     *         pass shouldn't wait.
+     */
+    bool ServiceTransfers(bool telemetryEnabled);
+
+    /**
+     * Scan the next chunk of retained samples for a range request.
+     *
+     * m_connListMutex must be held.
+     *
+     * @param transfer The range request.
+     */
+    void ScanRange(ClientConnection::RangeTransfer& transfer);
+
+    /**
+     * Serialize the next range packets of a range request whose retained
+     * samples were all scanned.
+     *
+     * @param transfer The range request.
+     * @param room     The number of bytes after which no more packets are
+     *                 serialized.
+     * @param packets  Receives the packets.
+     * @return True if the response is complete.
+     */
+    static bool SerializeRange(ClientConnection::RangeTransfer& transfer,
+                               size_t room, std::vector<std::string>& packets);
+
+    /**
+     * Queue a time sync response for the given client.
+     *
+     * @param conn        The client connection that sent the time sync request.
+     * @param payload     The time sync request payload.
+     * @param receiveTime The time at which the request was received.
+     */
+    void SendTimeSync(ClientConnection& conn, std::string_view payload,
+                      std::chrono::steady_clock::time_point receiveTime);
 };
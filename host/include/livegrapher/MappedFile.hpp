@@ -0,0 +1,67 @@
+// Copyright (c) 2020 FRC Team 3512. All Rights Reserved.
+
+#pragma once
+
+#include <stddef.h>
+
+#include <string>
+
+/**
+ * Wrapper around a memory-mapped file.
+ */
+class MappedFile {
+public:
+    /**
+     * Opens an existing file for reading and maps all of it.
+     *
+     * @param path The path of the file.
+     */
+    explicit MappedFile(const std::string& path);
+
+    /**
+     * Opens a file for reading and writing and maps the given number of bytes
+     * of it.
+     *
+     * The file is created if it doesn't exist and truncated if it does, then
+     * resized to the given size, so the mapping starts out zero-filled. Writes
+     * go through the kernel's page cache, so they survive the process
+     * crashing.
+     *
+     * @param path The path of the file.
+     * @param size The size of the mapping in bytes.
+     */
+    MappedFile(const std::string& path, size_t size);
+
+    ~MappedFile();
+
+    MappedFile(MappedFile&& rhs);
+    MappedFile& operator=(MappedFile&& rhs);
+
+    /**
+     * Returns a pointer to the start of the mapping.
+     */
+    char* Data() const;
+
+    /**
+     * Returns the size of the mapping in bytes.
+     */
+    size_t Size() const;
+
+    /**
+     * Schedules modified pages to be written back to disk.
+     */
+    void Flush();
+
+private:
+    char* m_data = nullptr;
+    size_t m_size = 0;
+
+#ifdef _WIN32
+    // These are HANDLEs. They're stored as void* so this header doesn't have
+    // to include windows.h, which conflicts with winsock2.h.
+    void* m_file = nullptr;
+    void* m_mapping = nullptr;
+#else
+    int m_fd = -1;
+#endif
+};
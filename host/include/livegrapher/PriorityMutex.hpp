@@ -0,0 +1,53 @@
+// Copyright (c) 2020 FRC Team 3512. All Rights Reserved.
+
+#pragma once
+
+#ifdef _WIN32
+#include <mutex>
+#else
+#include <pthread.h>
+#endif
+
+/**
+ * A mutex with priority inheritance.
+ *
+ * While a higher-priority thread like a control loop waits on the mutex, the
+ * thread holding it runs at the waiter's priority, so a lower-priority thread
+ * like the network thread can't delay the control loop beyond its critical
+ * section. Windows doesn't support priority inheritance, so it's an ordinary
+ * mutex there.
+ *
+ * The methods are named like std::mutex's so it works with std::scoped_lock.
+ */
+class PriorityMutex {
+public:
+    PriorityMutex();
+    ~PriorityMutex();
+
+    PriorityMutex(const PriorityMutex&) = delete;
+    PriorityMutex& operator=(const PriorityMutex&) = delete;
+
+    /**
+     * Blocks until the mutex is acquired.
+     */
+    void lock();
+
+    /**
+     * Acquires the mutex if it isn't held.
+     *
+     * @return True if the mutex was acquired.
+     */
+    bool try_lock();
+
+    /**
+     * Releases the mutex.
+     */
+    void unlock();
+
+private:
+#ifdef _WIN32
+    std::mutex m_mutex;
+#else
+    pthread_mutex_t m_mutex;
+#endif
+};
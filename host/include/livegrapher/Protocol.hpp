@@ -5,6 +5,7 @@
 #include <stdint.h>
 
 #include <string>
+#include <string_view>
 
 // LiveGrapher wire protocol. See README.md in the root directory of this
 // project for protocol documentation.
@@ -24,6 +25,46 @@ struct [[gnu::packed]] HostPacket {
 constexpr uint8_t kHostConnectPacket = 0b00 << 6;
 constexpr uint8_t kHostDisconnectPacket = 0b01 << 6;
 constexpr uint8_t kHostListPacket = 0b10 << 6;
+constexpr uint8_t kHostExtendedPacket = 0b11 << 6;
+
+// Extended host packets. The six low-order bits of an extended packet's ID
+// select its type instead of a graph ID, and the ID is followed by a uint32_t
+// payload length and the payload.
+constexpr uint8_t kHostStatsPacket = kHostExtendedPacket | 0;
+constexpr uint8_t kHostTimeSyncPacket = kHostExtendedPacket | 1;
+constexpr uint8_t kHostCatalogSubscribePacket = kHostExtendedPacket | 2;
+constexpr uint8_t kHostBandwidthPacket = kHostExtendedPacket | 3;
+constexpr uint8_t kHostResumePacket = kHostExtendedPacket | 4;
+constexpr uint8_t kHostFlushPolicyPacket = kHostExtendedPacket | 5;
+constexpr uint8_t kHostRangePacket = kHostExtendedPacket | 6;
+
+// Largest extended host packet payload the host accepts
+constexpr uint32_t kMaxHostExtendedLength = 65536;
+
+// The hello packet is the exception to extended packet framing. It's followed
+// by a version byte and a capabilities byte, and the two high-order bits of all
+// three bytes are set. Hosts that predate it ignore every byte of that packet
+// type, so clients can always send it and fall back to the original protocol if
+// no hello response arrives.
+constexpr uint8_t kHostHelloPacket = kHostExtendedPacket | 0x3F;
+
+// Protocol version sent in hello packets (6 bits)
+//
+// 1: Initial version
+// 2: Resume requests and sequence markers
+// 3: Heartbeats
+// 4: Range requests
+constexpr uint8_t kProtocolVersion = 4;
+
+// Capability flags sent in hello packets (6 bits). The host's hello response
+// contains the flags both ends support, which are then in effect.
+//
+// kCapNativeSamples: Data packets are sent as ClientNativeDataPackets.
+// kCapCustomClock: Sample times come from a clock set with
+//   LiveGrapher::SetClock(), like a simulation's, instead of the steady clock
+//   that time sync responses use. Only the host sets it in its response.
+constexpr uint8_t kCapNativeSamples = 1 << 0;
+constexpr uint8_t kCapCustomClock = 1 << 1;
 
 #ifdef _WIN32
 #pragma pack(push, 1)
@@ -41,6 +82,20 @@ struct [[gnu::packed]] ClientDataPacket {
 };
 #endif
 
+// Data packet sent when kCapNativeSamples is in effect. Fields are in
+// little-endian byte order and naturally aligned relative to the start of the
+// packet, so it can be copied into or read in place as this struct on
+// little-endian machines.
+struct ClientNativeDataPacket {
+    uint8_t ID;
+    uint8_t padding[3];
+    float y;
+    uint64_t x;
+};
+
+static_assert(sizeof(ClientNativeDataPacket) == 16,
+              "ClientNativeDataPacket has unexpected padding");
+
 struct ClientListPacket {
     uint8_t ID;
     uint8_t length;
@@ -50,3 +105,100 @@ struct ClientListPacket {
 
 constexpr uint8_t kClientDataPacket = 0b00 << 6;
 constexpr uint8_t kClientListPacket = 0b01 << 6;
+constexpr uint8_t kClientExtendedPacket = 0b11 << 6;
+
+// Extended client packets. These are framed like extended host packets and are
+// only sent in response to an extended host packet, so clients that don't
+// understand them never receive them.
+constexpr uint8_t kClientStatsPacket = kClientExtendedPacket | 0;
+constexpr uint8_t kClientTimeSyncPacket = kClientExtendedPacket | 1;
+constexpr uint8_t kClientDatasetAddedPacket = kClientExtendedPacket | 2;
+constexpr uint8_t kClientHelloPacket = kClientExtendedPacket | 3;
+constexpr uint8_t kClientDatasetRemovedPacket = kClientExtendedPacket | 4;
+constexpr uint8_t kClientBandwidthPacket = kClientExtendedPacket | 5;
+constexpr uint8_t kClientSessionPacket = kClientExtendedPacket | 6;
+constexpr uint8_t kClientSequencePacket = kClientExtendedPacket | 7;
+constexpr uint8_t kClientHeartbeatPacket = kClientExtendedPacket | 8;
+constexpr uint8_t kClientCapturePacket = kClientExtendedPacket | 9;
+constexpr uint8_t kClientRangePacket = kClientExtendedPacket | 10;
+
+// Session packet statuses
+constexpr uint8_t kSessionNew = 0;
+constexpr uint8_t kSessionResumed = 1;
+constexpr uint8_t kSessionResumedWithLoss = 2;
+
+// Kinds of histograms in a stats packet
+constexpr uint8_t kStatsConnectionHistogram = 0;
+constexpr uint8_t kStatsDatasetHistogram = 1;
+
+// Stats packet histogram flag set on the requesting connection's histogram
+constexpr uint8_t kStatsRequesterFlag = 1 << 0;
+
+/**
+ * Converts a 64-bit integer from host byte order to network byte order.
+ *
+ * @param in The integer in host byte order.
+ */
+uint64_t HostToNetwork64(uint64_t in);
+
+/**
+ * Encodes a data packet in network byte order.
+ *
+ * @param id    The graph ID.
+ * @param time  The x value.
+ * @param value The y value.
+ */
+ClientDataPacket MakeClientDataPacket(uint8_t id, uint64_t time, float value);
+
+/**
+ * Encodes a native data packet.
+ *
+ * Only valid on little-endian machines.
+ *
+ * @param id    The graph ID.
+ * @param time  The x value.
+ * @param value The y value.
+ */
+ClientNativeDataPacket MakeClientNativeDataPacket(uint8_t id, uint64_t time,
+                                                  float value);
+
+/**
+ * Returns true if this machine is little-endian, in which case native data
+ * packets can be sent.
+ */
+bool IsLittleEndian();
+
+/**
+ * Appends an unsigned integer to a buffer in network byte order.
+ *
+ * @param buf   The buffer.
+ * @param value The integer.
+ */
+template <typename T>
+void AppendNetworkOrder(std::string& buf, T value) {
+    for (int shift = (sizeof(T) - 1) * 8; shift >= 0; shift -= 8) {
+        buf += static_cast<char>(value >> shift & 0xff);
+    }
+}
+
+/**
+ * Reads an unsigned integer in network byte order from a buffer.
+ *
+ * @param data The buffer, which must hold at least sizeof(T) bytes.
+ */
+template <typename T>
+T ReadNetworkOrder(const char* data) {
+    T value = 0;
+    for (size_t i = 0; i < sizeof(T); ++i) {
+        value = static_cast<T>(value << 8 | static_cast<uint8_t>(data[i]));
+    }
+    return value;
+}
+
+/**
+ * Frames an extended client packet.
+ *
+ * @param id      The packet ID including the extended packet type.
+ * @param payload The packet payload.
+ */
+std::string MakeClientExtendedPacket(uint8_t id, std::string_view payload);
@@ -0,0 +1,49 @@
+// Copyright (c) 2020 FRC Team 3512. All Rights Reserved.
+
+#pragma once
+
+#include "livegrapher/Subscriber.hpp"
+
+/**
+ * A destination for samples, like a log file or shared memory, that's added
+ * to a host with LiveGrapher::AddSink().
+ *
+ * Each sink is fed by its own thread with blocks of samples of every dataset.
+ * The thread takes a block when it fills up or when the sink's batching
+ * period elapses, so a slow sink only drops its own samples and never delays
+ * the producers, clients, or other sinks.
+ *
+ * Example:
+ *     class ConsoleSink : public Sink {
+ *     public:
+ *         void Write(SampleBlock samples) override {
+ *             for (const auto& sample : samples) {
+ *                 std::cout << int{sample.id} << ',' << sample.time.count()
+ *                           << ',' << sample.value << '\n';
+ *             }
+ *         }
+ *     };
+ *
+ *     grapher.AddSink(std::make_shared<ConsoleSink>());
+ */
+class Sink {
+public:
+    virtual ~Sink() = default;
+
+    /**
+     * Write a block of samples.
+     *
+     * This is called from the sink's thread and must not throw. The samples
+     * are only valid until it returns. Use LiveGrapher::DatasetName() to look
+     * up the names of their datasets.
+     *
+     * @param samples The samples in the order they were added.
+     */
+    virtual void Write(SampleBlock samples) = 0;
+
+    /**
+     * Called from the sink's thread after the last block was written, when
+     * the sink is removed or the host is destroyed.
+     */
+    virtual void Close() {}
+};
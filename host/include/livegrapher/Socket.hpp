@@ -20,6 +20,23 @@
 
 class Socket {
 public:
+#ifdef _WIN32
+    using NativeHandle = SOCKET;
+#else
+    using NativeHandle = int;
+#endif
+
+    // Error codes returned by LastError() when a nonblocking socket has
+    // nothing to read or can't take more data, and when the peer stopped
+    // responding
+#ifdef _WIN32
+    static constexpr int kWouldBlock = WSAEWOULDBLOCK;
+    static constexpr int kTimedOut = WSAETIMEDOUT;
+#else
+    static constexpr int kWouldBlock = EWOULDBLOCK;
+    static constexpr int kTimedOut = ETIMEDOUT;
+#endif
+
     Socket() = default;
 #ifdef _WIN32
     explicit Socket(SOCKET fd) : m_fd{fd} {}
@@ -41,22 +58,14 @@ public:
      */
     template <size_t N>
     bool Read(std::array<char, N>& buf) {
-        size_t pos = 0;
-        while (pos < buf.size()) {
-            int count = recv(m_fd, buf.data() + pos, buf.size() - pos, 0);
-            if (count == 0 || (count == -1 && errno != EAGAIN)) {
-                return false;
-            }
-            pos += count;
-        }
-
-        return true;
+        return Read(buf.data(), buf.size());
     }
 
     /**
      * Read the given amount of bytes from the socket.
      *
-     * This blocks until the buffer is full.
+     * This blocks until the buffer is full, even if the socket is
+     * nonblocking.
      *
      * @param buf    The destination for the bytes read.
      * @param length The number of bytes to read.
@@ -64,6 +73,18 @@ public:
      */
     bool Read(char* buf, size_t length);
 
+    /**
+     * Read up to the given amount of bytes from the socket.
+     *
+     * This only blocks if the socket is blocking and no data is available.
+     *
+     * @param buf    The destination for the bytes read.
+     * @param length The maximum number of bytes to read.
+     * @return The number of bytes read, 0 if the connection was closed, or -1
+     *         on error (including when a nonblocking socket has no data).
+     */
+    int ReadAvailable(char* buf, size_t length);
+
     /**
      * Send a string of data.
      *
@@ -87,6 +108,24 @@ public:
      */
     void SetBlocking(bool blocking);
 
+    /**
+     * Returns the OS handle of the socket, like for registering it with an
+     * event loop.
+     */
+    NativeHandle Handle() const { return m_fd; }
+
+    /**
+     * Returns the error code of the last failed socket call on this thread.
+     *
+     * Winsock doesn't set errno, so this is WSAGetLastError() on Windows.
+     */
+    static int LastError();
+
+    /**
+     * Clear the error code returned by LastError().
+     */
+    static void ClearLastError();
+
 protected:
     friend class SocketSelector;
 
@@ -14,6 +14,8 @@
 #include <sys/select.h>
 #endif
 
+#include <chrono>
+
 #include "livegrapher/Pipe.hpp"
 #include "livegrapher/Socket.hpp"
 
@@ -72,6 +74,14 @@ public:
      */
     bool Select();
 
+    /**
+     * Selects on all the registered sockets, giving up after a timeout.
+     *
+     * @param timeout The maximum time to wait for a socket to become ready.
+     * @return True if a socket is ready.
+     */
+    bool Select(std::chrono::microseconds timeout);
+
     /**
      * Returns true if socket is ready to read.
      *
@@ -127,6 +137,14 @@ private:
 
     Pipe m_pipe;
 
+    /**
+     * Selects on all the registered sockets.
+     *
+     * @param timeout The maximum time to wait, or nullptr to wait forever.
+     * @return True if a socket is ready.
+     */
+    bool SelectImpl(timeval* timeout);
+
     /**
      * Add socket file descriptor to the selector.
      *
@@ -0,0 +1,213 @@
+// Copyright (c) 2020 FRC Team 3512. All Rights Reserved.
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <vector>
+
+/**
+ * A sample delivered to a Subscriber.
+ */
+struct SubscriberSample {
+    std::chrono::milliseconds time;
+    float value;
+    uint8_t id;
+};
+
+/**
+ * A view of a block of samples received by a Subscriber.
+ *
+ * The samples aren't copied out of the subscriber; the view is valid until the
+ * next call to Subscriber::Poll() or Subscriber::Wait().
+ */
+class SampleBlock {
+public:
+    SampleBlock() = default;
+
+    /**
+     * Constructs a view of a block of samples.
+     *
+     * @param data The first sample.
+     * @param size The number of samples.
+     */
+    SampleBlock(const SubscriberSample* data, size_t size)
+        : m_data{data}, m_size{size} {}
+
+    const SubscriberSample* begin() const { return m_data; }
+
+    const SubscriberSample* end() const { return m_data + m_size; }
+
+    const SubscriberSample& operator[](size_t index) const {
+        return m_data[index];
+    }
+
+    /**
+     * Returns the number of samples in the block.
+     */
+    size_t size() const { return m_size; }
+
+    /**
+     * Returns true if the block has no samples.
+     */
+    bool empty() const { return m_size == 0; }
+
+private:
+    const SubscriberSample* m_data = nullptr;
+    size_t m_size = 0;
+};
+
+/**
+ * Receives samples in the same process as the host without a network
+ * connection.
+ *
+ * Obtain one with LiveGrapher::Subscribe(). Samples of the selected datasets
+ * are appended to a block as they're added, after deadbands are applied, and
+ * one consumer thread takes the block with Poll() or Wait(). If the consumer
+ * falls behind and the block fills up, further samples are dropped until it's
+ * taken.
+ *
+ * Example:
+ *     auto subscriber = grapher.Subscribe();
+ *     subscriber->SelectGraph(grapher.Register("Encoder").value());
+ *
+ *     while (!subscriber->IsClosed()) {
+ *         for (const auto& sample : subscriber->Wait(100ms)) {
+ *             Log(sample.time, sample.value);
+ *         }
+ *     }
+ */
+class Subscriber {
+public:
+    /**
+     * Constructs a subscriber with no datasets selected.
+     *
+     * @param capacity The maximum number of samples in a block.
+     */
+    explicit Subscriber(size_t capacity);
+
+    Subscriber(const Subscriber&) = delete;
+    Subscriber& operator=(const Subscriber&) = delete;
+
+    /**
+     * Select a graph so its samples will be received.
+     *
+     * @param id The ID of the graph to select.
+     */
+    void SelectGraph(uint8_t id);
+
+    /**
+     * Unselect a graph so its samples will no longer be received.
+     *
+     * @param id The ID of the graph to unselect.
+     */
+    void UnselectGraph(uint8_t id);
+
+    /**
+     * Returns true if the given graph is selected.
+     *
+     * @param id The ID of the graph.
+     */
+    bool IsGraphSelected(uint8_t id) const;
+
+    /**
+     * Returns a bitfield of the selected graphs. Bit n is set if graph ID n is
+     * selected.
+     */
+    uint64_t Selection() const;
+
+    /**
+     * Replace the selected graphs.
+     *
+     * @param selection A bitfield of the graphs to select.
+     */
+    void SetSelection(uint64_t selection);
+
+    /**
+     * Receive the samples of every dataset, including ones registered later,
+     * regardless of the selection.
+     *
+     * @param enabled True to receive every dataset.
+     */
+    void SelectAll(bool enabled);
+
+    /**
+     * Returns the samples received since the last call without blocking.
+     *
+     * The previously returned block is invalidated.
+     */
+    SampleBlock Poll();
+
+    /**
+     * Returns the samples received since the last call, waiting up to the
+     * given timeout for the given number of them.
+     *
+     * The previously returned block is invalidated. The block has fewer
+     * samples than requested on timeout or once the subscriber is closed.
+     *
+     * @param timeout The maximum time to wait.
+     * @param count   The number of samples to wait for. It's limited to the
+     *                block capacity.
+     */
+    SampleBlock Wait(std::chrono::milliseconds timeout, size_t count = 1);
+
+    /**
+     * Returns the number of samples dropped because the block was full.
+     */
+    uint64_t SamplesDropped() const;
+
+    /**
+     * Returns true if the host closed the subscription, either because of
+     * LiveGrapher::Unsubscribe() or because it was destroyed.
+     */
+    bool IsClosed() const;
+
+private:
+    std::atomic<uint64_t> m_selection{0};
+    std::atomic<bool> m_allSelected{false};
+
+    mutable std::mutex m_mutex;
+    std::condition_variable m_ready;
+
+    // The block being filled by the host and the block last returned to the
+    // consumer. They're swapped when the consumer takes a block, and both are
+    // reserved up front so samples are never moved. Guarded by m_mutex except
+    // m_taken, which only the consumer touches.
+    std::vector<SubscriberSample> m_filling;
+    std::vector<SubscriberSample> m_taken;
+    size_t m_capacity;
+    uint64_t m_samplesDropped = 0;
+    bool m_closed = false;
+
+    // Number of samples in the block at which the waiting consumer is woken
+    // up. Guarded by m_mutex.
+    size_t m_wakeSize = 1;
+
+    /**
+     * Append a sample to the block being filled.
+     *
+     * @param id    The graph ID of the dataset.
+     * @param time  The x value.
+     * @param value The y value.
+     */
+    void Push(uint8_t id, std::chrono::milliseconds time, float value);
+
+    /**
+     * Stop receiving samples and wake the consumer.
+     */
+    void Close();
+
+    /**
+     * Swap the filled block out for the consumer.
+     *
+     * m_mutex must be held.
+     */
+    SampleBlock Take();
+
+    friend class LiveGrapher;
+};
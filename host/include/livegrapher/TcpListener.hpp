@@ -21,7 +21,10 @@ public:
     /**
      * Accepts a pending TCP connection and returns the TcpSocket.
      *
-     * This blocks until a connection is pending.
+     * The listener is nonblocking, so this throws if no connection is
+     * pending.
+     *
+     * @throws std::system_error if no connection could be accepted.
      */
     TcpSocket Accept();
 };
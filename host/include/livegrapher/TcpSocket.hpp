@@ -2,6 +2,11 @@
 
 #pragma once
 
+#include <stdint.h>
+
+#include <chrono>
+#include <string>
+
 #include "livegrapher/Socket.hpp"
 
 class TcpSocket : public Socket {
@@ -22,6 +27,32 @@ public:
     TcpSocket(TcpSocket&&) = default;
     TcpSocket& operator=(TcpSocket&&) = default;
 
+    /**
+     * Connect to a remote host.
+     *
+     * This blocks until the connection is established or fails.
+     *
+     * @param address The IPv4 address of the remote host in dotted decimal
+     *                notation.
+     * @param port    The port on the remote host.
+     * @return True if the connection succeeded.
+     */
+    bool Connect(const std::string& address, uint16_t port);
+
+    /**
+     * Make the kernel detect a dead peer on its own.
+     *
+     * Keepalive probes are sent once the connection has been idle for half the
+     * given time, then every second, and the connection fails if the peer
+     * doesn't answer them by the end of it or doesn't acknowledge sent data
+     * within the given time. Options the platform doesn't support are
+     * skipped.
+     *
+     * @param timeout The time without a response from the peer after which the
+     *                connection fails.
+     */
+    void SetDeadPeerTimeout(std::chrono::milliseconds timeout);
+
 private:
     friend class TcpListener;
 
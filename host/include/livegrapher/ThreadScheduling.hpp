@@ -0,0 +1,51 @@
+// Copyright (c) 2020 FRC Team 3512. All Rights Reserved.
+
+#pragma once
+
+#include <stdint.h>
+
+/**
+ * Scheduling policies for a thread.
+ */
+enum class SchedulingPolicy {
+    // Keep the policy the thread inherited from the thread that created it
+    kInherit,
+
+    // Time-shared scheduling (SCHED_OTHER) with a nice level
+    kOther,
+
+    // Real-time first-in, first-out scheduling (SCHED_FIFO) with a priority
+    kFifo
+};
+
+/**
+ * Scheduling settings for a thread, like LiveGrapher's network thread.
+ *
+ * The default settings leave the thread as it was created.
+ */
+struct ThreadScheduling {
+    // The CPUs the thread may run on, with bit n set for CPU n, or zero to
+    // leave its affinity unchanged
+    uint64_t affinity = 0;
+
+    SchedulingPolicy policy = SchedulingPolicy::kInherit;
+
+    // Nice level from -20 (highest priority) to 19 (lowest priority) for
+    // SchedulingPolicy::kOther
+    int nice = 0;
+
+    // Priority from 1 (lowest) to 99 (highest) for SchedulingPolicy::kFifo
+    int priority = 1;
+};
+
+/**
+ * Apply scheduling settings to the calling thread.
+ *
+ * Affinity and nice levels are only supported on Linux and Windows. Windows
+ * maps nice levels and real-time priorities to its thread priority levels.
+ *
+ * @param scheduling The settings.
+ * @throws std::system_error if the settings aren't supported or the OS
+ *         rejected them, like for lack of privileges.
+ */
+void SetThreadScheduling(const ThreadScheduling& scheduling);
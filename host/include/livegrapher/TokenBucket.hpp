@@ -0,0 +1,71 @@
+// Copyright (c) 2020 FRC Team 3512. All Rights Reserved.
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <chrono>
+
+/**
+ * Token bucket for limiting a byte rate.
+ *
+ * Tokens accumulate at the rate limit up to a capacity that allows short
+ * bursts. Consuming tokens may take the bucket into debt of up to its capacity,
+ * which has to be paid off by refilling before the level is positive again.
+ *
+ * A default-constructed bucket is unlimited.
+ */
+class TokenBucket {
+public:
+    TokenBucket() = default;
+
+    /**
+     * Constructs a full token bucket.
+     *
+     * @param rate     The refill rate in bytes per second, or zero for no
+     *                 limit.
+     * @param capacity The maximum number of tokens in bytes.
+     */
+    TokenBucket(uint64_t rate, double capacity);
+
+    /**
+     * Add the tokens accumulated since the last refill.
+     *
+     * @param now The current time.
+     */
+    void Refill(std::chrono::steady_clock::time_point now);
+
+    /**
+     * Remove tokens from the bucket, going into debt if there aren't enough.
+     *
+     * @param tokens The number of tokens in bytes.
+     */
+    void Consume(double tokens);
+
+    /**
+     * Returns true if the bucket limits the rate.
+     */
+    bool IsLimited() const;
+
+    /**
+     * Returns the refill rate in bytes per second, or zero for no limit.
+     */
+    uint64_t Rate() const;
+
+    /**
+     * Returns the number of tokens in bytes. Negative values are debt.
+     */
+    double Level() const;
+
+    /**
+     * Returns the maximum number of tokens in bytes.
+     */
+    double Capacity() const;
+
+private:
+    uint64_t m_rate = 0;
+    double m_capacity = 0.0;
+    double m_level = 0.0;
+    std::chrono::steady_clock::time_point m_lastRefill;
+};
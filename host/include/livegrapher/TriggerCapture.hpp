@@ -0,0 +1,152 @@
+// Copyright (c) 2020 FRC Team 3512. All Rights Reserved.
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <chrono>
+#include <optional>
+#include <vector>
+
+/**
+ * Conditions on a dataset's value that fire a trigger.
+ */
+enum class TriggerCondition : uint8_t {
+    // The value rises from below the threshold to at or above it
+    kRising,
+
+    // The value falls from above the threshold to at or below it
+    kFalling,
+
+    // The value rises or falls through the threshold
+    kCrossing,
+
+    // The value is above the threshold
+    kAbove,
+
+    // The value is below the threshold
+    kBelow
+};
+
+/**
+ * A sample in a trigger capture.
+ */
+struct CapturedSample {
+    // Time in microseconds on the same clock as data packets' milliseconds
+    int64_t time;
+
+    float value;
+    uint8_t id;
+};
+
+/**
+ * The samples of every dataset around a trigger firing.
+ */
+struct Capture {
+    // The graph ID of the dataset whose trigger fired
+    uint8_t id;
+
+    // Time of the sample that fired the trigger in microseconds
+    int64_t time;
+
+    // The samples from the pre-trigger window through the post-trigger window
+    // in the order they were added
+    std::vector<CapturedSample> samples;
+};
+
+/**
+ * Evaluates triggers against every sample and captures the samples of all
+ * datasets around each firing.
+ *
+ * The most recent samples are kept in a ring buffer, which holds the
+ * pre-trigger window. When a trigger fires, the capture is completed once a
+ * sample arrives after the post-trigger window, or early if the ring buffer
+ * would otherwise overwrite its start. A trigger is rearmed once its capture
+ * completed and its condition stopped holding.
+ */
+class TriggerCapture {
+public:
+    /**
+     * Constructs a trigger capture engine with no triggers.
+     *
+     * @param capacity The number of samples in the ring buffer. It should
+     *                 cover the longest pre-trigger plus post-trigger window
+     *                 at the combined sample rate of all datasets.
+     */
+    explicit TriggerCapture(size_t capacity);
+
+    /**
+     * Add a trigger on a dataset.
+     *
+     * @param id          The graph ID of the dataset.
+     * @param condition   The condition that fires the trigger.
+     * @param threshold   The threshold the condition compares against.
+     * @param preTrigger  How long before the firing sample to capture.
+     * @param postTrigger How long after the firing sample to capture.
+     */
+    void AddTrigger(uint8_t id, TriggerCondition condition, float threshold,
+                    std::chrono::microseconds preTrigger,
+                    std::chrono::microseconds postTrigger);
+
+    /**
+     * Remove the triggers on a dataset, discarding their pending captures.
+     *
+     * @param id The graph ID of the dataset.
+     */
+    void RemoveTriggers(uint8_t id);
+
+    /**
+     * Record a sample and evaluate the triggers on its dataset.
+     *
+     * @param sample    The sample.
+     * @param completed Captures completed by this sample are appended to it.
+     */
+    void Record(const CapturedSample& sample, std::vector<Capture>& completed);
+
+private:
+    struct Trigger {
+        uint8_t id;
+        TriggerCondition condition;
+        float threshold;
+        std::chrono::microseconds preTrigger;
+        std::chrono::microseconds postTrigger;
+
+        // The previous value of the dataset, used to detect edges
+        std::optional<float> previous;
+
+        // False from firing until the capture completed and the condition
+        // stopped holding, so a level condition fires once per event
+        bool armed = true;
+
+        // Set while a capture is pending
+        bool fired = false;
+        int64_t fireTime = 0;
+        uint64_t startSequence = 0;
+    };
+
+    std::vector<Trigger> m_triggers;
+
+    // Ring buffer of the most recent samples indexed by sequence number modulo
+    // its size, and the sequence number of the next sample
+    std::vector<CapturedSample> m_ring;
+    uint64_t m_nextSequence = 0;
+
+    /**
+     * Returns true if a trigger's condition holds for a new value.
+     *
+     * @param trigger The trigger.
+     * @param value   The new value of its dataset.
+     */
+    static bool Evaluate(const Trigger& trigger, float value);
+
+    /**
+     * Copy a trigger's capture out of the ring buffer and end it.
+     *
+     * @param trigger The trigger.
+     * @param end     One past the sequence number of the last sample to
+     *                consider.
+     * @return The capture.
+     */
+    Capture Complete(Trigger& trigger, uint64_t end);
+};
@@ -4,14 +4,19 @@
 
 #include <fmt/chrono.h>
 
+#include <algorithm>
+#include <chrono>
 #include <cmath>
 #include <cstring>
 #include <ctime>
 #include <fstream>
 #include <iostream>
+#include <iterator>
+#include <limits>
 #include <optional>
 
 #include <QMessageBox>
+#include <QStatusBar>
 #include <QtEndian>
 
 #include "MainWindow.hpp"
@@ -71,14 +76,34 @@ constexpr QRgb HSVtoRGB(float h, float s, float v) {
     return qRgb(r * 255, g * 255, b * 255);
 }
 
+/**
+ * Returns the color of the graph with the given index.
+ *
+ * For HSV, V starts out at 1. H cycles through 12 colors (roughly the rainbow).
+ * When it wraps around 360 degrees, V is decremented by 0.5. S is always 1.
+ * This algorithm gives 25 possible values, one being black.
+ *
+ * @param i The index of the graph.
+ */
+static QRgb GraphColor(uint32_t i) {
+    constexpr uint32_t parts = 12;
+    return HSVtoRGB(360 / parts * i % 360, 1, 1 - 0.5 * std::floor(i / parts));
+}
+
 Graph::Graph(MainWindow* parentWindow)
     : QObject(parentWindow), m_window(*parentWindow) {
     connect(&m_dataSocket, SIGNAL(readyRead()), this, SLOT(HandleSocketData()));
+
+    connect(&m_timeSyncTimer, SIGNAL(timeout()), this, SLOT(SendTimeSync()));
+    connect(&m_timeSyncTimer, SIGNAL(timeout()), this,
+            SLOT(CheckHeartbeat()));
+    m_timeSyncTimer.start(1000);
 }
 
 void Graph::Reconnect() {
     // Clear the old list of graph names because a new set will be received
     m_graphNames.clear();
+    m_listReceived = false;
 
     // Attempt connection to remote dataset host
     if (m_dataSocket.state() != QAbstractSocket::ConnectedState) {
@@ -91,6 +116,16 @@ void Graph::Reconnect() {
                                   "Connection to remote host failed");
             return;
         }
+
+        // The hello is only sent on new connections because the host's
+        // response changes the format of the packets that follow it
+        if (!SendHello()) {
+            QMessageBox::critical(&m_window, "Connection Error",
+                                  "Sending hello to remote host failed");
+            m_dataSocket.disconnectFromHost();
+            m_startTime = 0;
+            return;
+        }
     }
 
     // Request list of all datasets on remote host
@@ -261,6 +296,8 @@ void Graph::HandleSocketData() {
         m_state = ReceiveState::ID;
     };
 
+    m_lastReceiveTime = LocalTime();
+
     while (1) {
         if (m_state == ReceiveState::ID) {
             if (m_dataSocket.bytesAvailable() == 0) {
@@ -283,7 +320,30 @@ void Graph::HandleSocketData() {
                     m_clientListPacket.ID = id;
                     m_state = ReceiveState::NameLength;
                     break;
+                case k_clientExtendedPacket:
+                    m_clientExtendedPacket.ID = id;
+                    m_state = ReceiveState::ExtendedLength;
+                    break;
             }
+        } else if (m_state == ReceiveState::Data && m_nativeSamples) {
+            // Native packets are already in this machine's byte order, so the
+            // rest of the packet is read straight into the struct
+            ClientNativeDataPacket packet;
+            if (static_cast<quint64>(m_dataSocket.bytesAvailable()) <
+                sizeof(packet) - sizeof(packet.ID)) {
+                return;
+            }
+
+            if (!RecvData(reinterpret_cast<char*>(&packet) + sizeof(packet.ID),
+                          sizeof(packet) - sizeof(packet.ID))) {
+                reportFailure();
+                return;
+            }
+
+            m_clientDataPacket.x = packet.x;
+            m_clientDataPacket.y = packet.y;
+
+            m_state = ReceiveState::DataComplete;
         } else if (m_state == ReceiveState::Data) {
             if (static_cast<quint64>(m_dataSocket.bytesAvailable()) <
                 sizeof(m_clientDataPacket.x) + sizeof(m_clientDataPacket.y)) {
@@ -302,6 +362,26 @@ void Graph::HandleSocketData() {
                 return;
             }
 
+            // This will only work if ints are the same size as floats
+            static_assert(sizeof(float) == sizeof(uint32_t),
+                          "float isn't 32 bits long");
+
+            // Convert endianness of x component
+            uint64_t xtmp;
+            std::memcpy(&xtmp, &m_clientDataPacket.x,
+                        sizeof(m_clientDataPacket.x));
+            xtmp = qFromBigEndian<qint64>(xtmp);
+            std::memcpy(&m_clientDataPacket.x, &xtmp,
+                        sizeof(m_clientDataPacket.x));
+
+            // Convert endianness of y component
+            uint64_t ytmp;
+            std::memcpy(&ytmp, &m_clientDataPacket.y,
+                        sizeof(m_clientDataPacket.y));
+            ytmp = qFromBigEndian<qint32>(ytmp);
+            std::memcpy(&m_clientDataPacket.y, &ytmp,
+                        sizeof(m_clientDataPacket.y));
+
             m_state = ReceiveState::DataComplete;
         } else if (m_state == ReceiveState::NameLength) {
             if (m_dataSocket.bytesAvailable() == 0) {
@@ -339,32 +419,43 @@ void Graph::HandleSocketData() {
             }
 
             m_state = ReceiveState::ListComplete;
-        } else if (m_state == ReceiveState::DataComplete) {
-            // Add sent point to local graph
+        } else if (m_state == ReceiveState::ExtendedLength) {
+            if (static_cast<quint64>(m_dataSocket.bytesAvailable()) <
+                sizeof(m_clientExtendedPacket.length)) {
+                return;
+            }
 
-            // This will only work if ints are the same size as floats
-            static_assert(sizeof(float) == sizeof(uint32_t),
-                          "float isn't 32 bits long");
+            char lengthBuf[sizeof(m_clientExtendedPacket.length)];
+            if (!RecvData(lengthBuf, sizeof(lengthBuf))) {
+                reportFailure();
+                return;
+            }
 
-            // Convert endianness of x component
-            uint64_t xtmp;
-            std::memcpy(&xtmp, &m_clientDataPacket.x,
-                        sizeof(m_clientDataPacket.x));
-            xtmp = qFromBigEndian<qint64>(xtmp);
-            std::memcpy(&m_clientDataPacket.x, &xtmp,
-                        sizeof(m_clientDataPacket.x));
+            m_clientExtendedPacket.length = qFromBigEndian<quint32>(lengthBuf);
+            m_clientExtendedPacket.payload.resize(
+                m_clientExtendedPacket.length);
+            m_state = ReceiveState::ExtendedPayload;
+        } else if (m_state == ReceiveState::ExtendedPayload) {
+            if (static_cast<quint64>(m_dataSocket.bytesAvailable()) <
+                m_clientExtendedPacket.length) {
+                return;
+            }
 
-            // Convert endianness of y component
-            uint64_t ytmp;
-            std::memcpy(&ytmp, &m_clientDataPacket.y,
-                        sizeof(m_clientDataPacket.y));
-            ytmp = qFromBigEndian<qint32>(ytmp);
-            std::memcpy(&m_clientDataPacket.y, &ytmp,
-                        sizeof(m_clientDataPacket.y));
+            if (m_clientExtendedPacket.length > 0 &&
+                !RecvData(&m_clientExtendedPacket.payload[0],
+                          m_clientExtendedPacket.length)) {
+                reportFailure();
+                return;
+            }
+
+            m_state = ReceiveState::ExtendedComplete;
+        } else if (m_state == ReceiveState::DataComplete) {
+            // Add sent point to local graph
 
             // Set time offset based on remote clock
             if (m_startTime == 0) {
                 m_startTime = m_clientDataPacket.x;
+                m_sessionStartTime = m_startTime;
             }
 
             // Add data to appropriate dataset; store point in temps because
@@ -373,6 +464,19 @@ void Graph::HandleSocketData() {
             float y = m_clientDataPacket.y;
             AddData(GraphID(m_clientDataPacket.ID), x / 1000.f, y);
 
+            // Measure the time from the sample being taken on the host to it
+            // being drawn. The host timestamps samples in milliseconds, so
+            // this overestimates by up to 1 ms.
+            if (m_clock && !m_customClock) {
+                int64_t sampleTime =
+                    static_cast<int64_t>(m_clientDataPacket.x) * 1000 -
+                    m_clock->offset;
+                int64_t latency = LocalTime() - sampleTime;
+                m_latencySum += latency;
+                m_latencyMax = std::max(m_latencyMax, latency);
+                ++m_latencyCount;
+            }
+
             m_state = ReceiveState::ID;
         } else if (m_state == ReceiveState::ListComplete) {
             m_graphNames[GraphID(m_clientListPacket.ID)] =
@@ -380,19 +484,19 @@ void Graph::HandleSocketData() {
 
             // If that was the last name, exit the recv loop
             if (m_clientListPacket.eof == 1) {
-                // If list of graph names changed, clear the checkbox states.
-                // Otherwise, retain the old states for user convenience.
-                if (m_oldGraphNames != m_graphNames) {
-                    m_curSelect = 0;
-                }
+                m_listReceived = true;
 
-                // Allow user to select which datasets to receive
-                auto dialog = new SelectDialog(m_graphNames, this, &m_window);
-                connect(dialog, SIGNAL(finished(int)), this,
-                        SLOT(SendGraphChoices()));
-                dialog->open();
+                // Whether the user needs to select datasets depends on
+                // whether the host resumes the session
+                if (!m_sessionPending) {
+                    FinishDatasetList();
+                }
             }
 
+            m_state = ReceiveState::ID;
+        } else if (m_state == ReceiveState::ExtendedComplete) {
+            HandleExtendedPacket();
+
             m_state = ReceiveState::ID;
         }
     }
@@ -412,20 +516,19 @@ void Graph::SendGraphChoices() {
     // If true, graphs haven't been created yet
     bool createGraphs = m_window.plot->graphCount() == 0;
 
-    // Send updated status on streams to which to connect based on the bit array
-    for (uint32_t i = 0; i < m_graphNames.size(); ++i) {
-        // If there are no graphs yet, create one for each dataset
-        if (createGraphs) {
-            // For HSV, V starts out at 1. H cycles through 12 colors (roughly
-            // the rainbow). When it wraps around 360 degrees, V is decremented
-            // by 0.5. S is always 1. This algorithm gives 25 possible values,
-            // one being black.
-            constexpr uint32_t parts = 12;
-            CreateGraph(m_graphNames[i],
-                        HSVtoRGB(360 / parts * i % 360, 1,
-                                 1 - 0.5 * std::floor(i / parts)));
+    // If there are no graphs yet, create one for each dataset. Graph indices
+    // are graph IDs, and IDs left unused by datasets the host unregistered get
+    // unnamed graphs that are never shown.
+    if (createGraphs && !m_graphNames.empty()) {
+        for (uint32_t i = 0; i <= m_graphNames.rbegin()->first; ++i) {
+            auto name = m_graphNames.find(i);
+            CreateGraph(name != m_graphNames.end() ? name->second : "",
+                        GraphColor(i));
         }
+    }
 
+    // Send updated status on streams to which to connect based on the bit array
+    for (const auto& [i, name] : m_graphNames) {
         // Remove all graphs from legend so the requested ones are properly
         // ordered after reconnects
         m_window.plot->graph(i)->removeFromLegend();
@@ -452,6 +555,170 @@ void Graph::SendGraphChoices() {
     }
 }
 
+void Graph::SelectDatasets() {
+    if (m_graphNames.empty()) {
+        QMessageBox::critical(&m_window, "Select Datasets",
+                              "No datasets have been received from the host");
+        return;
+    }
+
+    auto dialog = new SelectDialog(m_graphNames, this, &m_window);
+    connect(dialog, SIGNAL(finished(int)), this, SLOT(SendGraphChoices()));
+    dialog->open();
+}
+
+bool Graph::RequestStats() {
+    if (!IsConnected()) {
+        QMessageBox::critical(&m_window, "Host Statistics",
+                              "Not connected to remote host");
+        return false;
+    }
+
+    // Extended packet with an empty payload
+    char packet[1 + sizeof(uint32_t)] = {static_cast<char>(k_hostStatsPacket),
+                                         0, 0, 0, 0};
+    if (!SendData({packet, sizeof(packet)})) {
+        QMessageBox::critical(&m_window, "Connection Error",
+                              "Requesting statistics from remote host failed");
+        return false;
+    }
+
+    return true;
+}
+
+bool Graph::RequestBandwidth() {
+    if (!IsConnected()) {
+        QMessageBox::critical(&m_window, "Bandwidth Allocation",
+                              "Not connected to remote host");
+        return false;
+    }
+
+    // Extended packet with an empty payload
+    char packet[1 + sizeof(uint32_t)] = {
+        static_cast<char>(k_hostBandwidthPacket), 0, 0, 0, 0};
+    if (!SendData({packet, sizeof(packet)})) {
+        QMessageBox::critical(&m_window, "Connection Error",
+                              "Requesting bandwidth from remote host failed");
+        return false;
+    }
+
+    return true;
+}
+
+bool Graph::FetchFullResolution() {
+    if (!IsConnected()) {
+        QMessageBox::critical(&m_window, "Fetch Full Resolution",
+                              "Not connected to remote host");
+        return false;
+    }
+    if (!m_hostRanges) {
+        QMessageBox::critical(&m_window, "Fetch Full Resolution",
+                              "Remote host doesn't support range requests");
+        return false;
+    }
+
+    // Samples are only placed on the time axis once it has a start time
+    if (m_startTime == 0) {
+        return true;
+    }
+
+    // The visible range in host milliseconds, rounded outward
+    auto range = m_window.plot->xAxis->range();
+    auto first = static_cast<qint64>(m_startTime) +
+                 static_cast<qint64>(std::floor(range.lower * 1000.0));
+    auto last = static_cast<qint64>(m_startTime) +
+                static_cast<qint64>(std::ceil(range.upper * 1000.0));
+
+    // A fetch already in progress is finished first
+    if (m_rangePending || !m_rangeQueue.empty()) {
+        m_window.statusBar()->showMessage(
+            "Still fetching samples at full resolution", 5000);
+        return true;
+    }
+
+    // The host answers requests in order and holds back the ones it can't
+    // queue yet, so they're sent one at a time instead of in a burst
+    m_rangeFirst = first;
+    m_rangeLast = last;
+    m_rangeSamples = 0;
+    m_rangeUnavailable = 0;
+    for (size_t id = 0; id < m_datasets.size(); ++id) {
+        if (m_curSelect & (1ULL << id)) {
+            m_rangeQueue.push_back(static_cast<uint8_t>(id));
+        }
+    }
+
+    if (!SendNextRange()) {
+        QMessageBox::critical(&m_window, "Connection Error",
+                              "Requesting samples from remote host failed");
+        return false;
+    }
+
+    return true;
+}
+
+bool Graph::SendHello() {
+    // Extended packets are only sent once the host has shown it understands
+    // them by responding to the hello packet
+    m_helloReceived = false;
+    m_nativeSamples = false;
+    m_customClock = false;
+    m_hostHeartbeats = false;
+    m_hostRanges = false;
+    m_rangeQueue.clear();
+    m_rangePending.reset();
+    m_sessionPending = false;
+    m_sessionResumed = false;
+    m_clockSamples.clear();
+    m_clock.reset();
+
+    uint8_t capabilities = 0;
+#if Q_BYTE_ORDER == Q_LITTLE_ENDIAN
+    capabilities |= k_capNativeSamples;
+#endif
+    capabilities |= k_capCustomClock;
+
+    // Every byte of the hello packet has the two high-order bits set
+    char hello[3] = {static_cast<char>(k_hostHelloPacket),
+                     static_cast<char>(0xC0 | k_protocolVersion),
+                     static_cast<char>(0xC0 | capabilities)};
+    return SendData({hello, sizeof(hello)});
+}
+
+void Graph::SendTimeSync() {
+    if (!m_helloReceived || !IsConnected()) {
+        return;
+    }
+
+    // Extended packet containing the local transmit time, which the host
+    // echoes back
+    char packet[1 + sizeof(uint32_t) + sizeof(int64_t)];
+    packet[0] = static_cast<char>(k_hostTimeSyncPacket);
+    qToBigEndian<quint32>(sizeof(int64_t), packet + 1);
+    qToBigEndian<qint64>(LocalTime(), packet + 1 + sizeof(uint32_t));
+
+    if (!SendData({packet, sizeof(packet)})) {
+        std::cerr << "LiveGrapher: Graph::SendTimeSync(): send failed\n";
+    }
+}
+
+void Graph::CheckHeartbeat() {
+    if (!m_hostHeartbeats || !IsConnected()) {
+        return;
+    }
+
+    // A host that went out of range or crashed without closing the connection
+    // stops sending heartbeats
+    if (LocalTime() - m_lastReceiveTime > k_heartbeatTimeout) {
+        std::cerr << "LiveGrapher: Graph::CheckHeartbeat(): host timed out\n";
+        m_dataSocket.abort();
+        m_startTime = 0;
+        m_state = ReceiveState::ID;
+        m_window.statusBar()->showMessage(
+            "Connection to remote host timed out");
+    }
+}
+
 bool Graph::SendData(std::string_view buf) {
     uint64_t count = 0;
 
@@ -474,8 +741,8 @@ bool Graph::RecvData(void* data, size_t length) {
     int64_t received = 0;
 
     while (count < length) {
-        received =
-            m_dataSocket.read(reinterpret_cast<char*>(data), length - count);
+        received = m_dataSocket.read(reinterpret_cast<char*>(data) + count,
+                                     length - count);
         if (m_dataSocket.state() != QAbstractSocket::ConnectedState ||
             received < 0) {
             return false;
@@ -487,6 +754,669 @@ bool Graph::RecvData(void* data, size_t length) {
     return true;
 }
 
+void Graph::HandleExtendedPacket() {
+    // Unknown extended packets are ignored so newer hosts can talk to older
+    // clients
+    switch (m_clientExtendedPacket.ID) {
+        case k_clientStatsPacket:
+            ShowStats(m_clientExtendedPacket.payload);
+            break;
+        case k_clientTimeSyncPacket:
+            HandleTimeSync(m_clientExtendedPacket.payload);
+            break;
+        case k_clientDatasetAddedPacket:
+            HandleDatasetAdded(m_clientExtendedPacket.payload);
+            break;
+        case k_clientHelloPacket:
+            HandleHello(m_clientExtendedPacket.payload);
+            break;
+        case k_clientDatasetRemovedPacket:
+            HandleDatasetRemoved(m_clientExtendedPacket.payload);
+            break;
+        case k_clientBandwidthPacket:
+            ShowBandwidth(m_clientExtendedPacket.payload);
+            break;
+        case k_clientSessionPacket:
+            HandleSession(m_clientExtendedPacket.payload);
+            break;
+        case k_clientSequencePacket:
+            HandleSequence(m_clientExtendedPacket.payload);
+            break;
+        case k_clientHeartbeatPacket:
+            // Receiving it already showed the host is alive
+            break;
+        case k_clientCapturePacket:
+            HandleCapture(m_clientExtendedPacket.payload);
+            break;
+        case k_clientRangePacket:
+            HandleRange(m_clientExtendedPacket.payload);
+            break;
+    }
+}
+
+/**
+ * Returns the smallest value that falls in the given bucket of a host latency
+ * histogram.
+ *
+ * @param bucket        The bucket index.
+ * @param subBucketBits The number of bits of precision of each bucket.
+ */
+static uint64_t BucketLowerBound(uint64_t bucket, uint8_t subBucketBits) {
+    uint64_t subBuckets = uint64_t{1} << subBucketBits;
+    if (bucket < subBuckets) {
+        return bucket;
+    }
+
+    uint64_t shift = bucket / subBuckets - 1;
+    uint64_t mantissa = subBuckets + bucket % subBuckets;
+    return mantissa << shift;
+}
+
+void Graph::ShowStats(std::string_view payload) {
+    size_t pos = 0;
+    bool valid = true;
+
+    // Reads a big-endian integer from the payload, or returns zero and marks
+    // the payload invalid if it's too short
+    auto read = [&](auto value) {
+        using T = decltype(value);
+        if (pos + sizeof(T) > payload.size()) {
+            valid = false;
+            return T{0};
+        }
+        value = qFromBigEndian<T>(payload.data() + pos);
+        pos += sizeof(T);
+        return value;
+    };
+
+    auto subBucketBits = read(quint8{});
+    auto histogramCount = read(quint16{});
+
+    std::string text;
+    for (quint16 i = 0; i < histogramCount && valid; ++i) {
+        auto kind = read(quint8{});
+        auto index = read(quint8{});
+        auto flags = read(quint8{});
+        auto count = read(quint64{});
+        auto sum = read(quint64{});
+        auto max = read(quint64{});
+        auto bucketCount = read(quint16{});
+
+        // Find the buckets containing the median and 99th percentile. Their
+        // upper bounds are reported so latency is never underestimated.
+        std::optional<uint64_t> p50;
+        std::optional<uint64_t> p99;
+        uint64_t seen = 0;
+        for (quint16 j = 0; j < bucketCount && valid; ++j) {
+            auto bucket = read(quint16{});
+            seen += read(quint64{});
+
+            uint64_t upper = std::min<uint64_t>(
+                BucketLowerBound(bucket + 1, subBucketBits) - 1, max);
+            if (!p50 && seen * 100 >= count * 50) {
+                p50 = upper;
+            }
+            if (!p99 && seen * 100 >= count * 99) {
+                p99 = upper;
+            }
+        }
+
+        std::string label;
+        if (kind == k_statsConnectionHistogram) {
+            label = fmt::format("Connection {}{}", index,
+                                flags & k_statsRequesterFlag ? " (this client)"
+                                                             : "");
+        } else if (kind == k_statsDatasetHistogram) {
+            auto name = m_graphNames.find(index);
+            label = name != m_graphNames.end() ? name->second
+                                               : fmt::format("Graph {}", index);
+        } else {
+            continue;
+        }
+
+        text += fmt::format(
+            "{}: {} samples, mean {:.2f} ms, p50 {:.2f} ms, p99 {:.2f} ms, "
+            "max {:.2f} ms\n",
+            label, count, count > 0 ? sum / 1000.0 / count : 0.0,
+            p50.value_or(0) / 1000.0, p99.value_or(0) / 1000.0, max / 1000.0);
+    }
+
+    if (!valid) {
+        QMessageBox::critical(&m_window, "Host Statistics",
+                              "Received malformed statistics from host");
+        return;
+    }
+    if (text.empty()) {
+        text = "No samples have been sent yet";
+    }
+
+    QMessageBox::information(&m_window, "Host Latency (AddData to send)",
+                             QString::fromStdString(text));
+}
+
+void Graph::ShowBandwidth(std::string_view payload) {
+    size_t pos = 0;
+    bool valid = true;
+
+    // Reads a big-endian integer from the payload, or returns zero and marks
+    // the payload invalid if it's too short
+    auto read = [&](auto value) {
+        using T = decltype(value);
+        if (pos + sizeof(T) > payload.size()) {
+            valid = false;
+            return T{0};
+        }
+        value = qFromBigEndian<T>(payload.data() + pos);
+        pos += sizeof(T);
+        return value;
+    };
+
+    // Priority classes in the order the host numbers them
+    static constexpr const char* k_priorityNames[] = {"Critical", "Normal",
+                                                      "Low"};
+    constexpr uint8_t k_normalPriority = 1;
+    auto priorityName = [](uint8_t priority) -> std::string {
+        if (priority < std::size(k_priorityNames)) {
+            return k_priorityNames[priority];
+        }
+        return fmt::format("Priority {}", priority);
+    };
+
+    auto formatLimit = [](uint64_t limit) -> std::string {
+        if (limit == 0) {
+            return "unlimited";
+        }
+        return fmt::format("{:.1f} kB/s", limit / 1000.0);
+    };
+
+    auto totalLimit = read(quint64{});
+    auto clientLimit = read(quint64{});
+
+    std::string text =
+        fmt::format("Total budget: {}\nThis client's budget: {}\n\n",
+                    formatLimit(totalLimit), formatLimit(clientLimit));
+
+    auto priorityCount = read(quint8{});
+    for (quint8 i = 0; i < priorityCount && valid; ++i) {
+        auto queued = read(quint64{});
+        auto shed = read(quint64{});
+        uint64_t total = queued + shed;
+        text += fmt::format("{}: {} samples sent, {} shed ({:.1f}%)\n",
+                            priorityName(i), queued, shed,
+                            total > 0 ? 100.0 * shed / total : 0.0);
+    }
+
+    // Only datasets that don't have the default priority are listed
+    std::string datasets;
+    auto datasetCount = read(quint8{});
+    for (quint8 i = 0; i < datasetCount && valid; ++i) {
+        auto id = read(quint8{});
+        auto priority = read(quint8{});
+        if (priority == k_normalPriority) {
+            continue;
+        }
+
+        auto name = m_graphNames.find(id);
+        datasets += fmt::format(
+            "{}: {}\n",
+            name != m_graphNames.end() ? name->second
+                                       : fmt::format("Graph {}", id),
+            priorityName(priority));
+    }
+    if (!datasets.empty()) {
+        text += "\n" + datasets;
+    }
+
+    if (!valid) {
+        QMessageBox::critical(&m_window, "Bandwidth Allocation",
+                              "Received malformed bandwidth report from host");
+        return;
+    }
+
+    QMessageBox::information(&m_window, "Bandwidth Allocation",
+                             QString::fromStdString(text));
+}
+
+void Graph::HandleHello(std::string_view payload) {
+    if (payload.size() < 2) {
+        return;
+    }
+
+    // The host responds with the capabilities both ends support, which are
+    // in effect from the next packet on
+    uint8_t capabilities = payload[1];
+    m_nativeSamples = capabilities & k_capNativeSamples;
+    m_customClock = capabilities & k_capCustomClock;
+    m_helloReceived = true;
+
+    uint8_t version = payload[0];
+    m_hostHeartbeats = version >= k_heartbeatProtocolVersion;
+    m_hostRanges = version >= k_rangeProtocolVersion;
+
+    // Ask to be told about datasets registered after the list is sent
+    char packet[1 + sizeof(uint32_t)] = {
+        static_cast<char>(k_hostCatalogSubscribePacket), 0, 0, 0, 0};
+    if (!SendData({packet, sizeof(packet)})) {
+        std::cerr << "LiveGrapher: Graph::HandleHello(): send failed\n";
+        return;
+    }
+
+    if (!SendFlushPolicy()) {
+        std::cerr << "LiveGrapher: Graph::HandleHello(): send failed\n";
+        return;
+    }
+
+    // Hosts that understand resume requests answer them before sending the
+    // dataset list
+    if (version >= k_resumeProtocolVersion && !SendResume()) {
+        std::cerr << "LiveGrapher: Graph::HandleHello(): send failed\n";
+        return;
+    }
+
+    SendTimeSync();
+}
+
+bool Graph::SendFlushPolicy() {
+    // Extended packet containing the queue size in bytes and the delay in
+    // microseconds after which the host sends queued data
+    char packet[1 + sizeof(uint32_t) + 2 * sizeof(uint32_t)];
+    packet[0] = static_cast<char>(k_hostFlushPolicyPacket);
+    qToBigEndian<quint32>(2 * sizeof(uint32_t), packet + 1);
+    qToBigEndian<quint32>(m_settings.GetInt("flushSize"),
+                          packet + 1 + sizeof(uint32_t));
+    qToBigEndian<quint32>(m_settings.GetInt("flushDelay"),
+                          packet + 1 + 2 * sizeof(uint32_t));
+
+    return SendData({packet, sizeof(packet)});
+}
+
+bool Graph::SendResume() {
+    // Extended packet containing the session token and the sequence number of
+    // the first sample that may have been missed
+    char packet[1 + sizeof(uint32_t) + 2 * sizeof(uint64_t)];
+    packet[0] = static_cast<char>(k_hostResumePacket);
+    qToBigEndian<quint32>(2 * sizeof(uint64_t), packet + 1);
+    qToBigEndian<quint64>(m_sessionToken, packet + 1 + sizeof(uint32_t));
+    qToBigEndian<quint64>(m_nextSequence,
+                          packet + 1 + sizeof(uint32_t) + sizeof(uint64_t));
+
+    m_sessionPending = SendData({packet, sizeof(packet)});
+    return m_sessionPending;
+}
+
+void Graph::HandleSession(std::string_view payload) {
+    if (payload.size() != 3 * sizeof(uint64_t) + sizeof(uint8_t)) {
+        return;
+    }
+
+    m_sessionToken = qFromBigEndian<quint64>(payload.data());
+    uint8_t status = payload[8];
+    m_resumedSelection = qFromBigEndian<quint64>(payload.data() + 9);
+    m_nextSequence = qFromBigEndian<quint64>(payload.data() + 17);
+
+    m_sessionPending = false;
+    m_sessionResumed = status != k_sessionNew;
+
+    if (status == k_sessionResumedWithLoss) {
+        m_window.statusBar()->showMessage(
+            "Some samples sent while disconnected were lost", 5000);
+    }
+
+    if (m_listReceived) {
+        FinishDatasetList();
+    }
+}
+
+void Graph::HandleSequence(std::string_view payload) {
+    if (payload.size() != sizeof(uint64_t)) {
+        return;
+    }
+
+    // Every sample before the marker was received since TCP is in order
+    m_nextSequence = qFromBigEndian<quint64>(payload.data());
+}
+
+void Graph::FinishDatasetList() {
+    // A resumed session keeps the host's dataset selection, so the graphs
+    // continue where they left off as long as the datasets didn't change
+    if (m_sessionResumed && m_oldGraphNames == m_graphNames &&
+        m_window.plot->graphCount() > 0) {
+        m_sessionResumed = false;
+        m_curSelect = m_resumedSelection;
+        m_startTime = m_sessionStartTime;
+        return;
+    }
+    m_sessionResumed = false;
+
+    // If list of graph names changed, clear the checkbox states. Otherwise,
+    // retain the old states for user convenience.
+    if (m_oldGraphNames != m_graphNames) {
+        m_curSelect = 0;
+    }
+
+    // Allow user to select which datasets to receive
+    SelectDatasets();
+}
+
+void Graph::HandleTimeSync(std::string_view payload) {
+    if (payload.size() != 3 * sizeof(int64_t)) {
+        return;
+    }
+
+    // NTP-style exchange: t0 and t3 are the local transmit and receive times,
+    // and t1 and t2 are the host's receive and transmit times
+    int64_t t0 = qFromBigEndian<qint64>(payload.data());
+    int64_t t1 = qFromBigEndian<qint64>(payload.data() + 8);
+    int64_t t2 = qFromBigEndian<qint64>(payload.data() + 16);
+    int64_t t3 = LocalTime();
+
+    ClockSample sample;
+    sample.offset = ((t1 - t0) + (t2 - t3)) / 2;
+    sample.roundTripTime = (t3 - t0) - (t2 - t1);
+
+    // Keep the last 8 exchanges (8 seconds)
+    m_clockSamples.push_back(sample);
+    if (m_clockSamples.size() > 8) {
+        m_clockSamples.pop_front();
+    }
+
+    m_clock = *std::min_element(
+        m_clockSamples.begin(), m_clockSamples.end(),
+        [](const auto& lhs, const auto& rhs) {
+            return lhs.roundTripTime < rhs.roundTripTime;
+        });
+
+    UpdateLatencyReadout();
+}
+
+void Graph::HandleDatasetAdded(std::string_view payload) {
+    if (payload.empty()) {
+        return;
+    }
+
+    uint8_t id = GraphID(payload[0]);
+    std::string name{payload.substr(1)};
+
+    // If the graphs for the current list exist, the new dataset's graph is
+    // added to them. Otherwise, it's created with the rest once the user makes
+    // their selection.
+    bool graphsCreated = m_window.plot->graphCount() > 0 &&
+                         m_oldGraphNames == m_graphNames;
+
+    m_graphNames[id] = name;
+
+    if (graphsCreated) {
+        m_oldGraphNames = m_graphNames;
+
+        if (id < m_window.plot->graphCount()) {
+            // The ID belonged to a dataset the host unregistered, so its graph
+            // is reused
+            m_datasets[id].clear();
+            auto graph = m_window.plot->graph(id);
+            graph->data()->clear();
+            graph->setName(QString::fromStdString(name));
+        } else {
+            // Graph indices are graph IDs, so unnamed graphs fill any gap
+            for (uint32_t i = m_window.plot->graphCount(); i <= id; ++i) {
+                auto graphName = m_graphNames.find(i);
+                CreateGraph(graphName != m_graphNames.end() ? graphName->second
+                                                            : "",
+                            GraphColor(i));
+                m_window.plot->graph(i)->removeFromLegend();
+            }
+        }
+    }
+
+    m_window.statusBar()->showMessage(
+        QString::fromStdString(fmt::format(
+            "New dataset \"{}\" can be selected from Host > Select Datasets",
+            name)),
+        5000);
+}
+
+void Graph::HandleDatasetRemoved(std::string_view payload) {
+    if (payload.empty()) {
+        return;
+    }
+
+    uint8_t id = GraphID(payload[0]);
+    auto entry = m_graphNames.find(id);
+    if (entry == m_graphNames.end()) {
+        return;
+    }
+    std::string name = entry->second;
+
+    bool graphsCreated = m_window.plot->graphCount() > 0 &&
+                         m_oldGraphNames == m_graphNames;
+
+    // The host already stopped sending the dataset's samples, and its ID may
+    // be reused for a different dataset later
+    m_graphNames.erase(entry);
+    m_curSelect &= ~(1ULL << id);
+
+    if (graphsCreated) {
+        m_oldGraphNames = m_graphNames;
+
+        if (id < m_window.plot->graphCount()) {
+            m_datasets[id].clear();
+            auto graph = m_window.plot->graph(id);
+            graph->data()->clear();
+            graph->setName("");
+            graph->removeFromLegend();
+            m_window.plot->replot();
+        }
+    }
+
+    m_window.statusBar()->showMessage(
+        QString::fromStdString(
+            fmt::format("Dataset \"{}\" was removed by the host", name)),
+        5000);
+}
+
+void Graph::HandleCapture(std::string_view payload) {
+    constexpr size_t headerSize = 1 + sizeof(uint64_t);
+    constexpr size_t sampleSize = 1 + sizeof(uint64_t) + sizeof(uint32_t);
+    if (payload.size() < headerSize ||
+        (payload.size() - headerSize) % sampleSize != 0) {
+        return;
+    }
+
+    // Samples are only placed on the time axis once it has a start time
+    if (m_startTime == 0) {
+        return;
+    }
+
+    uint8_t triggerID = GraphID(payload[0]);
+    size_t sampleCount = 0;
+    for (size_t i = headerSize; i < payload.size(); i += sampleSize) {
+        uint8_t id = GraphID(payload[i]);
+        if (id >= m_datasets.size() || !(m_curSelect & (1ULL << id))) {
+            continue;
+        }
+
+        // Capture times are in microseconds, while the time axis starts at
+        // the first data packet's time in milliseconds
+        auto time = qFromBigEndian<quint64>(payload.data() + i + 1);
+        quint32 bits = qFromBigEndian<quint32>(
+            payload.data() + i + 1 + sizeof(uint64_t));
+        float y;
+        std::memcpy(&y, &bits, sizeof(y));
+        double x = (static_cast<double>(time) / 1000.0 - m_startTime) / 1000.0;
+
+        AddData(id, static_cast<float>(x), y);
+        ++sampleCount;
+    }
+
+    auto name = m_graphNames.find(triggerID);
+    m_window.statusBar()->showMessage(
+        QString::fromStdString(fmt::format(
+            "Trigger on \"{}\" captured {} samples",
+            name != m_graphNames.end() ? name->second : "unknown dataset",
+            sampleCount)),
+        5000);
+}
+
+void Graph::HandleRange(std::string_view payload) {
+    constexpr size_t headerSize = 1 + 2 * sizeof(int64_t);
+    constexpr size_t sampleSize = sizeof(uint64_t) + sizeof(uint32_t);
+    if (payload.empty()) {
+        return;
+    }
+    uint8_t id = GraphID(payload[0]);
+
+    // Once the host finished answering a range request, the next dataset is
+    // requested
+    auto requestNext = [&] {
+        m_rangePending.reset();
+        if (!SendNextRange()) {
+            QMessageBox::critical(&m_window, "Connection Error",
+                                  "Requesting samples from remote host failed");
+        }
+    };
+
+    // A packet with only the graph ID says the host couldn't send the
+    // dataset's samples
+    if (payload.size() == 1) {
+        if (m_rangePending == id) {
+            ++m_rangeUnavailable;
+            requestNext();
+        }
+        return;
+    }
+
+    if (payload.size() < headerSize ||
+        (payload.size() - headerSize) % sampleSize != 0) {
+        return;
+    }
+
+    // The packet covers whole host milliseconds from first through last, so
+    // the points received in them are replaced. Keys are computed like data
+    // packets' so the received points are matched exactly.
+    auto first = qFromBigEndian<qint64>(payload.data() + 1);
+    auto last = qFromBigEndian<qint64>(payload.data() + 1 + sizeof(int64_t));
+
+    // The response is complete once a packet reaches the last millisecond of
+    // the range
+    bool complete = m_rangePending == id && last >= m_rangeLast;
+
+    if (m_startTime == 0 || id >= m_datasets.size() ||
+        static_cast<int>(id) >= m_window.plot->graphCount()) {
+        if (complete) {
+            requestNext();
+        }
+        return;
+    }
+    float begin = static_cast<qint64>(first - m_startTime) / 1000.f;
+    float end = static_cast<qint64>(last + 1 - m_startTime) / 1000.f;
+
+    auto& dataset = m_datasets[id];
+    dataset.erase(dataset.lower_bound(begin), dataset.lower_bound(end));
+
+    auto graph = m_window.plot->graph(id);
+    graph->data()->remove(
+        begin, std::nextafter(static_cast<double>(end),
+                              -std::numeric_limits<double>::infinity()));
+
+    // Sample times are in microseconds
+    QVector<double> keys;
+    QVector<double> values;
+    for (size_t i = headerSize; i < payload.size(); i += sampleSize) {
+        auto time = qFromBigEndian<quint64>(payload.data() + i);
+        quint32 bits = qFromBigEndian<quint32>(payload.data() + i +
+                                               sizeof(uint64_t));
+        float y;
+        std::memcpy(&y, &bits, sizeof(y));
+        auto x = static_cast<float>(
+            (static_cast<double>(time) / 1000.0 - m_startTime) / 1000.0);
+
+        dataset.emplace(x, y);
+        keys.append(x);
+        values.append(y);
+    }
+    graph->addData(keys, values, true);
+    m_window.plot->replot(QCustomPlot::rpQueuedReplot);
+
+    m_rangeSamples += keys.size();
+    if (complete) {
+        requestNext();
+    } else {
+        m_window.statusBar()->showMessage(
+            QString::fromStdString(fmt::format(
+                "Fetching samples at full resolution ({} so far)",
+                m_rangeSamples)),
+            5000);
+    }
+}
+
+bool Graph::SendNextRange() {
+    if (m_rangeQueue.empty()) {
+        std::string message = fmt::format(
+            "Fetched {} samples at full resolution", m_rangeSamples);
+        if (m_rangeUnavailable > 0) {
+            message += fmt::format("; {} datasets weren't retained",
+                                   m_rangeUnavailable);
+        }
+        m_window.statusBar()->showMessage(QString::fromStdString(message),
+                                          5000);
+        return true;
+    }
+
+    uint8_t id = m_rangeQueue.front();
+    m_rangeQueue.pop_front();
+
+    // Extended packet containing the graph ID and the first and last
+    // millisecond of the range
+    constexpr size_t payloadSize = 1 + 2 * sizeof(int64_t);
+    char packet[1 + sizeof(uint32_t) + payloadSize];
+    packet[0] = static_cast<char>(k_hostRangePacket);
+    qToBigEndian<quint32>(payloadSize, packet + 1);
+    packet[1 + sizeof(uint32_t)] = static_cast<char>(id);
+    qToBigEndian<qint64>(m_rangeFirst, packet + 2 + sizeof(uint32_t));
+    qToBigEndian<qint64>(m_rangeLast,
+                         packet + 2 + sizeof(uint32_t) + sizeof(int64_t));
+
+    if (!SendData({packet, sizeof(packet)})) {
+        m_rangeQueue.clear();
+        return false;
+    }
+
+    m_rangePending = id;
+    return true;
+}
+
+void Graph::UpdateLatencyReadout() {
+    std::string text;
+    if (m_customClock) {
+        text = "Latency: unavailable with the host's custom clock";
+    } else if (m_latencyCount > 0) {
+        text = fmt::format("Latency: mean {:.1f} ms, max {:.1f} ms",
+                           m_latencySum / 1000.0 / m_latencyCount,
+                           m_latencyMax / 1000.0);
+    } else {
+        text = "Latency: no samples";
+    }
+    if (m_clock) {
+        text += fmt::format(" | RTT: {:.1f} ms | Host clock offset: {:.1f} ms",
+                            m_clock->roundTripTime / 1000.0,
+                            m_clock->offset / 1000.0);
+    }
+
+    m_window.statusBar()->showMessage(QString::fromStdString(text));
+
+    m_latencySum = 0;
+    m_latencyMax = 0;
+    m_latencyCount = 0;
+}
+
+int64_t Graph::LocalTime() {
+    using std::chrono::duration_cast;
+    using std::chrono::microseconds;
+    using std::chrono::steady_clock;
+
+    return duration_cast<microseconds>(steady_clock::now().time_since_epoch())
+        .count();
+}
+
 std::string Graph::GenerateFilename() {
     // Get the current date/time as a string. ISO 8601 format is roughly
     // YYYY-MM-DDTHH:mm:ss.
@@ -4,8 +4,10 @@
 
 #include <stdint.h>
 
+#include <deque>
 #include <map>
 #include <mutex>
+#include <optional>
 #include <string>
 #include <string_view>
 #include <vector>
@@ -14,6 +16,7 @@
 #include <QHostAddress>
 #include <QObject>
 #include <QTcpSocket>
+#include <QTimer>
 
 #include "Protocol.hpp"
 #include "Settings.hpp"
@@ -24,8 +27,11 @@ enum class ReceiveState {
     NameLength,
     Name,
     EndOfFile,
+    ExtendedLength,
+    ExtendedPayload,
     DataComplete,
-    ListComplete
+    ListComplete,
+    ExtendedComplete
 };
 
 class MainWindow;
@@ -104,11 +110,59 @@ public slots:
      */
     bool SaveAsCSV();
 
+    /**
+     * Asks the host for its latency statistics. They're displayed when the
+     * response arrives.
+     *
+     * @return True on success.
+     */
+    bool RequestStats();
+
+    /**
+     * Asks the host for its bandwidth budget and how many samples of each
+     * priority class it shed. They're displayed when the response arrives.
+     *
+     * @return True on success.
+     */
+    bool RequestBandwidth();
+
+    /**
+     * Asks the host for every retained sample of the selected datasets over
+     * the visible time range. They replace the decimated samples in that range
+     * as they arrive.
+     *
+     * One dataset is requested at a time, and the next one once the host
+     * finished answering for the previous one.
+     *
+     * @return True on success.
+     */
+    bool FetchFullResolution();
+
+    /**
+     * Lets the user select which datasets to receive.
+     */
+    void SelectDatasets();
+
 private slots:
     void HandleSocketData();
     void SendGraphChoices();
 
+    /**
+     * Sends a time sync request to the host.
+     */
+    void SendTimeSync();
+
+    /**
+     * Disconnects from a host that sends heartbeats if nothing was received
+     * from it for k_heartbeatTimeout.
+     */
+    void CheckHeartbeat();
+
 private:
+    // Time in microseconds without receiving anything from a host that sends
+    // heartbeats after which the connection is assumed dead
+    static constexpr int64_t k_heartbeatTimeout = 5'000'000;
+
     MainWindow& m_window;
 
     Settings m_settings{"IPSettings.txt"};
@@ -131,9 +185,90 @@ private:
 
     uint64_t m_startTime = 0;
 
+    // True once the host responded to the hello packet. Extended packets are
+    // only sent to hosts that understand them.
+    bool m_helloReceived = false;
+
+    // True if data packets are ClientNativeDataPackets
+    bool m_nativeSamples = false;
+
+    // True if the host timestamps samples with its own clock, like a
+    // simulation's, so their latency can't be measured
+    bool m_customClock = false;
+
+    // True if the host sends heartbeats while it has nothing else to send
+    bool m_hostHeartbeats = false;
+
+    // True if the host understands range requests
+    bool m_hostRanges = false;
+
+    // Number of samples received in response to the last range requests
+    size_t m_rangeSamples = 0;
+
+    // Graph IDs of the datasets whose range requests haven't been sent yet
+    std::deque<uint8_t> m_rangeQueue;
+
+    // Graph ID of the dataset whose range request was sent and whose response
+    // hasn't completely arrived yet, if any
+    std::optional<uint8_t> m_rangePending;
+
+    // First and last host millisecond of the range being fetched
+    int64_t m_rangeFirst = 0;
+    int64_t m_rangeLast = 0;
+
+    // Number of datasets whose samples the host couldn't send
+    size_t m_rangeUnavailable = 0;
+
+    // Local time in microseconds at which data was last received
+    int64_t m_lastReceiveTime = 0;
+
+    // Token of the host session to resume after a reconnect, or zero if there
+    // isn't one
+    uint64_t m_sessionToken = 0;
+
+    // Host sequence number of the first sample not yet known to be received
+    uint64_t m_nextSequence = 0;
+
+    // Start time of the session's plot, restored when the session resumes
+    uint64_t m_sessionStartTime = 0;
+
+    // True while waiting for the host's response to a resume request. The
+    // dataset selection is deferred until then since a resumed session already
+    // has one.
+    bool m_sessionPending = false;
+
+    // True once the last name of the dataset list was received
+    bool m_listReceived = false;
+
+    // True if the host resumed the previous session
+    bool m_sessionResumed = false;
+    uint64_t m_resumedSelection = 0;
+
+    QTimer m_timeSyncTimer{this};
+
+    struct ClockSample {
+        // Host steady clock minus local steady clock in microseconds
+        int64_t offset;
+
+        // Round-trip time in microseconds excluding the host's processing time
+        int64_t roundTripTime;
+    };
+
+    // The most recent time sync exchanges. The one with the shortest
+    // round-trip time has the least uncertainty in its offset, so it's used.
+    std::deque<ClockSample> m_clockSamples;
+    std::optional<ClockSample> m_clock;
+
+    // Sample-to-screen latency since the last latency readout update in
+    // microseconds
+    int64_t m_latencySum = 0;
+    int64_t m_latencyMax = 0;
+    int64_t m_latencyCount = 0;
+
     HostPacket m_hostPacket;
     ClientDataPacket m_clientDataPacket;
     ClientListPacket m_clientListPacket;
+    ClientExtendedPacket m_clientExtendedPacket;
     ReceiveState m_state = ReceiveState::ID;
 
     /**
@@ -144,6 +279,14 @@ private:
      */
     bool SendData(std::string_view buf);
 
+    /**
+     * Sends a hello packet to the host and resets the state negotiated by the
+     * previous one.
+     *
+     * @return True on success.
+     */
+    bool SendHello();
+
     /**
      * Receives block of data from host.
      *
@@ -154,6 +297,125 @@ private:
      */
     bool RecvData(void* data, size_t length);
 
+    /**
+     * Handles a completely received extended packet.
+     */
+    void HandleExtendedPacket();
+
+    /**
+     * Displays the latency histograms in a stats packet.
+     *
+     * @param payload The stats packet payload.
+     */
+    void ShowStats(std::string_view payload);
+
+    /**
+     * Displays the bandwidth allocation in a bandwidth packet.
+     *
+     * @param payload The bandwidth packet payload.
+     */
+    void ShowBandwidth(std::string_view payload);
+
+    /**
+     * Applies the capabilities in the host's hello response and starts using
+     * the extended packets that require them.
+     *
+     * @param payload The hello packet payload.
+     */
+    void HandleHello(std::string_view payload);
+
+    /**
+     * Sends the flush policy from the settings file to the host.
+     *
+     * @return True on success.
+     */
+    bool SendFlushPolicy();
+
+    /**
+     * Sends a request to resume the previous session to the host, or to start
+     * a new one if there isn't one.
+     *
+     * @return True on success.
+     */
+    bool SendResume();
+
+    /**
+     * Records the session the host started or resumed and finishes the dataset
+     * selection if the list was already received.
+     *
+     * @param payload The session packet payload.
+     */
+    void HandleSession(std::string_view payload);
+
+    /**
+     * Records the sequence number in a sequence marker.
+     *
+     * @param payload The sequence marker packet payload.
+     */
+    void HandleSequence(std::string_view payload);
+
+    /**
+     * Lets the user select datasets once the list is received, unless the
+     * host resumed a session with the same datasets.
+     */
+    void FinishDatasetList();
+
+    /**
+     * Updates the clock offset estimate with a time sync response.
+     *
+     * @param payload The time sync packet payload.
+     */
+    void HandleTimeSync(std::string_view payload);
+
+    /**
+     * Adds a dataset the host announced after the list was received.
+     *
+     * @param payload The dataset added packet payload.
+     */
+    void HandleDatasetAdded(std::string_view payload);
+
+    /**
+     * Removes a dataset the host unregistered and clears its graph.
+     *
+     * @param payload The dataset removed packet payload.
+     */
+    void HandleDatasetRemoved(std::string_view payload);
+
+    /**
+     * Adds the full-resolution samples of a trigger capture to the graphs
+     * among the decimated samples already received.
+     *
+     * @param payload The capture packet payload.
+     */
+    void HandleCapture(std::string_view payload);
+
+    /**
+     * Replaces the samples of a dataset in a time range with the retained
+     * samples the host sent for it.
+     *
+     * @param payload The range packet payload.
+     */
+    void HandleRange(std::string_view payload);
+
+    /**
+     * Sends the range request of the next dataset waiting for one, or shows
+     * the result in the status bar if there are none left.
+     *
+     * @return True on success.
+     */
+    bool SendNextRange();
+
+    /**
+     * Shows the sample-to-screen latency since the last update and the clock
+     * estimate in the status bar.
+     */
+    void UpdateLatencyReadout();
+
+    /**
+     * Returns the local steady clock's time in microseconds.
+     */
+    static int64_t LocalTime();
+
     /**
      * Extract the packet type from the ID field of a received client packet.
      *
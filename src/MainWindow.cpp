@@ -106,6 +106,29 @@ MainWindow::MainWindow(QWidget* parent) : QMainWindow(parent) {
             SLOT(SaveAsCSV()));
     menuFile->addAction(actionSave_As_CSV);
 
+    auto menuHost = menuBar()->addMenu("Host");
+
+    auto actionSelect_Datasets = new QAction("Select Datasets", this);
+    connect(actionSelect_Datasets, SIGNAL(triggered()), &m_graph,
+            SLOT(SelectDatasets()));
+    menuHost->addAction(actionSelect_Datasets);
+
+    auto actionLatency_Statistics = new QAction("Latency Statistics", this);
+    connect(actionLatency_Statistics, SIGNAL(triggered()), &m_graph,
+            SLOT(RequestStats()));
+    menuHost->addAction(actionLatency_Statistics);
+
+    auto actionBandwidth_Allocation = new QAction("Bandwidth Allocation", this);
+    connect(actionBandwidth_Allocation, SIGNAL(triggered()), &m_graph,
+            SLOT(RequestBandwidth()));
+    menuHost->addAction(actionBandwidth_Allocation);
+
+    auto actionFetch_Full_Resolution =
+        new QAction("Fetch Full Resolution", this);
+    connect(actionFetch_Full_Resolution, SIGNAL(triggered()), &m_graph,
+            SLOT(FetchFullResolution()));
+    menuHost->addAction(actionFetch_Full_Resolution);
+
     auto menuAbout = menuBar()->addMenu("Help");
 
     auto actionAbout = new QAction("About LiveGrapher", this);
@@ -24,6 +24,37 @@ struct [[gnu::packed]] HostPacket {
 constexpr uint8_t k_hostConnectPacket = 0b00 << 6;
 constexpr uint8_t k_hostDisconnectPacket = 0b01 << 6;
 constexpr uint8_t k_hostListPacket = 0b10 << 6;
+constexpr uint8_t k_hostExtendedPacket = 0b11 << 6;
+
+// Extended host packets. The six low-order bits of an extended packet's ID
+// select its type instead of a graph ID, and the ID is followed by a uint32_t
+// payload length and the payload.
+constexpr uint8_t k_hostStatsPacket = k_hostExtendedPacket | 0;
+constexpr uint8_t k_hostTimeSyncPacket = k_hostExtendedPacket | 1;
+constexpr uint8_t k_hostCatalogSubscribePacket = k_hostExtendedPacket | 2;
+constexpr uint8_t k_hostBandwidthPacket = k_hostExtendedPacket | 3;
+constexpr uint8_t k_hostResumePacket = k_hostExtendedPacket | 4;
+constexpr uint8_t k_hostFlushPolicyPacket = k_hostExtendedPacket | 5;
+constexpr uint8_t k_hostRangePacket = k_hostExtendedPacket | 6;
+
+// The hello packet is the exception to extended packet framing. It's followed
+// by a version byte and a capabilities byte, and the two high-order bits of all
+// three bytes are set, so hosts that predate it ignore it.
+constexpr uint8_t k_hostHelloPacket = k_hostExtendedPacket | 0x3F;
+
+// Protocol version sent in hello packets (6 bits). Hosts that respond with
+// version 2 or later understand resume requests, hosts that respond with
+// version 3 or later send heartbeats, and hosts that respond with version 4 or
+// later understand range requests.
+constexpr uint8_t k_protocolVersion = 4;
+constexpr uint8_t k_resumeProtocolVersion = 2;
+constexpr uint8_t k_heartbeatProtocolVersion = 3;
+constexpr uint8_t k_rangeProtocolVersion = 4;
+
+// Capability flags sent in hello packets (6 bits). Hosts only respond with
+// k_capCustomClock if their sample times aren't on the clock time sync uses.
+constexpr uint8_t k_capNativeSamples = 1 << 0;
+constexpr uint8_t k_capCustomClock = 1 << 1;
 
 #ifdef _WIN32
 #pragma pack(push, 1)
@@ -41,6 +72,19 @@ struct [[gnu::packed]] ClientDataPacket {
 };
 #endif
 
+// Data packet sent when k_capNativeSamples is in effect. Fields are in
+// little-endian byte order and naturally aligned relative to the start of the
+// packet.
+struct ClientNativeDataPacket {
+    uint8_t ID;
+    uint8_t padding[3];
+    float y;
+    uint64_t x;
+};
+
+static_assert(sizeof(ClientNativeDataPacket) == 16,
+              "ClientNativeDataPacket has unexpected padding");
+
 struct ClientListPacket {
     uint8_t ID;
     uint8_t length;
@@ -48,5 +92,37 @@ struct ClientListPacket {
     uint8_t eof;
 };
 
+struct ClientExtendedPacket {
+    uint8_t ID;
+    uint32_t length;
+    std::string payload;
+};
+
 constexpr uint8_t k_clientDataPacket = 0b00 << 6;
 constexpr uint8_t k_clientListPacket = 0b01 << 6;
+constexpr uint8_t k_clientExtendedPacket = 0b11 << 6;
+
+// Extended client packets
+constexpr uint8_t k_clientStatsPacket = k_clientExtendedPacket | 0;
+constexpr uint8_t k_clientTimeSyncPacket = k_clientExtendedPacket | 1;
+constexpr uint8_t k_clientDatasetAddedPacket = k_clientExtendedPacket | 2;
+constexpr uint8_t k_clientHelloPacket = k_clientExtendedPacket | 3;
+constexpr uint8_t k_clientDatasetRemovedPacket = k_clientExtendedPacket | 4;
+constexpr uint8_t k_clientBandwidthPacket = k_clientExtendedPacket | 5;
+constexpr uint8_t k_clientSessionPacket = k_clientExtendedPacket | 6;
+constexpr uint8_t k_clientSequencePacket = k_clientExtendedPacket | 7;
+constexpr uint8_t k_clientHeartbeatPacket = k_clientExtendedPacket | 8;
+constexpr uint8_t k_clientCapturePacket = k_clientExtendedPacket | 9;
+constexpr uint8_t k_clientRangePacket = k_clientExtendedPacket | 10;
+
+// Session packet statuses
+constexpr uint8_t k_sessionNew = 0;
+constexpr uint8_t k_sessionResumed = 1;
+constexpr uint8_t k_sessionResumedWithLoss = 2;
+
+// Kinds of histograms in a stats packet
+constexpr uint8_t k_statsConnectionHistogram = 0;
+constexpr uint8_t k_statsDatasetHistogram = 1;
+
+// Stats packet histogram flag set on the requesting connection's histogram
+constexpr uint8_t k_statsRequesterFlag = 1 << 0;
@@ -0,0 +1,795 @@
+// Copyright (c) 2020 FRC Team 3512. All Rights Reserved.
+
+// Microbenchmarks for the host's ingest and send paths.
+//
+// Usage: LiveGrapherBench [--filter <substring>] [--json <file>]
+//                         [--port <port>]
+//
+// Each benchmark reports nanoseconds and bytes per operation. On Linux, the
+// cycles, instructions, and cache misses per operation are also reported if
+// perf_event_open(2) is permitted (see /proc/sys/kernel/perf_event_paranoid).
+// Counters only cover user space and the benchmark's own thread.
+//
+// --json writes the results as a JSON array so runs can be diffed to find
+// regressions. --port sets the port used by benchmarks that need a listening
+// host (default: 3520).
+
+#include <stdint.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "livegrapher/ClientConnection.hpp"
+#include "livegrapher/LiveGrapher.hpp"
+#include "livegrapher/Protocol.hpp"
+#include "livegrapher/SocketSelector.hpp"
+#include "livegrapher/TcpListener.hpp"
+#include "livegrapher/TcpSocket.hpp"
+
+using namespace std::chrono_literals;
+using Clock = std::chrono::steady_clock;
+
+/**
+ * Prevents the compiler from optimizing away the computation of a value.
+ *
+ * @param value The value.
+ */
+template <typename T>
+void DoNotOptimize(const T& value) {
+#if defined(__GNUC__) || defined(__clang__)
+    asm volatile("" : : "r,m"(value) : "memory");
+#else
+    static volatile const T* sink;
+    sink = &value;
+#endif
+}
+
+/**
+ * Hardware performance counters for the calling thread.
+ *
+ * If the counters can't be opened, Available() returns false and the counts
+ * are zero.
+ */
+class PerfCounters {
+public:
+    enum Counter { kCycles, kInstructions, kCacheMisses, kNumCounters };
+
+    PerfCounters() {
+#ifdef __linux__
+        constexpr uint64_t configs[kNumCounters] = {
+            PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+            PERF_COUNT_HW_CACHE_MISSES};
+
+        for (int i = 0; i < kNumCounters; ++i) {
+            perf_event_attr attr;
+            std::memset(&attr, 0, sizeof(attr));
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.size = sizeof(attr);
+            attr.config = configs[i];
+            attr.disabled = i == 0;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            attr.read_format = PERF_FORMAT_GROUP;
+
+            // The first counter leads the group so all of them are enabled
+            // and disabled together
+            int fd = syscall(SYS_perf_event_open, &attr, 0, -1,
+                             i == 0 ? -1 : m_fds[0], 0);
+            if (fd == -1) {
+                Close();
+                return;
+            }
+            m_fds[i] = fd;
+        }
+#endif
+    }
+
+    ~PerfCounters() { Close(); }
+
+    PerfCounters(const PerfCounters&) = delete;
+    PerfCounters& operator=(const PerfCounters&) = delete;
+
+    /**
+     * Returns true if the counters could be opened.
+     */
+    bool Available() const { return m_fds[0] != -1; }
+
+    /**
+     * Resets the counts to zero.
+     */
+    void Reset() {
+#ifdef __linux__
+        if (Available()) {
+            ioctl(m_fds[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+        }
+#endif
+    }
+
+    /**
+     * Starts counting.
+     */
+    void Start() {
+#ifdef __linux__
+        if (Available()) {
+            ioctl(m_fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+        }
+#endif
+    }
+
+    /**
+     * Stops counting.
+     */
+    void Stop() {
+#ifdef __linux__
+        if (Available()) {
+            ioctl(m_fds[0], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+        }
+#endif
+    }
+
+    /**
+     * Returns the counts accumulated since the last Reset().
+     */
+    std::vector<uint64_t> Read() const {
+        std::vector<uint64_t> counts(kNumCounters, 0);
+#ifdef __linux__
+        if (Available()) {
+            // The group read format is the number of counters followed by
+            // each count
+            uint64_t buf[1 + kNumCounters];
+            if (read(m_fds[0], buf, sizeof(buf)) == sizeof(buf)) {
+                std::copy(buf + 1, buf + 1 + kNumCounters, counts.begin());
+            }
+        }
+#endif
+        return counts;
+    }
+
+private:
+    int m_fds[kNumCounters] = {-1, -1, -1};
+
+    void Close() {
+#ifdef __linux__
+        for (auto& fd : m_fds) {
+            if (fd != -1) {
+                close(fd);
+                fd = -1;
+            }
+        }
+#endif
+    }
+};
+
+/**
+ * Timing state passed to each benchmark.
+ */
+class State {
+public:
+    State(uint64_t iterations, PerfCounters& perf)
+        : m_iterations{iterations}, m_perf{perf} {}
+
+    /**
+     * Returns the number of operations the benchmark should perform.
+     */
+    uint64_t Iterations() const { return m_iterations; }
+
+    /**
+     * Starts timing. Called by the runner.
+     */
+    void Start() {
+        m_perf.Reset();
+        ResumeTiming();
+    }
+
+    /**
+     * Stops timing. Called by the runner.
+     */
+    void Stop() { PauseTiming(); }
+
+    /**
+     * Excludes the following code from the measurement.
+     */
+    void PauseTiming() {
+        if (m_running) {
+            m_perf.Stop();
+            m_elapsed += Clock::now() - m_startTime;
+            m_running = false;
+        }
+    }
+
+    /**
+     * Includes the following code in the measurement again.
+     */
+    void ResumeTiming() {
+        if (!m_running) {
+            m_running = true;
+            m_startTime = Clock::now();
+            m_perf.Start();
+        }
+    }
+
+    /**
+     * Overrides the measured time, for benchmarks that measure across threads.
+     *
+     * @param elapsed The total time taken by all operations.
+     */
+    void SetElapsed(Clock::duration elapsed) { m_manualElapsed = elapsed; }
+
+    /**
+     * Adds to the number of bytes processed.
+     *
+     * @param bytes The number of bytes.
+     */
+    void AddBytes(uint64_t bytes) { m_bytes += bytes; }
+
+    /**
+     * Reports an extra named result.
+     *
+     * @param name  The name of the result.
+     * @param value The value of the result.
+     */
+    void SetCounter(const std::string& name, double value) {
+        m_counters[name] = value;
+    }
+
+    Clock::duration Elapsed() const {
+        return m_manualElapsed.count() > 0 ? m_manualElapsed : m_elapsed;
+    }
+
+    uint64_t Bytes() const { return m_bytes; }
+
+    const std::map<std::string, double>& Counters() const { return m_counters; }
+
+private:
+    uint64_t m_iterations;
+    PerfCounters& m_perf;
+
+    bool m_running = false;
+    Clock::time_point m_startTime;
+    Clock::duration m_elapsed{0};
+    Clock::duration m_manualElapsed{0};
+    uint64_t m_bytes = 0;
+    std::map<std::string, double> m_counters;
+};
+
+struct Benchmark {
+    std::string name;
+    std::function<void(State&)> function;
+
+    // Number of iterations to run, or 0 to calibrate automatically
+    uint64_t iterations;
+};
+
+struct Result {
+    std::string name;
+    uint64_t iterations;
+    double nsPerOp;
+    double bytesPerOp;
+    bool hasPerf;
+    std::vector<double> perfPerOp;
+    std::map<std::string, double> counters;
+};
+
+/**
+ * Runs a benchmark, calibrating the number of iterations so the measurement
+ * takes a reasonable amount of time.
+ *
+ * @param benchmark The benchmark.
+ * @param perf      The performance counters.
+ */
+Result Run(const Benchmark& benchmark, PerfCounters& perf) {
+    constexpr auto kMinTime = 200ms;
+
+    uint64_t iterations = benchmark.iterations > 0 ? benchmark.iterations : 1;
+    while (true) {
+        State state{iterations, perf};
+        state.Start();
+        benchmark.function(state);
+        state.Stop();
+
+        auto elapsed = state.Elapsed();
+        if (benchmark.iterations > 0 || elapsed >= kMinTime ||
+            iterations >= 1'000'000'000) {
+            Result result;
+            result.name = benchmark.name;
+            result.iterations = iterations;
+            result.nsPerOp =
+                std::chrono::duration<double, std::nano>(elapsed).count() /
+                iterations;
+            result.bytesPerOp = static_cast<double>(state.Bytes()) / iterations;
+            result.hasPerf = perf.Available();
+            for (auto count : perf.Read()) {
+                result.perfPerOp.push_back(static_cast<double>(count) /
+                                           iterations);
+            }
+            result.counters = state.Counters();
+            return result;
+        }
+
+        // Grow the iteration count toward the minimum time, at most tenfold
+        // per attempt in case the first measurement was noisy
+        double scale =
+            elapsed.count() > 0
+                ? 1.2 * std::chrono::duration<double>(kMinTime).count() /
+                      std::chrono::duration<double>(elapsed).count()
+                : 10.0;
+        iterations = static_cast<uint64_t>(
+            iterations * std::clamp(scale, 2.0, 10.0));
+    }
+}
+
+/**
+ * A connected pair of TCP sockets on the loopback interface.
+ */
+struct SocketPair {
+    TcpSocket server;
+    TcpSocket client;
+
+    explicit SocketPair(uint16_t port) {
+        TcpListener listener{port};
+        if (!client.Connect("127.0.0.1", port)) {
+            throw std::runtime_error("failed to connect to benchmark listener");
+        }
+        server = listener.Accept();
+    }
+};
+
+/**
+ * Reads and discards everything sent to a set of sockets on a background
+ * thread, like a client that keeps up with the host.
+ */
+class Drain {
+public:
+    explicit Drain(std::vector<TcpSocket>& sockets) : m_sockets{sockets} {
+        for (auto& socket : m_sockets) {
+            socket.SetBlocking(false);
+            m_selector.Add(socket, SocketSelector::kRead);
+        }
+        m_thread = std::thread([this] { ThreadMain(); });
+    }
+
+    ~Drain() {
+        m_isRunning = false;
+        m_selector.Cancel();
+        m_thread.join();
+    }
+
+private:
+    std::vector<TcpSocket>& m_sockets;
+    SocketSelector m_selector;
+    std::atomic<bool> m_isRunning{true};
+    std::thread m_thread;
+
+    void ThreadMain() {
+        std::vector<char> buf(65536);
+        while (m_isRunning) {
+            if (!m_selector.Select()) {
+                continue;
+            }
+            for (auto& socket : m_sockets) {
+                if (m_selector.IsReadReady(socket)) {
+                    socket.ReadAvailable(buf.data(), buf.size());
+                }
+            }
+        }
+    }
+};
+
+/**
+ * A LiveGrapher host with a number of connected clients that drain everything
+ * sent to them.
+ */
+class HostFixture {
+public:
+    /**
+     * Constructs a HostFixture.
+     *
+     * @param port      The port on which the host listens.
+     * @param clients   The number of clients to connect.
+     * @param subscribe Whether the clients subscribe to the benchmark dataset.
+     */
+    HostFixture(uint16_t port, int clients, bool subscribe)
+        : grapher{std::make_unique<LiveGrapher>(port)} {
+        // Register the dataset so it has graph ID 0
+        grapher->AddData("bench", 0.f);
+
+        for (int i = 0; i < clients; ++i) {
+            m_clients.emplace_back();
+            if (!m_clients.back().Connect("127.0.0.1", port)) {
+                throw std::runtime_error("failed to connect to host");
+            }
+            if (subscribe) {
+                char packet = kHostConnectPacket | 0;
+                m_clients.back().WriteBlocking({&packet, 1});
+            }
+        }
+
+        // Wait for the host to accept the clients and process their requests
+        while (grapher->GetStats().clients.size() <
+               static_cast<size_t>(clients)) {
+            std::this_thread::sleep_for(1ms);
+        }
+        std::this_thread::sleep_for(50ms);
+
+        m_drain = std::make_unique<Drain>(m_clients);
+    }
+
+    ~HostFixture() {
+        // Stop the host before the clients so it doesn't see them disconnect
+        grapher.reset();
+        m_drain.reset();
+    }
+
+    std::unique_ptr<LiveGrapher> grapher;
+
+private:
+    std::vector<TcpSocket> m_clients;
+    std::unique_ptr<Drain> m_drain;
+};
+
+/**
+ * Registers all benchmarks.
+ *
+ * @param port The port used by benchmarks that need a listening host.
+ */
+std::vector<Benchmark> MakeBenchmarks(uint16_t port) {
+    std::vector<Benchmark> benchmarks;
+
+    benchmarks.push_back({"HostToNetwork64",
+                          [](State& state) {
+                              for (uint64_t i = 0; i < state.Iterations();
+                                   ++i) {
+                                  DoNotOptimize(HostToNetwork64(i));
+                              }
+                          },
+                          0});
+
+    benchmarks.push_back({"MakeClientDataPacket",
+                          [](State& state) {
+                              for (uint64_t i = 0; i < state.Iterations();
+                                   ++i) {
+                                  auto packet = MakeClientDataPacket(
+                                      i & 0x3F, i, static_cast<float>(i));
+                                  DoNotOptimize(packet);
+                              }
+                              state.AddBytes(state.Iterations() *
+                                             sizeof(ClientDataPacket));
+                          },
+                          0});
+
+    benchmarks.push_back({"MakeClientNativeDataPacket",
+                          [](State& state) {
+                              for (uint64_t i = 0; i < state.Iterations();
+                                   ++i) {
+                                  auto packet = MakeClientNativeDataPacket(
+                                      i & 0x3F, i, static_cast<float>(i));
+                                  DoNotOptimize(packet);
+                              }
+                              state.AddBytes(state.Iterations() *
+                                             sizeof(ClientNativeDataPacket));
+                          },
+                          0});
+
+    struct HostCase {
+        const char* name;
+        int clients;
+        bool subscribe;
+    };
+    for (const auto& host :
+         {HostCase{"LiveGrapher::AddData/clients:0", 0, false},
+          HostCase{"LiveGrapher::AddData/clients:1/unsubscribed", 1, false},
+          HostCase{"LiveGrapher::AddData/clients:1/subscribed", 1, true},
+          HostCase{"LiveGrapher::AddData/clients:8/unsubscribed", 8, false},
+          HostCase{"LiveGrapher::AddData/clients:8/subscribed", 8, true}}) {
+        benchmarks.push_back(
+            {host.name,
+             [=](State& state) {
+                 state.PauseTiming();
+                 HostFixture fixture{port, host.clients, host.subscribe};
+                 auto before = fixture.grapher->GetStats();
+                 state.ResumeTiming();
+
+                 for (uint64_t i = 0; i < state.Iterations(); ++i) {
+                     fixture.grapher->AddData("bench",
+                                              static_cast<float>(i));
+                 }
+
+                 state.PauseTiming();
+
+                 // Bytes are counted once they've been sent or queued
+                 auto after = fixture.grapher->GetStats();
+                 for (size_t i = 0; i < after.clients.size(); ++i) {
+                     state.AddBytes(after.clients[i].bytesSent +
+                                    after.clients[i].bytesQueued -
+                                    before.clients[i].bytesSent -
+                                    before.clients[i].bytesQueued);
+                 }
+             },
+             0});
+    }
+
+    // Iterations are samples, so these compare directly with the AddData()
+    // benchmarks above
+    for (int clients : {0, 1}) {
+        benchmarks.push_back(
+            {"LiveGrapher::AddData/bulk:64/clients:" + std::to_string(clients) +
+                 (clients > 0 ? "/subscribed" : ""),
+             [=](State& state) {
+                 state.PauseTiming();
+                 HostFixture fixture{port, clients, true};
+                 std::vector<LiveGrapher::Sample> batch(64);
+                 auto before = fixture.grapher->GetStats();
+                 state.ResumeTiming();
+
+                 for (uint64_t i = 0; i < state.Iterations();
+                      i += batch.size()) {
+                     size_t count = std::min<uint64_t>(batch.size(),
+                                                       state.Iterations() - i);
+                     auto now = fixture.grapher->Now();
+                     for (size_t j = 0; j < count; ++j) {
+                         batch[j] = {now, static_cast<float>(i + j)};
+                     }
+                     fixture.grapher->AddData("bench", batch.data(), count);
+                 }
+
+                 state.PauseTiming();
+
+                 auto after = fixture.grapher->GetStats();
+                 for (size_t i = 0; i < after.clients.size(); ++i) {
+                     state.AddBytes(after.clients[i].bytesSent +
+                                    after.clients[i].bytesQueued -
+                                    before.clients[i].bytesSent -
+                                    before.clients[i].bytesQueued);
+                 }
+             },
+             0});
+    }
+
+    for (size_t backlog : {0, 1 << 10, 1 << 16, 1 << 20}) {
+        benchmarks.push_back(
+            {"ClientConnection::AddData/backlog:" + std::to_string(backlog),
+             [=](State& state) {
+                 auto packet = MakeClientDataPacket(0, 0, 0.f);
+                 std::string_view data{reinterpret_cast<char*>(&packet),
+                                       sizeof(packet)};
+
+                 auto refill = [&] {
+                     auto conn = std::make_unique<ClientConnection>(
+                         TcpSocket{});
+                     while (conn->BytesQueued() < backlog) {
+                         conn->AddData(data);
+                     }
+                     return conn;
+                 };
+
+                 state.PauseTiming();
+                 auto conn = refill();
+                 state.ResumeTiming();
+
+                 for (uint64_t i = 0; i < state.Iterations(); ++i) {
+                     conn->AddData(data);
+
+                     // Keep the backlog near the requested size
+                     if (conn->BytesQueued() > backlog + (1 << 20)) {
+                         state.PauseTiming();
+                         conn = refill();
+                         state.ResumeTiming();
+                     }
+                 }
+                 state.AddBytes(state.Iterations() * sizeof(packet));
+             },
+             0});
+    }
+
+    for (size_t backlog : {1 << 10, 1 << 16, 1 << 20}) {
+        benchmarks.push_back(
+            {"ClientConnection::WriteToSocket/backlog:" +
+                 std::to_string(backlog),
+             [=](State& state) {
+                 state.PauseTiming();
+                 SocketPair pair{port};
+                 pair.server.SetBlocking(false);
+                 ClientConnection conn{std::move(pair.server)};
+                 std::vector<TcpSocket> clients;
+                 clients.emplace_back(std::move(pair.client));
+                 Drain drain{clients};
+
+                 auto packet = MakeClientDataPacket(0, 0, 0.f);
+                 std::string_view data{reinterpret_cast<char*>(&packet),
+                                       sizeof(packet)};
+
+                 for (uint64_t i = 0; i < state.Iterations(); ++i) {
+                     while (conn.BytesQueued() < backlog) {
+                         conn.AddData(data);
+                     }
+
+                     uint64_t sent = conn.BytesSent();
+                     state.ResumeTiming();
+                     conn.WriteToSocket();
+                     state.PauseTiming();
+                     state.AddBytes(conn.BytesSent() - sent);
+                 }
+             },
+             0});
+    }
+
+    benchmarks.push_back(
+        {"SocketSelector::Select/wake",
+         [](State& state) {
+             state.PauseTiming();
+
+             SocketSelector selector;
+             std::atomic<bool> waiting{false};
+             std::atomic<bool> woken{false};
+             Clock::time_point wakeTime;
+             std::vector<Clock::duration> latencies;
+             latencies.reserve(state.Iterations());
+
+             std::thread waiter([&] {
+                 for (uint64_t i = 0; i < state.Iterations(); ++i) {
+                     waiting = true;
+                     selector.Select();
+                     wakeTime = Clock::now();
+                     woken = true;
+                     while (woken) {
+                         std::this_thread::yield();
+                     }
+                 }
+             });
+
+             for (uint64_t i = 0; i < state.Iterations(); ++i) {
+                 while (!waiting) {
+                     std::this_thread::yield();
+                 }
+                 waiting = false;
+
+                 // Give the waiter time to block in select()
+                 std::this_thread::sleep_for(100us);
+
+                 auto cancelTime = Clock::now();
+                 state.ResumeTiming();
+                 selector.Cancel();
+                 state.PauseTiming();
+
+                 while (!woken) {
+                     std::this_thread::yield();
+                 }
+                 latencies.push_back(wakeTime - cancelTime);
+                 woken = false;
+             }
+             waiter.join();
+
+             std::sort(latencies.begin(), latencies.end());
+             Clock::duration total{0};
+             for (auto latency : latencies) {
+                 total += latency;
+             }
+             state.SetElapsed(total);
+
+             auto percentile = [&](double p) {
+                 return std::chrono::duration<double, std::nano>(
+                            latencies[static_cast<size_t>(
+                                p * (latencies.size() - 1))])
+                     .count();
+             };
+             state.SetCounter("p50_ns", percentile(0.5));
+             state.SetCounter("p99_ns", percentile(0.99));
+         },
+         2000});
+
+    return benchmarks;
+}
+
+/**
+ * Writes the results as a JSON array.
+ *
+ * @param results The benchmark results.
+ * @param path    The path of the JSON file.
+ */
+void WriteJSON(const std::vector<Result>& results, const std::string& path) {
+    std::ofstream file{path, std::ofstream::trunc};
+    file << "[\n";
+    for (size_t i = 0; i < results.size(); ++i) {
+        const auto& result = results[i];
+        file << "  {\"name\": \"" << result.name
+             << "\", \"iterations\": " << result.iterations
+             << ", \"ns_per_op\": " << result.nsPerOp
+             << ", \"bytes_per_op\": " << result.bytesPerOp;
+        if (result.hasPerf) {
+            file << ", \"cycles_per_op\": "
+                 << result.perfPerOp[PerfCounters::kCycles]
+                 << ", \"instructions_per_op\": "
+                 << result.perfPerOp[PerfCounters::kInstructions]
+                 << ", \"cache_misses_per_op\": "
+                 << result.perfPerOp[PerfCounters::kCacheMisses];
+        }
+        for (const auto& [name, value] : result.counters) {
+            file << ", \"" << name << "\": " << value;
+        }
+        file << (i + 1 < results.size() ? "},\n" : "}\n");
+    }
+    file << "]\n";
+}
+
+int main(int argc, char* argv[]) {
+    std::string filter;
+    std::string jsonPath;
+    uint16_t port = 3520;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string_view arg = argv[i];
+        if (arg == "--filter" && i + 1 < argc) {
+            filter = argv[++i];
+        } else if (arg == "--json" && i + 1 < argc) {
+            jsonPath = argv[++i];
+        } else if (arg == "--port" && i + 1 < argc) {
+            port = static_cast<uint16_t>(std::atoi(argv[++i]));
+        } else {
+            std::cerr << "usage: " << argv[0]
+                      << " [--filter <substring>] [--json <file>] [--port "
+                         "<port>]\n";
+            return 1;
+        }
+    }
+
+    PerfCounters perf;
+    if (!perf.Available()) {
+        std::cerr << "Hardware performance counters unavailable\n";
+    }
+
+    std::printf("%-48s %12s %12s %10s %10s %10s %10s\n", "Benchmark",
+                "Iterations", "ns/op", "B/op", "cycles/op", "instr/op",
+                "misses/op");
+
+    std::vector<Result> results;
+    for (const auto& benchmark : MakeBenchmarks(port)) {
+        if (benchmark.name.find(filter) == std::string::npos) {
+            continue;
+        }
+
+        auto result = Run(benchmark, perf);
+        std::printf("%-48s %12llu %12.1f %10.1f", result.name.c_str(),
+                    static_cast<unsigned long long>(result.iterations),
+                    result.nsPerOp, result.bytesPerOp);
+        if (result.hasPerf) {
+            std::printf(" %10.1f %10.1f %10.2f",
+                        result.perfPerOp[PerfCounters::kCycles],
+                        result.perfPerOp[PerfCounters::kInstructions],
+                        result.perfPerOp[PerfCounters::kCacheMisses]);
+        } else {
+            std::printf(" %10s %10s %10s", "-", "-", "-");
+        }
+        for (const auto& [name, value] : result.counters) {
+            std::printf(" %s=%.1f", name.c_str(), value);
+        }
+        std::printf("\n");
+        std::fflush(stdout);
+
+        results.emplace_back(std::move(result));
+    }
+
+    if (!jsonPath.empty()) {
+        WriteJSON(results, jsonPath);
+    }
+}
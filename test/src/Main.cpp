@@ -1,6 +1,104 @@
 // Copyright (c) 2018-2020 FRC Team 3512. All Rights Reserved.
 
+// Load generator for measuring host and client throughput.
+//
+// Usage: LiveGrapherTest [options]
+//
+// Options:
+//   --port <port>        Port on which to listen for clients (default: 3513)
+//   --channels <count>   Number of datasets (default: 33)
+//   --rate <hz>          Samples per second per dataset, or 0 to send as fast
+//                        as possible (default: 100)
+//   --pattern <pattern>  Values to send: constant, ramp, noise, scurve,
+//                        trapezoid, or mixed (default: mixed)
+//   --threads <count>    Number of producer threads (default: 1)
+//   --duration <s>       Seconds to run for, or 0 to run forever (default: 0)
+//   --telemetry <ms>     Publish the host's telemetry datasets with the given
+//                        period, or 0 to disable them (default: 0)
+//   --deadband <value>   Only send samples that changed by more than the given
+//                        absolute deadband, plus a heartbeat every second
+//                        (default: disabled)
+//   --bandwidth <B/s>    Limit the bytes per second sent to all clients
+//                        combined. Datasets cycle through critical, normal,
+//                        and low priority. (default: unlimited)
+//   --resume <samples>   Retain the given number of samples so clients can
+//                        resume after a reconnect (default: disabled)
+//   --stall-timeout <ms> Disconnect clients that stop responding for the
+//                        given time, or 0 to never disconnect them
+//                        (default: 10000)
+//   --flush-size <bytes> Send queued data once this many bytes are queued, or
+//                        0 to only send at the flush deadline (default: 1400)
+//   --flush-delay <us>   Send queued data at the latest this long after it was
+//                        queued (default: 2000)
+//   --subscribers <n>    Number of in-process subscribers that receive every
+//                        dataset on their own thread (default: 0)
+//   --sink-delay <ms>    Add a sink that takes the given time to write each
+//                        block of samples (default: disabled)
+//   --time-scale <x>     Timestamp samples with a simulated clock that starts
+//                        at zero and runs the given times faster than real
+//                        time (default: disabled)
+//   --batch <samples>    Send each dataset's samples in batches of the given
+//                        size with the bulk AddData() overload (default: 1)
+//   --decimation <n>     Only stream every nth sample of each dataset to
+//                        clients (default: 1)
+//   --trigger <value>    Capture 50 ms before and after the first dataset
+//                        rises through the given value (default: disabled)
+//   --inline <ms>        Run the host's network work from Poll() calls on a
+//                        loop with the given period, like a robot loop,
+//                        instead of a network thread (default: disabled)
+//   --net-cpu <cpu>      Pin the network thread to the given CPU
+//                        (default: any CPU)
+//   --net-nice <level>   Run the network thread at the given nice level
+//                        (default: inherited)
+//   --net-fifo <prio>    Run the network thread with SCHED_FIFO at the given
+//                        priority (default: inherited)
+//   --jitter <ms>        Run a control loop with the given period and report
+//                        how late it wakes up (default: disabled)
+//   --loop-cpu <cpu>     Pin the control loop to the given CPU
+//                        (default: any CPU)
+//   --loop-fifo <prio>   Run the control loop with SCHED_FIFO at the given
+//                        priority (default: inherited)
+//   --external           Run the host inside a poll() event loop through its
+//                        embedding API instead of a network thread (POSIX
+//                        only, default: disabled)
+//
+// The mixed pattern cycles through S-curve profile, constant, and trapezoid
+// profile datasets, which reproduces the original fixed test host with the
+// default options.
+//
+// Once per second, the achieved ingest rate, the bytes sent to and queued for
+// each client, each client's 99th percentile send latency and samples shed by
+// the bandwidth budget, the samples received and dropped by each subscriber
+// and sink, the number of samples dropped and suppressed and trigger captures
+// completed by the host, the longest Poll() call of an inline host, and the
+// control loop's wake-up jitter are reported.
+//
+// Running the control loop with --jitter on the same CPU as the network thread
+// and then on a different one shows how much the network thread delays a
+// robot's control loop.
+
+#include <stdint.h>
+
+#ifndef _WIN32
+#include <poll.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <random>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <thread>
+#include <vector>
 
 #include "SCurveProfile.hpp"
 #include "TrapezoidProfile.hpp"
@@ -8,87 +106,150 @@
 
 using namespace std::chrono_literals;
 
-int main() {
-    LiveGrapher liveGrapher(3513);
+enum class Pattern { kConstant, kRamp, kNoise, kSCurve, kTrapezoid, kMixed };
 
-    double goal = 150.0;
-    SCurveProfile sProfile(91.26, 228.15);
-    TrapezoidProfile tProfile(91.26, 0.4);
-    sProfile.setGoal(0.0, goal);
-    tProfile.setGoal(0.0, goal);
+struct Channel {
+    std::string name;
+    Pattern pattern;
 
-    using clock = std::chrono::high_resolution_clock;
-    using std::chrono::duration_cast;
-    using std::chrono::milliseconds;
+    // Constant value or offset added to the pattern
+    float offset;
 
-    auto startTime =
-        duration_cast<milliseconds>(clock::now().time_since_epoch());
-    auto lastTime = startTime;
-    auto currentTime = startTime;
-    float curTime = 0.f;
-    float sSetpoint = 0.f;
-    float tSetpoint = 0.f;
+    // Multiplier applied to the pattern
+    float scale;
+};
 
-    sProfile.resetProfile();
-    tProfile.resetProfile();
-    while (1) {
-        currentTime =
-            duration_cast<milliseconds>(clock::now().time_since_epoch());
-        curTime = (currentTime.count() - startTime.count()) / 1000.f;
-        sSetpoint = static_cast<float>(sProfile.updateSetpoint(curTime));
-        tSetpoint = static_cast<float>(tProfile.updateSetpoint(curTime));
+/**
+ * Creates the datasets sent by the load generator.
+ *
+ * @param count   The number of datasets.
+ * @param pattern The pattern of values to send.
+ */
+std::vector<Channel> MakeChannels(int count, Pattern pattern) {
+    std::vector<Channel> channels;
 
-        if (currentTime - lastTime > 10ms) {
-            liveGrapher.AddData("SCurve SP", sSetpoint);
-            liveGrapher.AddData("Test", 0.f);
-            liveGrapher.AddData("TCurve SP", tSetpoint);
+    for (int i = 0; i < count; ++i) {
+        if (pattern == Pattern::kMixed) {
+            // Datasets are created in groups of three like the original test
+            // host: S-curve, constant, and trapezoid. Its profiles are
+            // unchanged in the first group, negated in the second, offset by
+            // 20 in the third, and mirrored about 20 after that, and its
+            // constants skip 1 and 3.
+            int group = i / 3 + 1;
+            std::string suffix = group == 1 ? "" : " " + std::to_string(group);
+            float offset = group <= 2 ? 0.f : 20.f;
+            float scale = group == 2 || group >= 4 ? -1.f : 1.f;
+            float constant = group <= 3 ? 2.f * (group - 1) : group + 1.f;
 
-            liveGrapher.AddData("SCurve SP 2", -sSetpoint);
-            liveGrapher.AddData("Test 2", 2.f);
-            liveGrapher.AddData("TCurve SP 2", -tSetpoint);
+            switch (i % 3) {
+                case 0:
+                    channels.push_back({"SCurve SP" + suffix, Pattern::kSCurve,
+                                        offset, scale});
+                    break;
+                case 1:
+                    channels.push_back({"Test" + suffix, Pattern::kConstant,
+                                        constant, 1.f});
+                    break;
+                case 2:
+                    channels.push_back({"TCurve SP" + suffix,
+                                        Pattern::kTrapezoid, offset, scale});
+                    break;
+            }
+        } else {
+            channels.push_back({"Channel " + std::to_string(i + 1), pattern,
+                                static_cast<float>(i), 1.f});
+        }
+    }
 
-            liveGrapher.AddData("SCurve SP 3", 20.f + sSetpoint);
-            liveGrapher.AddData("Test 3", 4.f);
-            liveGrapher.AddData("TCurve SP 3", 20.f + tSetpoint);
+    return channels;
+}
 
-            liveGrapher.AddData("SCurve SP 4", 20.f - sSetpoint);
-            liveGrapher.AddData("Test 4", 5.f);
-            liveGrapher.AddData("TCurve SP 4", 20.f - tSetpoint);
+/**
+ * Sends samples for a set of datasets at a fixed rate.
+ *
+ * @param grapher  The host.
+ * @param channels The datasets for which to send samples.
+ * @param rate     The samples per second per dataset, or 0 for as fast as
+ *                 possible.
+ * @param batch    The number of samples of each dataset sent per AddData()
+ *                 call.
+ * @param running  Set to false to stop.
+ */
+void Produce(LiveGrapher& grapher, std::vector<Channel> channels, double rate,
+             int batch, const std::atomic<bool>& running) {
+    using clock = std::chrono::steady_clock;
 
-            liveGrapher.AddData("SCurve SP 5", 20.f - sSetpoint);
-            liveGrapher.AddData("Test 5", 6.f);
-            liveGrapher.AddData("TCurve SP 5", 20.f - tSetpoint);
+    double goal = 150.0;
+    SCurveProfile sProfile(91.26, 228.15);
+    TrapezoidProfile tProfile(91.26, 0.4);
+    sProfile.setGoal(0.0, goal);
+    tProfile.setGoal(0.0, goal);
+    sProfile.resetProfile();
+    tProfile.resetProfile();
 
-            liveGrapher.AddData("SCurve SP 6", 20.f - sSetpoint);
-            liveGrapher.AddData("Test 6", 7.f);
-            liveGrapher.AddData("TCurve SP 6", 20.f - tSetpoint);
+    std::mt19937 generator{std::random_device{}()};
+    std::uniform_real_distribution<float> noise{-1.f, 1.f};
 
-            liveGrapher.AddData("SCurve SP 7", 20.f - sSetpoint);
-            liveGrapher.AddData("Test 7", 8.f);
-            liveGrapher.AddData("TCurve SP 7", 20.f - tSetpoint);
+    auto period = std::chrono::duration_cast<clock::duration>(
+        std::chrono::duration<double>(rate > 0.0 ? 1.0 / rate : 0.0));
 
-            liveGrapher.AddData("SCurve SP 8", 20.f - sSetpoint);
-            liveGrapher.AddData("Test 8", 9.f);
-            liveGrapher.AddData("TCurve SP 8", 20.f - tSetpoint);
+    auto startTime = clock::now();
+    auto profileStartTime = startTime;
+    auto nextTime = startTime;
 
-            liveGrapher.AddData("SCurve SP 9", 20.f - sSetpoint);
-            liveGrapher.AddData("Test 9", 10.f);
-            liveGrapher.AddData("TCurve SP 9", 20.f - tSetpoint);
+    // Samples of each dataset waiting to be sent as a batch
+    std::vector<std::vector<LiveGrapher::Sample>> pending(channels.size());
 
-            liveGrapher.AddData("SCurve SP 10", 20.f - sSetpoint);
-            liveGrapher.AddData("Test 10", 11.f);
-            liveGrapher.AddData("TCurve SP 10", 20.f - tSetpoint);
+    while (running) {
+        auto currentTime = clock::now();
+        float elapsed =
+            std::chrono::duration<float>(currentTime - startTime).count();
+        float curTime =
+            std::chrono::duration<float>(currentTime - profileStartTime)
+                .count();
 
-            liveGrapher.AddData("SCurve SP 11", 20.f - sSetpoint);
-            liveGrapher.AddData("Test 11", 12.f);
-            liveGrapher.AddData("TCurve SP 11", 20.f - tSetpoint);  // 33
+        float sSetpoint = static_cast<float>(sProfile.updateSetpoint(curTime));
+        float tSetpoint = static_cast<float>(tProfile.updateSetpoint(curTime));
+
+        auto sampleTime = grapher.Now();
+        for (size_t i = 0; i < channels.size(); ++i) {
+            const auto& channel = channels[i];
+            float value = 0.f;
+            switch (channel.pattern) {
+                case Pattern::kConstant:
+                    value = 0.f;
+                    break;
+                case Pattern::kRamp:
+                    // Sawtooth from 0 to 100 with a period of one second
+                    value = 100.f * (elapsed - std::floor(elapsed));
+                    break;
+                case Pattern::kNoise:
+                    value = noise(generator);
+                    break;
+                case Pattern::kSCurve:
+                    value = sSetpoint;
+                    break;
+                case Pattern::kTrapezoid:
+                case Pattern::kMixed:
+                    value = tSetpoint;
+                    break;
+            }
+            value = channel.offset + channel.scale * value;
 
-            lastTime = currentTime;
+            if (batch == 1) {
+                grapher.AddData(channel.name, value);
+            } else {
+                pending[i].push_back({sampleTime, value});
+                if (pending[i].size() == static_cast<size_t>(batch)) {
+                    grapher.AddData(channel.name, pending[i].data(),
+                                    pending[i].size());
+                    pending[i].clear();
+                }
+            }
         }
 
         if (tProfile.atGoal()) {
-            startTime =
-                duration_cast<milliseconds>(clock::now().time_since_epoch());
+            profileStartTime = clock::now();
 
             if (sProfile.getGoal() == goal) {
                 sProfile.setGoal(curTime, 0.0, sProfile.getGoal());
@@ -99,6 +260,613 @@ int main() {
             }
         }
 
-        std::this_thread::sleep_for(5ms);
+        if (rate > 0.0) {
+            // Sleeping until an absolute time keeps the rate from drifting.
+            // If the producer falls behind, it catches up without sleeping.
+            nextTime += period;
+            std::this_thread::sleep_until(nextTime);
+        }
+    }
+
+    for (size_t i = 0; i < channels.size(); ++i) {
+        grapher.AddData(channels[i].name, pending[i].data(),
+                        pending[i].size());
+    }
+}
+
+/**
+ * Calls Poll() on an inline host at a fixed period, like a robot loop.
+ *
+ * @param grapher  The host.
+ * @param period   The time between calls.
+ * @param running  Set to false to stop.
+ * @param pollTime Raised to the duration of the longest call in microseconds.
+ */
+void PollLoop(LiveGrapher& grapher, std::chrono::milliseconds period,
+              const std::atomic<bool>& running,
+              std::atomic<int64_t>& pollTime) {
+    auto nextTime = std::chrono::steady_clock::now();
+    while (running) {
+        auto start = std::chrono::steady_clock::now();
+        grapher.Poll();
+        int64_t elapsed =
+            std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now() - start)
+                .count();
+
+        int64_t longest = pollTime.load(std::memory_order_relaxed);
+        while (elapsed > longest &&
+               !pollTime.compare_exchange_weak(longest, elapsed,
+                                               std::memory_order_relaxed)) {
+        }
+
+        nextTime += period;
+        std::this_thread::sleep_until(nextTime);
+    }
+}
+
+#ifndef _WIN32
+/**
+ * A minimal poll() event loop that stands in for an application's own event
+ * loop running an external host.
+ */
+class EventLoop {
+public:
+    /**
+     * Constructs an event loop for the given host.
+     *
+     * @param grapher A host constructed with Threading::kExternal.
+     */
+    explicit EventLoop(LiveGrapher& grapher) : m_grapher{grapher} {
+        if (pipe(m_wakeFds) == -1) {
+            throw std::system_error(errno, std::system_category(),
+                                    "EventLoop");
+        }
+
+        // The application's event loop already has a way to be woken up from
+        // other threads, which the host reuses. Wakeups are coalesced until
+        // the loop handles them.
+        m_grapher.SetWakeCallback([this] {
+            if (!m_wakePending.exchange(true)) {
+                [[maybe_unused]] auto count = write(m_wakeFds[1], "", 1);
+            }
+        });
+    }
+
+    ~EventLoop() {
+        m_grapher.SetWakeCallback(nullptr);
+        close(m_wakeFds[0]);
+        close(m_wakeFds[1]);
+    }
+
+    EventLoop(const EventLoop&) = delete;
+    EventLoop& operator=(const EventLoop&) = delete;
+
+    /**
+     * Runs the event loop.
+     *
+     * @param running Set to false to stop.
+     */
+    void Run(const std::atomic<bool>& running) {
+        using clock = std::chrono::steady_clock;
+
+        std::vector<pollfd> fds;
+        while (running) {
+            fds.clear();
+            fds.push_back({m_wakeFds[0], POLLIN, 0});
+            for (const auto& interest : m_grapher.Interests()) {
+                short events = interest.read ? POLLIN : 0;
+                if (interest.write) {
+                    events |= POLLOUT;
+                }
+                fds.push_back({interest.handle, events, 0});
+            }
+
+            // Wake up for the host's timer, rounding up so it's never early,
+            // and at least every 100 ms to check whether to stop
+            auto timeout = 100ms;
+            if (auto timerTime = m_grapher.NextTimerTime()) {
+                auto untilTimer =
+                    std::chrono::ceil<std::chrono::milliseconds>(
+                        timerTime.value() - clock::now());
+                timeout = std::clamp(untilTimer, 0ms, timeout);
+            }
+            if (poll(fds.data(), fds.size(), timeout.count()) == -1) {
+                continue;
+            }
+
+            if (fds[0].revents & POLLIN) {
+                char byte;
+                [[maybe_unused]] auto count = read(m_wakeFds[0], &byte, 1);
+                m_wakePending = false;
+                m_grapher.OnTimer();
+            }
+
+            for (size_t i = 1; i < fds.size(); ++i) {
+                if (fds[i].revents & (POLLIN | POLLERR | POLLHUP)) {
+                    m_grapher.OnReadable(fds[i].fd);
+                }
+                if (fds[i].revents & POLLOUT) {
+                    m_grapher.OnWritable(fds[i].fd);
+                }
+            }
+
+            auto timerTime = m_grapher.NextTimerTime();
+            if (timerTime && clock::now() >= timerTime.value()) {
+                m_grapher.OnTimer();
+            }
+        }
+    }
+
+private:
+    LiveGrapher& m_grapher;
+    int m_wakeFds[2];
+    std::atomic<bool> m_wakePending{false};
+};
+#endif
+
+/**
+ * Runs a periodic loop like a robot's control loop and records how late each
+ * iteration wakes up.
+ *
+ * @param period      The time between iterations.
+ * @param scheduling  The loop thread's scheduling settings.
+ * @param running     Set to false to stop.
+ * @param jitter      Records the wake-up lateness in microseconds.
+ * @param jitterMutex Guards jitter.
+ */
+void JitterLoop(std::chrono::milliseconds period, ThreadScheduling scheduling,
+                const std::atomic<bool>& running, LatencyHistogram& jitter,
+                std::mutex& jitterMutex) {
+    try {
+        SetThreadScheduling(scheduling);
+    } catch (const std::system_error& e) {
+        std::cerr << "control loop scheduling failed: " << e.what() << '\n';
+    }
+
+    auto nextTime = std::chrono::steady_clock::now() + period;
+    while (running) {
+        std::this_thread::sleep_until(nextTime);
+        auto lateness = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - nextTime);
+        {
+            std::scoped_lock lock(jitterMutex);
+            jitter.Record(std::max<int64_t>(lateness.count(), 0));
+        }
+        nextTime += period;
+    }
+}
+
+/**
+ * Receives samples from a subscriber until it's closed.
+ *
+ * @param subscriber The subscriber.
+ * @param received   Incremented by the number of samples received.
+ */
+void Consume(Subscriber& subscriber, std::atomic<uint64_t>& received) {
+    while (!subscriber.IsClosed()) {
+        auto block = subscriber.Wait(100ms);
+        received.fetch_add(block.size(), std::memory_order_relaxed);
+    }
+}
+
+/**
+ * A sink that simulates a slow destination like a file on an SD card.
+ */
+class SlowSink : public Sink {
+public:
+    /**
+     * Constructs a slow sink.
+     *
+     * @param delay The time taken to write each block.
+     */
+    explicit SlowSink(std::chrono::milliseconds delay) : m_delay{delay} {}
+
+    void Write(SampleBlock) override { std::this_thread::sleep_for(m_delay); }
+
+private:
+    std::chrono::milliseconds m_delay;
+};
+
+/**
+ * Parses a pattern name.
+ *
+ * @param name    The pattern name.
+ * @param pattern The parsed pattern.
+ * @return True if the name is valid.
+ */
+bool ParsePattern(std::string_view name, Pattern& pattern) {
+    if (name == "constant") {
+        pattern = Pattern::kConstant;
+    } else if (name == "ramp") {
+        pattern = Pattern::kRamp;
+    } else if (name == "noise") {
+        pattern = Pattern::kNoise;
+    } else if (name == "scurve") {
+        pattern = Pattern::kSCurve;
+    } else if (name == "trapezoid") {
+        pattern = Pattern::kTrapezoid;
+    } else if (name == "mixed") {
+        pattern = Pattern::kMixed;
+    } else {
+        return false;
     }
+
+    return true;
+}
+
+int main(int argc, char* argv[]) {
+    uint16_t port = 3513;
+    int channelCount = 33;
+    double rate = 100.0;
+    Pattern pattern = Pattern::kMixed;
+    int threadCount = 1;
+    double duration = 0.0;
+    int telemetryPeriod = 0;
+    double deadband = -1.0;
+    double bandwidth = 0.0;
+    int resumeCapacity = 0;
+    int stallTimeout = 10000;
+    int flushSize = 1400;
+    int flushDelay = 2000;
+    int subscriberCount = 0;
+    int sinkDelay = -1;
+    double timeScale = 0.0;
+    int batch = 1;
+    int decimation = 1;
+    std::optional<float> triggerThreshold;
+    int inlinePeriod = 0;
+    ThreadScheduling netScheduling;
+    int jitterPeriod = 0;
+    ThreadScheduling loopScheduling;
+    bool external = false;
+
+    bool valid = true;
+    for (int i = 1; i < argc && valid; ++i) {
+        std::string_view arg = argv[i];
+        if (arg == "--external") {
+#ifdef _WIN32
+            valid = false;
+#else
+            external = true;
+#endif
+        } else if (i + 1 == argc) {
+            // Every other option takes a value
+            valid = false;
+        } else if (arg == "--port") {
+            port = static_cast<uint16_t>(std::atoi(argv[++i]));
+        } else if (arg == "--channels") {
+            channelCount = std::atoi(argv[++i]);
+        } else if (arg == "--rate") {
+            rate = std::atof(argv[++i]);
+        } else if (arg == "--pattern") {
+            valid = ParsePattern(argv[++i], pattern);
+        } else if (arg == "--threads") {
+            threadCount = std::atoi(argv[++i]);
+        } else if (arg == "--duration") {
+            duration = std::atof(argv[++i]);
+        } else if (arg == "--telemetry") {
+            telemetryPeriod = std::atoi(argv[++i]);
+        } else if (arg == "--deadband") {
+            deadband = std::atof(argv[++i]);
+            valid = deadband >= 0.0;
+        } else if (arg == "--bandwidth") {
+            bandwidth = std::atof(argv[++i]);
+        } else if (arg == "--resume") {
+            resumeCapacity = std::atoi(argv[++i]);
+        } else if (arg == "--stall-timeout") {
+            stallTimeout = std::atoi(argv[++i]);
+        } else if (arg == "--flush-size") {
+            flushSize = std::atoi(argv[++i]);
+        } else if (arg == "--flush-delay") {
+            flushDelay = std::atoi(argv[++i]);
+        } else if (arg == "--subscribers") {
+            subscriberCount = std::atoi(argv[++i]);
+        } else if (arg == "--sink-delay") {
+            sinkDelay = std::atoi(argv[++i]);
+            valid = sinkDelay >= 0;
+        } else if (arg == "--time-scale") {
+            timeScale = std::atof(argv[++i]);
+            valid = timeScale > 0.0;
+        } else if (arg == "--batch") {
+            batch = std::atoi(argv[++i]);
+        } else if (arg == "--decimation") {
+            decimation = std::atoi(argv[++i]);
+        } else if (arg == "--trigger") {
+            triggerThreshold = static_cast<float>(std::atof(argv[++i]));
+        } else if (arg == "--inline") {
+            inlinePeriod = std::atoi(argv[++i]);
+            valid = inlinePeriod > 0;
+        } else if (arg == "--net-cpu" || arg == "--loop-cpu") {
+            int cpu = std::atoi(argv[++i]);
+            valid = cpu >= 0 && cpu < 64;
+            if (valid) {
+                auto& scheduling =
+                    arg == "--net-cpu" ? netScheduling : loopScheduling;
+                scheduling.affinity = uint64_t{1} << cpu;
+            }
+        } else if (arg == "--net-nice") {
+            netScheduling.policy = SchedulingPolicy::kOther;
+            netScheduling.nice = std::atoi(argv[++i]);
+        } else if (arg == "--net-fifo" || arg == "--loop-fifo") {
+            auto& scheduling =
+                arg == "--net-fifo" ? netScheduling : loopScheduling;
+            scheduling.policy = SchedulingPolicy::kFifo;
+            scheduling.priority = std::atoi(argv[++i]);
+            valid = scheduling.priority >= 1 && scheduling.priority <= 99;
+        } else if (arg == "--jitter") {
+            jitterPeriod = std::atoi(argv[++i]);
+            valid = jitterPeriod > 0;
+        } else {
+            valid = false;
+        }
+    }
+
+    // Graph IDs are 6 bits wide, so at most 64 datasets can exist
+    int maxChannels = 64;
+    if (telemetryPeriod > 0) {
+        maxChannels -= LiveGrapher::kTelemetryDatasets;
+    }
+
+    if (!valid || channelCount < 1 || channelCount > maxChannels ||
+        rate < 0.0 || threadCount < 1 || duration < 0.0 ||
+        telemetryPeriod < 0 || bandwidth < 0.0 || resumeCapacity < 0 ||
+        stallTimeout < 0 || flushSize < 0 || flushDelay < 0 ||
+        subscriberCount < 0 || batch < 1 || decimation < 1 ||
+        (external && inlinePeriod > 0)) {
+        std::cerr << "usage: " << argv[0]
+                  << " [--port <port>] [--channels <1-64>] [--rate <hz>]\n"
+                     "    [--pattern constant|ramp|noise|scurve|trapezoid|"
+                     "mixed]\n"
+                     "    [--threads <count>] [--duration <s>] "
+                     "[--telemetry <ms>]\n"
+                     "    [--deadband <value>] [--bandwidth <B/s>] "
+                     "[--resume <samples>]\n"
+                     "    [--stall-timeout <ms>] [--flush-size <bytes>] "
+                     "[--flush-delay <us>]\n"
+                     "    [--subscribers <count>] [--sink-delay <ms>]\n"
+                     "    [--time-scale <factor>] [--batch <samples>]\n"
+                     "    [--decimation <n>] [--trigger <value>] "
+                     "[--inline <ms>]\n"
+                     "    [--net-cpu <cpu>] [--net-nice <level>] "
+                     "[--net-fifo <1-99>]\n"
+                     "    [--jitter <ms>] [--loop-cpu <cpu>] "
+                     "[--loop-fifo <1-99>]\n"
+                     "    [--external]\n";
+        return 1;
+    }
+
+    auto threading = LiveGrapher::Threading::kThread;
+    if (inlinePeriod > 0) {
+        threading = LiveGrapher::Threading::kInline;
+    } else if (external) {
+        threading = LiveGrapher::Threading::kExternal;
+    }
+
+    std::optional<LiveGrapher> grapher;
+    try {
+        grapher.emplace(port, threading, netScheduling);
+    } catch (const std::system_error& e) {
+        // Binding the port or scheduling the network thread can fail
+        std::cerr << "failed to start the host: " << e.what() << '\n';
+        return 1;
+    }
+    LiveGrapher& liveGrapher = grapher.value();
+
+#ifndef _WIN32
+    // The wake callback is set before any samples are added
+    std::optional<EventLoop> eventLoop;
+    if (external) {
+        eventLoop.emplace(liveGrapher);
+    }
+#endif
+    if (timeScale > 0.0) {
+        auto simStartTime = std::chrono::steady_clock::now();
+        liveGrapher.SetClock([=] {
+            return std::chrono::duration_cast<std::chrono::milliseconds>(
+                (std::chrono::steady_clock::now() - simStartTime) * timeScale);
+        });
+    }
+    liveGrapher.SetStallTimeout(std::chrono::milliseconds{stallTimeout});
+    liveGrapher.SetFlushPolicy(flushSize,
+                               std::chrono::microseconds{flushDelay});
+    if (resumeCapacity > 0) {
+        liveGrapher.EnableResume(resumeCapacity);
+    }
+    if (telemetryPeriod > 0) {
+        liveGrapher.EnableTelemetry(std::chrono::milliseconds{telemetryPeriod});
+    }
+
+    auto channels = MakeChannels(channelCount, pattern);
+    if (deadband >= 0.0) {
+        for (const auto& channel : channels) {
+            liveGrapher.SetDeadband(channel.name, deadband);
+        }
+    }
+
+    if (decimation > 1) {
+        for (const auto& channel : channels) {
+            liveGrapher.SetDecimation(channel.name, decimation);
+        }
+    }
+
+    if (triggerThreshold) {
+        // The pre-trigger buffer holds at least the 100 ms of samples a
+        // capture spans
+        double capacity = rate > 0.0 ? 0.2 * rate * channels.size() : 1 << 20;
+        liveGrapher.EnableTriggers(
+            std::max<size_t>(static_cast<size_t>(capacity), 1024));
+        liveGrapher.AddTrigger(channels[0].name, TriggerCondition::kRising,
+                               triggerThreshold.value(), 50ms, 50ms);
+    }
+
+    if (bandwidth > 0.0) {
+        liveGrapher.SetBandwidthLimit(static_cast<uint64_t>(bandwidth));
+
+        constexpr LiveGrapher::Priority priorities[] = {
+            LiveGrapher::Priority::kCritical, LiveGrapher::Priority::kNormal,
+            LiveGrapher::Priority::kLow};
+        for (size_t i = 0; i < channels.size(); ++i) {
+            liveGrapher.SetPriority(channels[i].name, priorities[i % 3]);
+        }
+    }
+
+    std::vector<std::shared_ptr<Subscriber>> subscribers;
+    std::vector<std::atomic<uint64_t>> received(subscriberCount);
+    std::vector<std::thread> consumers;
+    for (int i = 0; i < subscriberCount; ++i) {
+        auto& subscriber = subscribers.emplace_back(liveGrapher.Subscribe());
+        subscriber->SelectAll(true);
+        consumers.emplace_back(Consume, std::ref(*subscriber),
+                               std::ref(received[i]));
+    }
+    std::vector<uint64_t> lastReceived(subscriberCount, 0);
+
+    if (sinkDelay >= 0) {
+        liveGrapher.AddSink(
+            std::make_shared<SlowSink>(std::chrono::milliseconds{sinkDelay}));
+    }
+
+    // Distribute the datasets round-robin between the producer threads
+    std::vector<std::vector<Channel>> threadChannels(threadCount);
+    for (size_t i = 0; i < channels.size(); ++i) {
+        threadChannels[i % threadCount].push_back(channels[i]);
+    }
+
+    std::atomic<bool> running{true};
+    std::vector<std::thread> producers;
+    for (auto& assigned : threadChannels) {
+        if (!assigned.empty()) {
+            producers.emplace_back(Produce, std::ref(liveGrapher), assigned,
+                                   rate, batch, std::cref(running));
+        }
+    }
+
+    std::atomic<int64_t> pollTime{0};
+    std::thread poller;
+    if (inlinePeriod > 0) {
+        poller = std::thread(PollLoop, std::ref(liveGrapher),
+                             std::chrono::milliseconds{inlinePeriod},
+                             std::cref(running), std::ref(pollTime));
+    }
+
+#ifndef _WIN32
+    std::thread eventLoopThread;
+    if (eventLoop) {
+        eventLoopThread = std::thread([&] { eventLoop->Run(running); });
+    }
+#endif
+
+    LatencyHistogram jitter;
+    std::mutex jitterMutex;
+    std::thread jitterLoop;
+    if (jitterPeriod > 0) {
+        jitterLoop = std::thread(JitterLoop,
+                                 std::chrono::milliseconds{jitterPeriod},
+                                 loopScheduling, std::cref(running),
+                                 std::ref(jitter), std::ref(jitterMutex));
+    }
+
+    using clock = std::chrono::steady_clock;
+    auto startTime = clock::now();
+    auto lastTime = startTime;
+    auto lastStats = liveGrapher.GetStats();
+    std::vector<uint64_t> lastBytesSent;
+
+    while (duration == 0.0 ||
+           clock::now() - startTime < std::chrono::duration<double>(duration)) {
+        std::this_thread::sleep_for(1s);
+
+        auto currentTime = clock::now();
+        auto stats = liveGrapher.GetStats();
+        double dt =
+            std::chrono::duration<double>(currentTime - lastTime).count();
+
+        std::cout << "ingest: "
+                  << (stats.samplesAdded - lastStats.samplesAdded) / dt
+                  << " samples/s, dropped: " << stats.samplesDropped
+                  << ", suppressed: " << stats.samplesSuppressed
+                  << ", evicted: " << stats.clientsEvicted
+                  << ", captures: " << stats.capturesCompleted;
+        if (inlinePeriod > 0) {
+            std::cout << ", poll max: " << pollTime.exchange(0) << " us";
+        }
+        std::cout << '\n';
+
+        if (jitterPeriod > 0) {
+            std::scoped_lock lock(jitterMutex);
+            std::cout << "  loop jitter: p50 " << jitter.Percentile(50.0)
+                      << " us, p99 " << jitter.Percentile(99.0) << " us, max "
+                      << jitter.Max() << " us\n";
+            jitter.Reset();
+        }
+
+        // Clients can connect and disconnect between reports, which shifts
+        // their indices. A client that sent fewer bytes than the one at its
+        // index last time is treated as new.
+        lastBytesSent.resize(stats.clients.size(), 0);
+        for (size_t i = 0; i < stats.clients.size(); ++i) {
+            const auto& client = stats.clients[i];
+            if (client.bytesSent < lastBytesSent[i]) {
+                lastBytesSent[i] = 0;
+            }
+            std::cout << "  client " << i << ": "
+                      << (client.bytesSent - lastBytesSent[i]) / dt
+                      << " B/s sent, " << client.bytesSent << " B total, "
+                      << client.bytesQueued << " B queued, p99 latency "
+                      << client.latency.Percentile(99.0)
+                      << " us, shed (critical/normal/low) "
+                      << client.samplesShed[0] << '/' << client.samplesShed[1]
+                      << '/' << client.samplesShed[2] << '\n';
+            lastBytesSent[i] = client.bytesSent;
+        }
+
+        for (size_t i = 0; i < subscribers.size(); ++i) {
+            uint64_t count = received[i].load(std::memory_order_relaxed);
+            std::cout << "  subscriber " << i << ": "
+                      << (count - lastReceived[i]) / dt
+                      << " samples/s received, "
+                      << subscribers[i]->SamplesDropped() << " dropped\n";
+            lastReceived[i] = count;
+        }
+
+        for (size_t i = 0; i < stats.sinkSamplesDropped.size(); ++i) {
+            std::cout << "  sink " << i << ": " << stats.sinkSamplesDropped[i]
+                      << " dropped\n";
+        }
+
+        lastStats = stats;
+        lastTime = currentTime;
+    }
+
+    running = false;
+    for (auto& producer : producers) {
+        producer.join();
+    }
+    if (poller.joinable()) {
+        poller.join();
+    }
+    if (jitterLoop.joinable()) {
+        jitterLoop.join();
+    }
+#ifndef _WIN32
+    if (eventLoopThread.joinable()) {
+        eventLoopThread.join();
+    }
+#endif
+    for (auto& subscriber : subscribers) {
+        liveGrapher.Unsubscribe(subscriber);
+    }
+    for (auto& consumer : consumers) {
+        consumer.join();
+    }
+
+    auto stats = liveGrapher.GetStats();
+    double elapsed =
+        std::chrono::duration<double>(clock::now() - startTime).count();
+    std::cout << "total: " << stats.samplesAdded << " samples in " << elapsed
+              << " s (" << stats.samplesAdded / elapsed
+              << " samples/s), dropped: " << stats.samplesDropped
+              << ", suppressed: " << stats.samplesSuppressed
+              << ", evicted: " << stats.clientsEvicted << '\n';
 }
@@ -0,0 +1,161 @@
+// Copyright (c) 2020 FRC Team 3512. All Rights Reserved.
+
+// Extracts the samples retained in a flight recorder file written by
+// LiveGrapher::EnableFlightRecorder().
+//
+// Usage: FlightRecorderDump <recorder file> <output file>
+//
+// If the output filename ends in ".csv", the samples are written in the same
+// CSV format as the LiveGrapher client's CSV export. Otherwise, they're written
+// to a new flight recorder file that contains only the valid samples in order,
+// which can be replayed with LiveGrapherReplay.
+
+#include <stdint.h>
+
+#include <algorithm>
+#include <array>
+#include <exception>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "livegrapher/FlightRecorder.hpp"
+
+/**
+ * Writes the samples to a CSV file.
+ *
+ * @param reader The flight recorder to read from.
+ * @param path   The path of the CSV file.
+ * @return The number of samples written.
+ */
+uint64_t WriteCSV(const FlightRecorderReader& reader, const std::string& path) {
+    // Collate all data in a format easier written to CSV. Each time entry has
+    // one column per dataset name, since a graph ID can be reused by another
+    // dataset during the recording.
+    std::map<uint64_t, std::vector<std::optional<float>>> csvData;
+    std::vector<std::string> columns;
+    std::map<std::string, size_t> columnIndices;
+    FlightRecorderNames names{reader};
+    uint64_t count = 0;
+
+    FlightRecorderSample sample;
+    for (uint64_t i = reader.Begin(); i < reader.End(); ++i) {
+        if (!reader.Read(i, sample)) {
+            continue;
+        }
+
+        const auto& name = names.Get(sample);
+        auto [column, inserted] =
+            columnIndices.try_emplace(name, columns.size());
+        if (inserted) {
+            columns.emplace_back(name);
+        }
+
+        auto& values = csvData[sample.time];
+        values.resize(std::max(values.size(), column->second + 1));
+        values[column->second] = sample.value;
+        ++count;
+    }
+
+    std::ofstream saveFile{path, std::ofstream::trunc};
+    if (!saveFile.is_open()) {
+        throw std::runtime_error("failed to open " + path);
+    }
+
+    // Write X axis label, then data labels
+    saveFile << "Time (s)";
+    for (const auto& column : columns) {
+        saveFile << ',' << column;
+    }
+    saveFile << '\n';
+
+    // Times are written relative to the oldest retained sample like the
+    // client does
+    uint64_t startTime = csvData.empty() ? 0 : csvData.begin()->first;
+    for (const auto& [time, values] : csvData) {
+        saveFile << (time - startTime) / 1000.f;
+        for (size_t column = 0; column < columns.size(); ++column) {
+            saveFile << ',';
+            if (column < values.size() && values[column].has_value()) {
+                saveFile << values[column].value();
+            }
+        }
+        saveFile << '\n';
+    }
+
+    return count;
+}
+
+/**
+ * Writes the valid samples to a new flight recorder file in order.
+ *
+ * @param reader The flight recorder to read from.
+ * @param path   The path of the new flight recorder file.
+ * @return The number of samples written.
+ */
+uint64_t WriteRecorder(const FlightRecorderReader& reader,
+                       const std::string& path) {
+    // The end index is sampled once so both passes agree if the recorder is
+    // still being written
+    uint64_t begin = reader.Begin();
+    uint64_t end = reader.End();
+
+    FlightRecorderSample sample;
+    uint64_t count = 0;
+    for (uint64_t i = begin; i < end; ++i) {
+        if (reader.Read(i, sample)) {
+            ++count;
+        }
+    }
+
+    // Names are recorded again wherever a graph ID's name changes, so each
+    // sample keeps its name
+    FlightRecorder output{path, count};
+    std::array<std::optional<std::string>, 64> outputNames;
+    FlightRecorderNames names{reader};
+
+    // A sample can be overwritten between the passes, so count them again
+    uint64_t written = 0;
+    for (uint64_t i = begin; i < end && written < count; ++i) {
+        if (reader.Read(i, sample)) {
+            const auto& name = names.Get(sample);
+            if (outputNames[sample.id] != name) {
+                output.SetName(sample.id, name);
+                outputNames[sample.id] = name;
+            }
+            output.Write(sample.id, sample.time, sample.value);
+            ++written;
+        }
+    }
+
+    return written;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc != 3) {
+        std::cerr << "usage: " << argv[0]
+                  << " <recorder file> <output file (.csv or recorder)>\n";
+        return 1;
+    }
+
+    try {
+        FlightRecorderReader reader{argv[1]};
+        std::string output = argv[2];
+
+        uint64_t count;
+        if (output.size() >= 4 && output.substr(output.size() - 4) == ".csv") {
+            count = WriteCSV(reader, output);
+        } else {
+            count = WriteRecorder(reader, output);
+        }
+
+        std::cout << "Extracted " << count << " samples to " << output << '\n';
+    } catch (const std::exception& e) {
+        std::cerr << argv[0] << ": " << e.what() << '\n';
+        return 1;
+    }
+}
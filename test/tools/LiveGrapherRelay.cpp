@@ -0,0 +1,381 @@
+// Copyright (c) 2020 FRC Team 3512. All Rights Reserved.
+
+// Relays the datasets of several LiveGrapher hosts to any number of clients.
+//
+// Usage: LiveGrapherRelay [options] <name>=<address>:<port>...
+//
+// The relay connects to each upstream host once, receives all of its datasets,
+// and serves them under "<name>/<dataset>" to clients using the normal
+// protocol. The robot's bandwidth and CPU use then don't depend on how many
+// clients are watching, and history and recording happen on the relay.
+//
+// Options:
+//   --port <port>       Port on which to listen for clients (default: 3513)
+//   --resume <samples>  Retain the given number of samples so clients can
+//                       resume after a reconnect (default: disabled)
+//   --record <file>     Record every relayed sample to a flight recorder file
+//                       (default: disabled)
+
+#include <stdint.h>
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <iostream>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "livegrapher/LiveGrapher.hpp"
+#include "livegrapher/Protocol.hpp"
+#include "livegrapher/TcpSocket.hpp"
+
+using namespace std::chrono_literals;
+
+// Number of samples kept by --record (16 MB)
+constexpr size_t kRecorderCapacity = 1 << 20;
+
+// Time between attempts to reconnect to an upstream host
+constexpr auto kReconnectPeriod = 1s;
+
+// Time without a response from an upstream host after which the connection is
+// considered dead. The host sends heartbeats while it's idle, so a live
+// connection is never silent for this long.
+constexpr auto kUpstreamTimeout = 5s;
+
+// Serializes console output from the upstream threads
+std::mutex consoleMutex;
+
+/**
+ * A connection to one upstream host whose datasets are added to the relay's
+ * host.
+ */
+class Upstream {
+public:
+    /**
+     * Constructs an Upstream.
+     *
+     * @param grapher The host through which to serve the datasets.
+     * @param name    The prefix of the upstream's dataset names.
+     * @param address The IPv4 address of the upstream host.
+     * @param port    The port of the upstream host.
+     */
+    Upstream(LiveGrapher& grapher, std::string name, std::string address,
+             uint16_t port)
+        : m_grapher{grapher},
+          m_name{std::move(name)},
+          m_address{std::move(address)},
+          m_port{port} {}
+
+    /**
+     * Connects to the upstream host and relays its samples, reconnecting
+     * whenever the connection is lost. Never returns.
+     */
+    void Run() {
+        while (true) {
+            TcpSocket socket;
+            if (socket.Connect(m_address, m_port)) {
+                socket.SetDeadPeerTimeout(kUpstreamTimeout);
+                Log("connected");
+                Relay(socket);
+                Log("disconnected");
+            }
+
+            // The relay keeps serving the upstream's datasets while it's gone,
+            // so clients keep their selection over short outages. The names
+            // are relisted after reconnecting since graph IDs may change.
+            m_names.fill({});
+            m_timeOffset.reset();
+            std::this_thread::sleep_for(kReconnectPeriod);
+        }
+    }
+
+private:
+    LiveGrapher& m_grapher;
+    std::string m_name;
+    std::string m_address;
+    uint16_t m_port;
+
+    // Relay dataset names indexed by upstream graph ID
+    std::array<std::string, 64> m_names;
+
+    // Relay time minus upstream time in milliseconds, which puts the samples
+    // of all upstreams on the relay's clock. Measured with the first sample of
+    // each connection.
+    std::optional<int64_t> m_timeOffset;
+
+    /**
+     * Prints a message about this upstream.
+     *
+     * @param message The message.
+     */
+    void Log(std::string_view message) {
+        std::scoped_lock lock(consoleMutex);
+        std::cout << m_name << " (" << m_address << ':' << m_port
+                  << "): " << message << std::endl;
+    }
+
+    /**
+     * Subscribes to every dataset and relays samples until the connection
+     * fails.
+     *
+     * @param socket The connected socket.
+     */
+    void Relay(TcpSocket& socket) {
+        // The hello asks for the original data packet format so the relay
+        // works regardless of either machine's byte order. The list request
+        // is answered after the hello response and the catalog subscription.
+        std::string request = {static_cast<char>(kHostHelloPacket),
+                               static_cast<char>(0xC0 | kProtocolVersion),
+                               static_cast<char>(0xC0)};
+        request += static_cast<char>(kHostCatalogSubscribePacket);
+        AppendNetworkOrder<uint32_t>(request, 0);
+        request += static_cast<char>(kHostListPacket);
+        if (!socket.WriteBlocking(request)) {
+            return;
+        }
+
+        while (true) {
+            char id;
+            if (!socket.Read(&id, 1)) {
+                return;
+            }
+
+            uint8_t graphID = id & 0x3F;
+            switch (id & 0xC0) {
+                case kClientDataPacket: {
+                    char buf[sizeof(uint64_t) + sizeof(uint32_t)];
+                    if (!socket.Read(buf, sizeof(buf))) {
+                        return;
+                    }
+                    RelaySample(graphID, ReadNetworkOrder<uint64_t>(buf),
+                                ReadNetworkOrder<uint32_t>(buf + 8));
+                    break;
+                }
+                case kClientListPacket: {
+                    char length;
+                    if (!socket.Read(&length, 1)) {
+                        return;
+                    }
+                    std::string name(static_cast<uint8_t>(length), '\0');
+                    char eof;
+                    if (!socket.Read(name.data(), name.size()) ||
+                        !socket.Read(&eof, 1) ||
+                        !AddDataset(socket, graphID, name)) {
+                        return;
+                    }
+                    break;
+                }
+                case kClientExtendedPacket: {
+                    char lengthBuf[sizeof(uint32_t)];
+                    if (!socket.Read(lengthBuf, sizeof(lengthBuf))) {
+                        return;
+                    }
+                    uint32_t length = ReadNetworkOrder<uint32_t>(lengthBuf);
+
+                    // The packets the relay handles are small, so larger
+                    // ones, like trigger captures, are skipped instead of
+                    // buffered
+                    if (length > kMaxHostExtendedLength) {
+                        if (!Skip(socket, length)) {
+                            return;
+                        }
+                        break;
+                    }
+
+                    std::string payload(length, '\0');
+                    if (!socket.Read(payload.data(), payload.size()) ||
+                        !HandleExtendedPacket(socket, id, payload)) {
+                        return;
+                    }
+                    break;
+                }
+                default:
+                    // The stream can't be resynchronized after an unknown
+                    // packet
+                    Log("received unknown packet type");
+                    return;
+            }
+        }
+    }
+
+    /**
+     * Discards bytes received from the upstream host.
+     *
+     * @param socket The connected socket.
+     * @param count  The number of bytes to discard.
+     * @return False if the connection failed.
+     */
+    bool Skip(TcpSocket& socket, size_t count) {
+        std::array<char, 4096> buf;
+        while (count > 0) {
+            size_t length = std::min(count, buf.size());
+            if (!socket.Read(buf.data(), length)) {
+                return false;
+            }
+            count -= length;
+        }
+        return true;
+    }
+
+    /**
+     * Handles an extended packet from the upstream host.
+     *
+     * @param socket  The connected socket.
+     * @param id      The packet ID.
+     * @param payload The packet payload.
+     * @return False if the connection failed.
+     */
+    bool HandleExtendedPacket(TcpSocket& socket, uint8_t id,
+                              std::string_view payload) {
+        if (id == kClientDatasetAddedPacket && !payload.empty()) {
+            return AddDataset(socket, payload[0] & 0x3F, payload.substr(1));
+        } else if (id == kClientDatasetRemovedPacket && !payload.empty()) {
+            auto& name = m_names[payload[0] & 0x3F];
+            if (!name.empty()) {
+                m_grapher.Unregister(name);
+                name.clear();
+            }
+        }
+
+        // Other packets, like heartbeats, don't need handling
+        return true;
+    }
+
+    /**
+     * Names an upstream dataset and subscribes to its samples.
+     *
+     * @param socket The connected socket.
+     * @param id     The upstream graph ID.
+     * @param name   The upstream dataset name.
+     * @return False if the connection failed.
+     */
+    bool AddDataset(TcpSocket& socket, uint8_t id, std::string_view name) {
+        m_names[id] = m_name + '/' + std::string{name};
+        char connect = static_cast<char>(kHostConnectPacket | id);
+        return socket.WriteBlocking({&connect, 1});
+    }
+
+    /**
+     * Adds a sample from the upstream host to the relay's host.
+     *
+     * @param id    The upstream graph ID.
+     * @param time  The upstream x value in milliseconds.
+     * @param value The y value's bits.
+     */
+    void RelaySample(uint8_t id, uint64_t time, uint32_t value) {
+        const auto& name = m_names[id];
+        if (name.empty()) {
+            return;
+        }
+
+        auto now = std::chrono::duration_cast<std::chrono::milliseconds>(
+                       std::chrono::steady_clock::now().time_since_epoch())
+                       .count();
+        if (!m_timeOffset) {
+            m_timeOffset = now - static_cast<int64_t>(time);
+        }
+
+        float y;
+        std::memcpy(&y, &value, sizeof(y));
+        m_grapher.AddData(name,
+                          std::chrono::milliseconds{static_cast<int64_t>(time) +
+                                                    m_timeOffset.value()},
+                          y);
+    }
+};
+
+/**
+ * Parses an upstream in the form <name>=<address>:<port>.
+ *
+ * @param spec    The upstream specification.
+ * @param name    Set to the name.
+ * @param address Set to the address.
+ * @param port    Set to the port.
+ * @return True if the specification was valid.
+ */
+bool ParseUpstream(std::string_view spec, std::string& name,
+                   std::string& address, uint16_t& port) {
+    size_t equals = spec.find('=');
+    size_t colon = spec.rfind(':');
+    if (equals == 0 || equals == std::string_view::npos ||
+        colon == std::string_view::npos || colon < equals + 2 ||
+        colon + 1 == spec.size()) {
+        return false;
+    }
+
+    name = spec.substr(0, equals);
+    address = spec.substr(equals + 1, colon - equals - 1);
+    port = static_cast<uint16_t>(
+        std::atoi(std::string{spec.substr(colon + 1)}.c_str()));
+    return port != 0;
+}
+
+int main(int argc, char* argv[]) {
+    uint16_t port = 3513;
+    int resumeCapacity = 0;
+    std::string recordFile;
+
+    struct UpstreamSpec {
+        std::string name;
+        std::string address;
+        uint16_t port;
+    };
+    std::vector<UpstreamSpec> specs;
+
+    bool valid = true;
+    for (int i = 1; i < argc && valid; ++i) {
+        std::string_view arg = argv[i];
+        if (arg == "--port" && i + 1 < argc) {
+            port = static_cast<uint16_t>(std::atoi(argv[++i]));
+        } else if (arg == "--resume" && i + 1 < argc) {
+            resumeCapacity = std::atoi(argv[++i]);
+        } else if (arg == "--record" && i + 1 < argc) {
+            recordFile = argv[++i];
+        } else {
+            auto& spec = specs.emplace_back();
+            valid = ParseUpstream(arg, spec.name, spec.address, spec.port);
+        }
+    }
+
+    if (!valid || specs.empty() || resumeCapacity < 0) {
+        std::cerr << "usage: " << argv[0]
+                  << " [--port <port>] [--resume <samples>] [--record <file>]"
+                     "\n    <name>=<address>:<port>...\n";
+        return 1;
+    }
+
+    try {
+        LiveGrapher grapher{port};
+        if (resumeCapacity > 0) {
+            grapher.EnableResume(resumeCapacity);
+        }
+        if (!recordFile.empty()) {
+            grapher.EnableFlightRecorder(recordFile, kRecorderCapacity);
+        }
+
+        // Each upstream gets a thread that blocks on its socket
+        std::vector<Upstream> upstreams;
+        for (const auto& spec : specs) {
+            upstreams.emplace_back(grapher, spec.name, spec.address,
+                                   spec.port);
+        }
+        std::vector<std::thread> threads;
+        for (auto& upstream : upstreams) {
+            threads.emplace_back([&] { upstream.Run(); });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+    } catch (const std::exception& e) {
+        std::cerr << argv[0] << ": " << e.what() << '\n';
+        return 1;
+    }
+}
@@ -0,0 +1,322 @@
+// Copyright (c) 2020 FRC Team 3512. All Rights Reserved.
+
+// Serves recorded samples to LiveGrapher clients as if they were coming from a
+// robot.
+//
+// Usage: LiveGrapherReplay [options] <file>
+//
+// The file can be a flight recorder file (see FlightRecorderDump) or a CSV
+// file exported by the LiveGrapher client. It's memory-mapped and streamed, so
+// recordings larger than memory can be replayed.
+//
+// Options:
+//   --port <port>    Port on which to listen for clients (default: 3513)
+//   --speed <speed>  Playback speed multiplier, or "max" to send samples as
+//                    fast as possible (default: 1)
+//   --loop           Restart from the beginning when the end is reached
+//   --wait           Register the recording's datasets and start playback once
+//                    a client selects one of them
+
+#include <stdint.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "livegrapher/FlightRecorder.hpp"
+#include "livegrapher/LiveGrapher.hpp"
+#include "livegrapher/MappedFile.hpp"
+
+using namespace std::chrono_literals;
+
+/**
+ * Paces samples according to their timestamps and the playback speed.
+ */
+class Player {
+public:
+    /**
+     * Constructs a Player.
+     *
+     * @param grapher The host through which to serve the samples.
+     * @param speed   The playback speed multiplier. Zero plays back as fast as
+     *                possible.
+     */
+    Player(LiveGrapher& grapher, double speed)
+        : m_grapher{grapher}, m_speed{speed} {}
+
+    /**
+     * Sends a sample once its time has come.
+     *
+     * @param name  The name of the dataset.
+     * @param time  The recorded time of the sample in milliseconds.
+     * @param value The value of the sample.
+     */
+    void Play(const std::string& name, uint64_t time, float value) {
+        if (!m_started) {
+            m_firstTime = time;
+            m_startTime = std::chrono::steady_clock::now();
+            m_started = true;
+        }
+
+        if (m_speed > 0.0 && time > m_firstTime) {
+            std::chrono::duration<double, std::milli> elapsed{
+                (time - m_firstTime) / m_speed};
+            std::this_thread::sleep_until(
+                m_startTime +
+                std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                    elapsed));
+        }
+
+        // Shift the timestamps of later loops so time keeps increasing
+        m_lastTime = time + m_timeOffset;
+        m_grapher.AddData(name, std::chrono::milliseconds{m_lastTime}, value);
+        ++m_count;
+    }
+
+    /**
+     * Starts the next loop of the recording after the last sample played.
+     */
+    void Rewind() {
+        m_timeOffset = m_lastTime + 1 - m_firstTime;
+        m_firstTime = 0;
+        m_started = false;
+    }
+
+    /**
+     * Returns the number of samples sent.
+     */
+    uint64_t Count() const { return m_count; }
+
+private:
+    LiveGrapher& m_grapher;
+    double m_speed;
+
+    bool m_started = false;
+    uint64_t m_firstTime = 0;
+    uint64_t m_lastTime = 0;
+    uint64_t m_timeOffset = 0;
+    std::chrono::steady_clock::time_point m_startTime;
+    uint64_t m_count = 0;
+};
+
+/**
+ * Plays the samples in a flight recorder file.
+ *
+ * @param reader The flight recorder file.
+ * @param player The player through which to send the samples.
+ */
+void PlayRecorder(const FlightRecorderReader& reader, Player& player) {
+    // Samples are played under the name their dataset had when they were
+    // recorded, since graph IDs can be reused. Samples whose name wasn't
+    // recorded are played under a name like the client's default one.
+    FlightRecorderNames names{reader};
+
+    FlightRecorderSample sample;
+    for (uint64_t i = reader.Begin(); i < reader.End(); ++i) {
+        if (reader.Read(i, sample)) {
+            player.Play(names.Get(sample), sample.time, sample.value);
+        }
+    }
+}
+
+/**
+ * Splits the next line off the front of the given text.
+ *
+ * @param text The remaining text.
+ */
+std::string_view NextLine(std::string_view& text) {
+    size_t end = text.find('\n');
+    auto line = text.substr(0, end);
+    text.remove_prefix(end == std::string_view::npos ? text.size() : end + 1);
+    if (!line.empty() && line.back() == '\r') {
+        line.remove_suffix(1);
+    }
+    return line;
+}
+
+/**
+ * Splits the next comma-separated field off the front of the given line.
+ *
+ * @param line The remaining line.
+ */
+std::string_view NextField(std::string_view& line) {
+    size_t end = line.find(',');
+    auto field = line.substr(0, end);
+    line.remove_prefix(end == std::string_view::npos ? line.size() : end + 1);
+    return field;
+}
+
+/**
+ * Parses a floating point number from a field.
+ *
+ * @param field The field.
+ */
+double ParseNumber(std::string_view field) {
+    // strtod() needs a null-terminated string and the mapping may not have one
+    char buf[64];
+    size_t length = std::min(field.size(), sizeof(buf) - 1);
+    std::memcpy(buf, field.data(), length);
+    buf[length] = '\0';
+    return std::strtod(buf, nullptr);
+}
+
+/**
+ * Splits the header off the front of a CSV file exported by the client and
+ * returns its dataset names.
+ *
+ * @param text The remaining text.
+ */
+std::vector<std::string> CSVNames(std::string_view& text) {
+    // The first column of the header is the time axis label
+    auto header = NextLine(text);
+    NextField(header);
+    std::vector<std::string> names;
+    while (!header.empty()) {
+        names.emplace_back(NextField(header));
+    }
+    return names;
+}
+
+/**
+ * Plays the samples in a CSV file exported by the client.
+ *
+ * @param file   The CSV file.
+ * @param player The player through which to send the samples.
+ */
+void PlayCSV(const MappedFile& file, Player& player) {
+    std::string_view text{file.Data(), file.Size()};
+    auto names = CSVNames(text);
+
+    while (!text.empty()) {
+        auto line = NextLine(text);
+        if (line.empty()) {
+            continue;
+        }
+
+        // Times are stored in seconds
+        auto time =
+            static_cast<uint64_t>(ParseNumber(NextField(line)) * 1000.0 + 0.5);
+        for (size_t i = 0; i < names.size() && !line.empty(); ++i) {
+            auto field = NextField(line);
+
+            // Empty cells mean the dataset had no sample at this time
+            if (!field.empty()) {
+                player.Play(names[i], time,
+                            static_cast<float>(ParseNumber(field)));
+            }
+        }
+    }
+}
+
+/**
+ * Registers the datasets of a recording, then blocks until a client selects
+ * one of them.
+ *
+ * Clients can only select datasets that are registered, and samples sent
+ * before a dataset is selected are lost, so playback waits for this.
+ *
+ * @param grapher  The host through which to serve the samples.
+ * @param filename The recording.
+ * @param isCSV    True if the recording is a CSV file.
+ */
+void WaitForClient(LiveGrapher& grapher, const std::string& filename,
+                   bool isCSV) {
+    std::vector<std::string> names;
+    if (isCSV) {
+        MappedFile file{filename};
+        std::string_view text{file.Data(), file.Size()};
+        names = CSVNames(text);
+    } else {
+        names = FlightRecorderReader{filename}.Names();
+    }
+    for (const auto& name : names) {
+        if (!name.empty()) {
+            grapher.Register(name);
+        }
+    }
+
+    std::cout << "Waiting for a client to select a dataset" << std::endl;
+    while (true) {
+        auto clients = grapher.GetStats().clients;
+        if (std::any_of(clients.begin(), clients.end(),
+                        [](const auto& client) { return client.selection; })) {
+            return;
+        }
+        std::this_thread::sleep_for(100ms);
+    }
+}
+
+int main(int argc, char* argv[]) {
+    uint16_t port = 3513;
+    double speed = 1.0;
+    bool loop = false;
+    bool wait = false;
+    std::string filename;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string_view arg = argv[i];
+        if (arg == "--port" && i + 1 < argc) {
+            port = static_cast<uint16_t>(std::atoi(argv[++i]));
+        } else if (arg == "--speed" && i + 1 < argc) {
+            std::string_view value = argv[++i];
+            speed = value == "max" ? 0.0 : std::atof(argv[i]);
+        } else if (arg == "--loop") {
+            loop = true;
+        } else if (arg == "--wait") {
+            wait = true;
+        } else if (filename.empty() && arg.substr(0, 2) != "--") {
+            filename = arg;
+        } else {
+            filename.clear();
+            break;
+        }
+    }
+
+    if (filename.empty() || speed < 0.0) {
+        std::cerr << "usage: " << argv[0]
+                  << " [--port <port>] [--speed <speed>|max] [--loop] [--wait]"
+                     " <file>\n";
+        return 1;
+    }
+
+    try {
+        LiveGrapher grapher{port};
+        Player player{grapher, speed};
+
+        bool isCSV = filename.size() >= 4 &&
+                     filename.substr(filename.size() - 4) == ".csv";
+
+        if (wait) {
+            WaitForClient(grapher, filename, isCSV);
+        }
+
+        auto startTime = std::chrono::steady_clock::now();
+        do {
+            if (isCSV) {
+                PlayCSV(MappedFile{filename}, player);
+            } else {
+                PlayRecorder(FlightRecorderReader{filename}, player);
+            }
+            player.Rewind();
+        } while (loop);
+
+        std::chrono::duration<double> elapsed =
+            std::chrono::steady_clock::now() - startTime;
+        std::cout << "Replayed " << player.Count() << " samples in "
+                  << elapsed.count() << " s ("
+                  << player.Count() / elapsed.count() << " samples/s)\n";
+
+        // Give the network thread a chance to flush queued samples
+        std::this_thread::sleep_for(1s);
+    } catch (const std::exception& e) {
+        std::cerr << argv[0] << ": " << e.what() << '\n';
+        return 1;
+    }
+}